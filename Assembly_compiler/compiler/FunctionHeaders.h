@@ -17,16 +17,68 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <conio.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 /**
  * @defgroup MemoryConstants Memory Configuration Constants
  * @{
  */
-#define STACK_SIZE 100              /**< Maximum stack size for nested control structures */
+#define STACK_SIZE 100              /**< Initial capacity of the stack for nested control structures */
 #define MEMORY_SIZE 100             /**< Total memory size for the virtual machine */
 #define VARIABLE_MEMORY_START 8     /**< Starting address for variables (0-7 reserved for registers) */
 #define CONST_VARIABLE_SIZE 0       /**< Size indicator for constants */
+#define CALL_STACK_SIZE 256         /**< Default depth of the return stack for CALL */
+/** @} */
+
+/**
+ * @defgroup ExecutionStatus Execution Status Codes
+ * @{
+ */
+#define EXEC_FINISHED 0             /**< Program ran to its end */
+#define EXEC_INSTRUCTION_LIMIT 1    /**< Stopped at the instruction limit */
+#define EXEC_TIME_LIMIT 2           /**< Stopped at the time limit */
+#define EXEC_RETURN_STACK 3         /**< Stopped on a return stack overflow or a RET without CALL */
+#define EXEC_INVALID_CODE 4         /**< Stopped at code that failed lazy compilation or verification */
+#define EXEC_THREAD_ERROR 5         /**< Stopped at a SPAWN that could not start a thread */
+#define EXEC_BREAKPOINT 6           /**< Stopped at a trap patched in by the debugger */
+#define TIME_CHECK_INTERVAL 1024    /**< Backward jumps between clock reads */
+/** @} */
+
+/**
+ * @defgroup ThreadConstants VM Thread Constants
+ * @{
+ */
+#define THREAD_MAX 64               /**< VM threads a program can run at once, including the main thread */
+#define THREAD_MEMORY_SIZE (MEMORY_SIZE + (THREAD_MAX - 1) * VARIABLE_MEMORY_START) /**< Memory plus a register bank per spawned thread */
+/** @} */
+
+/**
+ * @defgroup AtomicOperations Atomic Operations
+ * 
+ * Read-modify-write operations on memory cells shared between VM threads,
+ * for XADD and CAS. Both are full barriers and give the old value.
+ * @{
+ */
+#ifdef _WIN32
+#define ATOMIC_XADD(cell, value) \
+    ((int)InterlockedExchangeAdd((volatile long*)(cell), (long)(value)))   /**< Add, giving the old value */
+#define ATOMIC_CAS(cell, expected, desired) \
+    ((int)InterlockedCompareExchange((volatile long*)(cell), (long)(desired), (long)(expected))) /**< Compare and swap, giving the old value */
+#else
+#define ATOMIC_XADD(cell, value) __sync_fetch_and_add((cell), (value))   /**< Add, giving the old value */
+#define ATOMIC_CAS(cell, expected, desired) \
+    __sync_val_compare_and_swap((cell), (expected), (desired))        /**< Compare and swap, giving the old value */
+#endif
+/** @} */
+
+/**
+ * @defgroup WatchConstants Watch Mode Constants
+ * @{
+ */
+#define WATCH_POLL_INTERVAL 200     /**< Milliseconds between checks for source changes */
 /** @} */
 
 /**
@@ -36,10 +88,67 @@
 #define INSTRUCTION_LENGTH 6        /**< Maximum length of instruction mnemonics */
 #define PARAMETERS_LENGTH 25        /**< Maximum length of instruction parameters */
 #define LINE_SIZE 25                /**< Maximum length of a line in the source file */
+#define FILENAME_SIZE 256           /**< Size of the buffer for a filename typed at the prompt */
 #define VARIABLE_LENGTH 5           /**< Maximum length of variable names */
 #define LABEL_LENGTH 5              /**< Maximum length of label names */
 /** @} */
 
+/**
+ * @defgroup ObjectConstants Object File Layout Constants
+ * @{
+ */
+#define OBJECT_PARAMS_WIDTH 20      /**< Width of the parameter column in output.obj */
+#define OBJECT_ROW_WIDTH (5 + 1 + 5 + 1 + OBJECT_PARAMS_WIDTH + 1) /**< Length of one instruction row */
+/** @} */
+
+/**
+ * @defgroup StatsPhases Statistics Phases
+ * @{
+ */
+#define STATS_DECLARATIONS 0        /**< Declarations before START: */
+#define STATS_INSTRUCTIONS 1        /**< Instruction code generation, or the lazy scan */
+#define STATS_BACKPATCH 2           /**< ENDIF backpatching, part of STATS_INSTRUCTIONS */
+#define STATS_VERIFY 3              /**< Verification */
+#define STATS_OPTIMIZE 4            /**< Optimizer passes */
+#define STATS_DUMP 5                /**< Writing output.obj */
+#define STATS_EXECUTE 6             /**< Running the program, including lazy compilation */
+#define STATS_LINK 7                /**< Loading, relocating and merging objects */
+#define STATS_PHASES 8              /**< Number of phases */
+#define STATS_COUNTERS 4            /**< Hardware counters read around each phase */
+#define STATS_REPORT_FILE "output.stats.json" /**< Report written next to output.obj */
+/** @} */
+
+/**
+ * @defgroup ImageConstants Program Image Constants
+ * @{
+ */
+#define IMAGE_MAGIC "ASMI"          /**< First bytes of a program image */
+#define IMAGE_VERSION 1             /**< Layout version of program images */
+#define IMAGE_ALIGNMENT 65536       /**< Alignment of the data segment, a multiple of the mapping granularity */
+/** @} */
+
+/**
+ * @defgroup RelocatableObjectConstants Relocatable Object Constants
+ * @{
+ */
+#define OBJECT_MAGIC "ASMO"         /**< First bytes of a relocatable object */
+#define OBJECT_VERSION 1            /**< Layout version of relocatable objects */
+#define OBJECT_LABEL 1              /**< Exported symbol is a label */
+#define OBJECT_DATA 2               /**< Exported symbol is a DATA or CONST variable */
+#define IMPORT_ADDRESS_BASE 65536   /**< First operand value standing for an imported symbol */
+#define IMPORT_ADDRESS_SPAN 256     /**< Operand values per import, for indexes into imported arrays */
+/** @} */
+
+/**
+ * @defgroup DaemonConstants Daemon Constants
+ * @{
+ */
+#define DAEMON_WORKERS 4            /**< Default number of worker threads */
+#define DAEMON_QUEUE_SIZE 64        /**< Connections waiting for a worker */
+#define DAEMON_PATH_LENGTH 4096     /**< Maximum length of a source path in a request */
+#define DAEMON_MAX_INPUT (64L * 1024 * 1024) /**< Maximum size of the input sent with a request */
+/** @} */
+
 /**
  * @defgroup SpecialValues Special Values
  * @{
@@ -47,6 +156,34 @@
 #define WILDCARD_VALUE -2           /**< Special value representing a wildcard (*) */
 /** @} */
 
+/**
+ * @defgroup OperandKinds Operand Kinds
+ * @{
+ */
+#define OPERAND_NONE 0              /**< Parameter slot is unused */
+#define OPERAND_READ 1              /**< Memory address that is read */
+#define OPERAND_WRITE 2             /**< Memory address that is written */
+#define OPERAND_UPDATE 3            /**< Memory address that is read and written (READ | WRITE) */
+#define OPERAND_TARGET 4            /**< Instruction number of a branch target */
+#define OPERAND_CONDITION 8         /**< Condition code (OP_EQ, OP_LT, etc.) */
+#define OPERAND_COUNT 16            /**< Number of cells covered by the address in the previous slot */
+#define OPERAND_IMMEDIATE 32        /**< Literal value, not an address; may be -1 */
+/** @} */
+
+#define LIVE_WORDS ((MEMORY_SIZE + 31) / 32) /**< Words needed for one bit per memory cell */
+#define INLINE_MAX_LENGTH 8         /**< Longest subroutine body the optimizer inlines */
+
+/**
+ * @defgroup SsaValueKinds SSA Value Kinds
+ * @{
+ */
+#define SSA_ENTRY 0                 /**< Value of a cell when the program starts */
+#define SSA_PHI 1                   /**< Value of a cell where control flow merges */
+#define SSA_COPY 2                  /**< Copy of another value (MOV, or FOR setting its counter) */
+#define SSA_EXPR 3                  /**< ADD, SUB, MUL, SHL or an immediate operation on other values */
+#define SSA_OPAQUE 4                /**< Value that is unlike any other (READ, LOOP, CALL, ...) */
+/** @} */
+
 /**
  * @defgroup OpCodes Instruction OpCodes
  * @{
@@ -67,6 +204,30 @@
 #define OP_READ 14                  /**< Read operation */
 #define OP_ENDIF 15                 /**< End of conditional block */
 #define OP_END 16                   /**< End of program */
+#define OP_LOOP 17                  /**< Decrement counter and branch if not zero */
+#define OP_FOR 18                   /**< Start of a counted FOR loop */
+#define OP_NEXT 19                  /**< Increment FOR counter and branch back while in range */
+#define OP_CALL 20                  /**< Call a subroutine */
+#define OP_RET 21                   /**< Return from a subroutine */
+#define OP_READ_JUMP 22             /**< Read, or jump to a label at the end of input */
+#define OP_READ_ARRAY 23            /**< Read every element of an array */
+#define OP_PRINT_ARRAY 24           /**< Print every element of an array */
+#define OP_COMPILE 25               /**< Not compiled yet: compile the block on first entry */
+#define OP_SHL 26                   /**< Shift left by an immediate count (strength-reduced MUL) */
+#define OP_LOAD_IMM 27              /**< Store an immediate value */
+#define OP_IF_EQ 28                 /**< IF with the EQ comparison built in */
+#define OP_IF_LT 29                 /**< IF with the LT comparison built in */
+#define OP_IF_GT 30                 /**< IF with the GT comparison built in */
+#define OP_IF_LTEQ 31               /**< IF with the LTEQ comparison built in */
+#define OP_IF_GTEQ 32               /**< IF with the GTEQ comparison built in */
+#define OP_ADD_IMM 33               /**< Add an immediate value (also used for SUB) */
+#define OP_MUL_IMM 34               /**< Multiply by an immediate value */
+#define OP_IF_NE 35                 /**< IF with an inequality built in (inverted IF_EQ, from profile layout) */
+#define OP_SPAWN 36                 /**< Start a VM thread at a subroutine */
+#define OP_JOIN 37                  /**< Wait for the threads this thread spawned */
+#define OP_XADD 38                  /**< Atomic add to a cell, giving its old value */
+#define OP_CAS 39                   /**< Atomic compare and swap of a cell, giving its old value */
+#define OP_TRAP 40                  /**< Breakpoint patched over an instruction by the debugger */
 /** @} */
 
 /**
@@ -106,6 +267,567 @@ typedef struct {
     int instr_no;                   /**< Instruction number after the label */
 } blocks_table;
 
+/**
+ * @struct label_fixup
+ * @brief Branch to a label that was not defined yet
+ * 
+ * Recorded while compiling and filled in once all labels are known.
+ */
+typedef struct {
+    int instruction;                /**< Index of the branch in the intermediate table */
+    int slot;                       /**< Parameter index of the target */
+    const char *mnemonic;           /**< Instruction name for error messages */
+    char name[PARAMETERS_LENGTH];   /**< Name of the label */
+} label_fixup;
+
+/**
+ * @struct control_stack
+ * @brief Stack of open IF, ELSE and FOR instructions
+ * 
+ * Entries are indices into the intermediate table, so closing a structure
+ * patches its instructions directly. The stack grows as needed, so there
+ * is no limit on nesting depth.
+ */
+typedef struct {
+    int *entries;                   /**< Intermediate table indices, allocated on first push */
+    int top;                        /**< Index of the top entry, -1 when empty */
+    int capacity;                   /**< Number of entries allocated */
+} control_stack;
+
+/**
+ * @struct source_reader
+ * @brief Source the compiler reads lines from
+ * 
+ * Either a file or program text held in memory.
+ */
+typedef struct {
+    FILE *fp;                       /**< Source file, or NULL to read text */
+    const char *text;               /**< Next character of the text */
+    const char *end;                /**< End of the text */
+} source_reader;
+
+/**
+ * @brief Receives the values a program PRINTs
+ * 
+ * @param context Context given with the function
+ * @param values Values printed, one for PRINT or a whole array
+ * @param count Number of values
+ */
+typedef void (*vm_print_function)(void *context, const int *values, int count);
+
+/**
+ * @struct lazy_instruction
+ * @brief Instruction found by the lazy mode scan
+ * 
+ * Enough to compile the instruction later without reading the lines
+ * before it.
+ */
+typedef struct {
+    long offset;                    /**< File offset of the source line */
+    int target;                     /**< IF/ELSE/FOR/NEXT branch target worked out by the scan */
+    int partner;                    /**< Index of the FOR of a NEXT; -2 marks a FOR during the scan */
+} lazy_instruction;
+
+/**
+ * @struct vm_state
+ * @brief Execution state of the virtual machine
+ * 
+ * Holds everything needed to stop a running program at a limit and resume
+ * it later. The registers and variables live in the memory array; the
+ * code only points at instructions, so several states can share it.
+ */
+typedef struct {
+    const intermediate_lang *code;  /**< Instructions being run, shared and never written */
+    int code_length;                /**< Number of instructions */
+    int pc;                         /**< Index of the next instruction to execute */
+    long long executed;             /**< Instructions executed so far */
+    long instruction_limit;         /**< Stop after this many instructions, 0 for no limit */
+    long time_limit_ms;             /**< Stop after this many milliseconds, 0 for no limit */
+    long long elapsed_ms;           /**< Milliseconds spent running so far */
+    int status;                     /**< EXEC_* status of the last run */
+    int *return_stack;              /**< Return addresses of active CALLs, allocated on first use */
+    int return_depth;               /**< Number of active CALLs */
+    int return_stack_size;          /**< Maximum number of active CALLs */
+    const int *input;               /**< Values for READ, or NULL to read text from stdin */
+    long input_count;               /**< Number of values in input */
+    long input_position;            /**< Index of the next value READ takes from input */
+    FILE *output;                   /**< Stream PRINT writes to, stdout by default */
+    vm_print_function print;        /**< Receives PRINT values in place of output, or NULL; never called concurrently */
+    void *print_context;            /**< Context passed to print */
+    long long *branches_taken;      /**< Per instruction, times it branched; NULL when not profiling */
+    long long *branch_entries;      /**< Per instruction and the end, times execution arrived by a branch */
+    struct thread_group *threads;   /**< Threads of the program, NULL when it cannot spawn any */
+    int thread;                     /**< Slot of this thread in threads, 0 for the main thread */
+} vm_state;
+
+#ifdef _WIN32
+typedef void *thread_handle;        /**< HANDLE of an OS thread */
+#else
+typedef pthread_t thread_handle;    /**< OS thread */
+#endif
+
+/**
+ * @struct vm_thread
+ * @brief Slot of a thread group, running one spawned VM thread
+ */
+typedef struct {
+    vm_state state;                 /**< Execution state of the thread */
+    intermediate_lang *code;        /**< Code with the registers moved to the slot's bank, made on first use */
+    int parent;                     /**< Slot of the thread that spawned it */
+    int active;                     /**< 1 from SPAWN until the thread is joined */
+    thread_handle handle;           /**< OS thread running it */
+} vm_thread;
+
+/**
+ * @struct thread_group
+ * @brief VM threads of one run of a program
+ * 
+ * The threads share the memory array. The main thread has its registers
+ * in cells 0-7; the thread in slot k has them in the bank at
+ * MEMORY_SIZE + (k - 1) * VARIABLE_MEMORY_START.
+ */
+typedef struct thread_group {
+    const intermediate_lang *code;  /**< Code of the main thread */
+    int code_length;                /**< Number of instructions */
+    int *memory;                    /**< THREAD_MEMORY_SIZE cells shared by the threads */
+    volatile int lock;              /**< Spin lock guarding the slots */
+    volatile int print_lock;        /**< Spin lock serializing calls to the print function */
+    vm_thread slots[THREAD_MAX];    /**< Slot 0 stands for the main thread */
+} thread_group;
+
+/**
+ * @struct breakpoint
+ * @brief Instruction the debugger patched a trap into
+ */
+typedef struct {
+    int instruction;                /**< Index of the instruction */
+    int opcode;                     /**< Opcode the trap replaced */
+} breakpoint;
+
+/**
+ * @struct debug_session
+ * @brief Program being run under the debugger
+ */
+typedef struct {
+    intermediate_lang *code;        /**< Instructions, with the breakpoints patched in */
+    int code_length;                /**< Number of instructions */
+    int *memory;                    /**< Memory array of the program */
+    vm_state state;                 /**< Virtual machine, stopped between commands */
+    breakpoint *breakpoints;        /**< Breakpoints set */
+    int breakpoint_count;           /**< Number of breakpoints set */
+    int breakpoint_capacity;        /**< Number of breakpoints allocated */
+} debug_session;
+
+/**
+ * @struct asm_program
+ * @brief Program compiled by the library API
+ * 
+ * Holds its own copy of the code and the initial memory, so it stays
+ * valid when other programs are compiled and can be run any number of
+ * times, also concurrently.
+ */
+typedef struct {
+    intermediate_lang *code;        /**< Instructions, ready to run */
+    int code_length;                /**< Number of instructions */
+    int memory[MEMORY_SIZE];        /**< Initial memory array, with the CONST values */
+    symbol_table *symbols;          /**< Variables of the program */
+    int symbol_count;               /**< Number of variables */
+} asm_program;
+
+/**
+ * @struct asm_run_options
+ * @brief Input, output and limits of one run through the library API
+ * 
+ * A zeroed structure runs without input, limits or output.
+ */
+typedef struct {
+    const int *input;               /**< Values READ takes, or NULL for no input */
+    long input_count;               /**< Number of values in input */
+    vm_print_function print;        /**< Receives the PRINT values, or NULL to drop them */
+    void *print_context;            /**< Context passed to print */
+    long instruction_limit;         /**< Stop after this many instructions, 0 for no limit */
+    long time_limit_ms;             /**< Stop after this many milliseconds, 0 for no limit */
+    int call_stack_depth;           /**< Maximum number of active CALLs, 0 for CALL_STACK_SIZE */
+} asm_run_options;
+
+/**
+ * @struct asm_output_buffer
+ * @brief Caller-owned buffer collecting PRINT values, for asm_collect_output
+ */
+typedef struct {
+    int *values;                    /**< Values printed, in order */
+    long capacity;                  /**< Number of values the buffer holds */
+    long count;                     /**< Number of values printed, also past the capacity */
+} asm_output_buffer;
+
+/**
+ * @struct input_map
+ * @brief Binary input file mapped into memory
+ */
+typedef struct {
+    const int *values;              /**< 32-bit integers in the file */
+    long count;                     /**< Number of integers */
+    void *view;                     /**< Start of the mapping, NULL for an empty file */
+    size_t size;                    /**< Size of the mapping in bytes */
+} input_map;
+
+/**
+ * @struct image_header
+ * @brief Header at the start of a program image file
+ * 
+ * The header is followed by the instructions. The initial memory array
+ * starts at data_offset, aligned to IMAGE_ALIGNMENT so it can be mapped
+ * on its own.
+ */
+typedef struct {
+    char magic[4];                  /**< IMAGE_MAGIC */
+    int version;                    /**< IMAGE_VERSION */
+    int entry_size;                 /**< Size of one instruction, to reject images from other builds */
+    int instruction_count;          /**< Number of instructions */
+    int memory_size;                /**< Cells in the data segment, MEMORY_SIZE */
+    int image_end;                  /**< First address past the declared variables */
+    int data_offset;                /**< File offset of the data segment */
+} image_header;
+
+/**
+ * @struct program_image
+ * @brief Program image mapped into memory
+ * 
+ * The code is mapped read-only and shared by every process running the
+ * image. The data segment is mapped copy-on-write, so a process only gets
+ * its own copy of the pages it writes.
+ */
+typedef struct {
+    const intermediate_lang *code;  /**< Instructions, in the shared mapping */
+    int code_length;                /**< Number of instructions */
+    int *memory;                    /**< Memory array, in the private mapping */
+    int image_end;                  /**< First address past the declared variables */
+    void *code_view;                /**< Read-only mapping of the header and code */
+    size_t code_size;               /**< Size of code_view in bytes */
+    void *data_view;                /**< Copy-on-write mapping of the data segment */
+} program_image;
+
+/**
+ * @struct object_header
+ * @brief Header at the start of a relocatable object file
+ * 
+ * The header is followed by the instructions, the initial values of the
+ * module's variables from VARIABLE_MEMORY_START up to data_end, its symbol
+ * table, its exports and its imports.
+ */
+typedef struct {
+    char magic[4];                  /**< OBJECT_MAGIC */
+    int version;                    /**< OBJECT_VERSION */
+    int entry_size;                 /**< Size of one instruction, to reject objects from other builds */
+    int instruction_count;          /**< Number of instructions */
+    int data_end;                   /**< First address past the module's variables */
+    int symbol_count;               /**< Entries of the symbol table */
+    int export_count;               /**< Exported symbols */
+    int import_count;               /**< Imported symbols */
+} object_header;
+
+/**
+ * @struct object_symbol
+ * @brief Symbol exported or imported by a module
+ */
+typedef struct {
+    char name[LABEL_LENGTH];        /**< Name of the label or variable */
+    int kind;                       /**< OBJECT_LABEL or OBJECT_DATA, 0 for imports */
+    int value;                      /**< Instruction number or address */
+    int size;                       /**< Size from the symbol table, for variables */
+} object_symbol;
+
+/**
+ * @struct linked_module
+ * @brief Relocatable object loaded by the linker
+ */
+typedef struct {
+    const char *filename;           /**< Object file, for error messages */
+    object_header header;           /**< Header of the object */
+    intermediate_lang *code;        /**< Instructions, numbered from 1 */
+    int *data;                      /**< Initial values of the module's variables */
+    symbol_table *symbols;          /**< Symbol table of the module */
+    object_symbol *exports;         /**< Exported symbols */
+    object_symbol *imports;         /**< Imported symbols */
+    const object_symbol **resolved; /**< Per import, the export it resolves to */
+    int code_base;                  /**< Instructions placed before the module */
+    int data_base;                  /**< First address of the module's variables */
+} linked_module;
+
+/**
+ * @struct resident_program
+ * @brief Compiled program kept in memory by the daemon
+ * 
+ * Programs are looked up by path and reused while the file keeps the same
+ * modification time and size. Every run holds a reference, so a program
+ * replaced by a newer version is freed when its last run ends.
+ */
+typedef struct resident_program {
+    char path[DAEMON_PATH_LENGTH];  /**< Absolute path of the source */
+    long long modified;             /**< Modification time of the source when compiled */
+    long long size;                 /**< Size of the source when compiled */
+    intermediate_lang *code;        /**< Compiled instructions */
+    int code_length;                /**< Number of instructions */
+    int memory[MEMORY_SIZE];        /**< Initial memory array */
+    int references;                 /**< Cache entry plus runs in progress */
+    struct resident_program *next;  /**< Next program in the cache */
+} resident_program;
+
+/**
+ * @struct live_set
+ * @brief Set of memory cells whose values may still be read
+ * 
+ * One bit per memory cell, used by the liveness analysis in the optimizer.
+ */
+typedef struct {
+    unsigned int bits[LIVE_WORDS];  /**< Bit i is set when cell i is live */
+} live_set;
+
+/**
+ * @struct ssa_value
+ * @brief Value written to a memory cell once, in the SSA form
+ */
+typedef struct {
+    int kind;                       /**< One of the SSA_* kinds */
+    int cell;                       /**< Memory cell holding the value */
+    int block;                      /**< Block of a phi, -1 otherwise */
+    int opcode;                     /**< Operation of an SSA_EXPR */
+    int operands[2];                /**< Source of a copy or operands of an expression, -1 if none */
+    int immediate;                  /**< Immediate operand of an expression */
+    int number;                     /**< Value number; values with equal numbers are equal */
+} ssa_value;
+
+/**
+ * @struct ssa_block
+ * @brief Basic block of the SSA form
+ */
+typedef struct {
+    int first;                      /**< Index of the first instruction */
+    int last;                       /**< Index of the last instruction */
+    int *preds;                     /**< Blocks that branch or fall through to it */
+    int pred_count;                 /**< Number of predecessors */
+    int order;                      /**< Position in reverse postorder, -1 when unreachable */
+} ssa_block;
+
+/**
+ * @struct ssa_form
+ * @brief SSA form of the intermediate language table
+ * 
+ * Only the cells that some instruction writes are tracked through the
+ * blocks; every other cell keeps its initial value, which is value number
+ * the cell's address.
+ */
+typedef struct {
+    ssa_block *blocks;              /**< Basic blocks in instruction order */
+    int block_count;                /**< Number of blocks */
+    int *block_of;                  /**< Block of each instruction */
+    int *pred_list;                 /**< Storage for the predecessor lists */
+    int *order;                     /**< Reachable blocks in reverse postorder */
+    int order_count;                /**< Number of reachable blocks */
+    ssa_value *values;              /**< Values; the first MEMORY_SIZE are the initial ones */
+    int value_count;                /**< Number of values */
+    int value_capacity;             /**< Number of values allocated */
+    int cells[MEMORY_SIZE];         /**< Index of each cell among the tracked cells, -1 if not tracked */
+    int tracked;                    /**< Number of tracked cells */
+    int *entry;                     /**< Per block and tracked cell, its value on entry */
+    int *exit;                      /**< Per block and tracked cell, its value on exit */
+    int *uses;                      /**< Per instruction and parameter, the value read, -1 if not a scalar read */
+    int *defs;                      /**< Per instruction, the first value it writes */
+    int *def_ends;                  /**< Per instruction, one past the last value it writes */
+    int *leaders;                   /**< Per value number, the first value with it */
+    int number_count;               /**< Number of value numbers given */
+} ssa_form;
+
+/**
+ * @brief Grows the intermediate table so it can hold a number of instructions
+ * 
+ * @param needed Number of instructions the table must be able to hold
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int ensure_intermediate_capacity(int needed);
+
+/**
+ * @brief Pushes an entry onto a control stack, growing it if needed
+ * 
+ * @param stack Control stack
+ * @param entry Entry to push
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int push_control(control_stack *stack, int entry);
+
+/**
+ * @brief Frees the entries of a control stack and empties it
+ * 
+ * @param stack Control stack
+ */
+void release_control_stack(control_stack *stack);
+
+/**
+ * @brief Gets the memory address for a variable or register
+ * 
+ * @param variable_name Variable or register name; array references are
+ *                      cut down to the array name
+ * @return int Memory address, or -1 if not found
+ */
+int getAddress(char *variable_name);
+
+/**
+ * @brief Processes one line of the declaration section
+ * 
+ * @param line Source line, including its newline
+ * @param memory Memory array
+ * @param memory_index Pointer to the current memory index
+ */
+void process_declaration(const char *line, int *memory, int *memory_index);
+
+/**
+ * @brief Compiles one line of the instruction section
+ * 
+ * Labels are added to the block table; every other line generates at most
+ * one instruction at intermediate_index. Lines that do not generate code
+ * (labels, blank lines and ENDIF) give their instruction number back.
+ * 
+ * @param line Source line; its trailing newline is removed
+ * @param instruction_no Pointer to the current instruction number
+ * @param stack Stack for tracking nested control structures
+ * @return int 1 if the line was END, 0 otherwise
+ */
+int compile_instruction(char *line, int *instruction_no, control_stack *stack);
+
+/**
+ * @brief Looks up the instruction number of a label
+ * 
+ * @param name Label name
+ * @return int Instruction number, or -1 if the label is not defined
+ */
+int find_label(const char *name);
+
+/**
+ * @brief Fills in branches to labels that were defined after the branch
+ * 
+ * Must be called once all instructions of the program are compiled.
+ * 
+ * @return int Number of labels that are not defined anywhere
+ */
+int resolve_label_fixups(void);
+
+/**
+ * @brief Clears the compiler tables before another program is compiled
+ */
+void reset_compiler(void);
+
+/**
+ * @brief Allocates the compiler tables if they are not allocated yet
+ * 
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int init_compiler(void);
+
+/**
+ * @brief Frees the compiler tables
+ * 
+ * init_compiler allocates them again before the next program.
+ */
+void release_compiler(void);
+
+/**
+ * @brief Reads the next line of a source, like fgets
+ * 
+ * A line longer than LINE_SIZE - 1 characters is split, as fgets does.
+ * 
+ * @param source Source file or in-memory text
+ * @param line Buffer of LINE_SIZE characters receiving the line
+ * @return char* line, or NULL at the end of the source
+ */
+char *read_source_line(source_reader *source, char *line);
+
+/**
+ * @brief Processes the declarations before START:
+ * 
+ * @param source Source, positioned at its start
+ * @param memory_array Memory array receiving the CONST values
+ * @param memory_index Pointer to the current memory index
+ */
+void compile_declarations(source_reader *source, int *memory_array, int *memory_index);
+
+/**
+ * @brief Compiles the instructions after START: for execution
+ * 
+ * The instructions are compiled, their labels resolved and the program
+ * verified, then optimized when requested and specialized for the
+ * virtual machine.
+ * 
+ * @param source Source, positioned right after START:
+ * @param memory_array Memory array holding the CONST values
+ * @param optimize 1 to run the optimizer
+ * @return int 1 if the program can be run, 0 if it was rejected
+ */
+int compile_instructions(source_reader *source, int *memory_array, int optimize);
+
+/**
+ * @brief Compiles the instructions after START: and resolves their labels
+ * 
+ * @param source Source, positioned right after START:
+ */
+void read_instructions(source_reader *source);
+
+/**
+ * @brief Verifies the compiled program and prepares it for execution
+ * 
+ * The program is optimized when requested and specialized for the
+ * virtual machine.
+ * 
+ * @param memory_array Memory array holding the CONST values
+ * @param optimize 1 to run the optimizer
+ * @return int 1 if the program can be run, 0 if it was rejected
+ */
+int prepare_program(int *memory_array, int optimize);
+
+/**
+ * @brief Indexes the instruction section without compiling it
+ * 
+ * Every instruction gets its file offset, labels are added to the block
+ * table and IF/ELSE/ENDIF and FOR/NEXT targets are worked out from the
+ * keywords. The intermediate table is filled with OP_COMPILE entries. The
+ * file must be positioned right after START: and is kept open until
+ * lazy_release.
+ * 
+ * @param fp Source file
+ * @return int 1 on success, 0 if the program cannot be run
+ */
+int lazy_scan(FILE *fp);
+
+/**
+ * @brief Compiles the basic block that starts at an instruction
+ * 
+ * Instructions are compiled up to the first one that can branch, or up to
+ * one that is already compiled, and verified before they are run.
+ * 
+ * @param index Index of the first instruction of the block
+ * @return int Index of the last instruction of the block, or -1 if the
+ *             block is invalid
+ */
+int compile_block(int index);
+
+/**
+ * @brief Closes the source file and frees the lazy mode scan results
+ */
+void lazy_release(void);
+
+/**
+ * @brief Recompiles a source file whenever it changes
+ * 
+ * The symbol table, block table and intermediate code stay in memory
+ * between builds. When only plain instructions changed, just those lines
+ * are recompiled, later instructions are renumbered, jump targets are
+ * patched and only the affected rows of output.obj are rewritten.
+ * Anything else triggers a full rebuild. Runs until interrupted.
+ * 
+ * @param filename Source file to watch
+ * @return int Exit code
+ */
+int watch_source(const char *filename);
+
 /**
  * @brief Displays the contents of the symbol table
  * 
@@ -139,14 +861,639 @@ void display_block_table(void);
 void dump_to_file(void);
 
 /**
- * @brief Executes the compiled program
+ * @brief Rewrites part of the instruction table in the output file
  * 
- * This function runs the virtual machine that executes the
- * intermediate language instructions.
+ * The block table and the given instruction rows are rewritten in place.
+ * When the number of instructions changed, every row from first_row on is
+ * rewritten and the file is truncated to its new length. If the file
+ * layout does not allow an in-place update, the whole file is rewritten.
  * 
- * @param memory_array Pointer to the memory array
+ * @param first_row Index of the first changed instruction
+ * @param last_row Index of the last changed instruction
+ */
+void update_object_file(int first_row, int last_row);
+
+/**
+ * @brief Prepares a virtual machine to run the program from the start
+ * 
+ * Registers are cleared, no limits are set and the return stack gets
+ * the default depth of CALL_STACK_SIZE. The code is not copied, so it
+ * must outlive the state; several states can run the same code.
+ * 
+ * @param state State to initialize
+ * @param code Instructions of the program
+ * @param code_length Number of instructions
+ * @param memory_array Pointer to the memory array
+ */
+void vm_init(vm_state *state, const intermediate_lang *code, int code_length, int *memory_array);
+
+/**
+ * @brief Frees the return stack of a virtual machine
+ * 
+ * @param state State to release
+ */
+void vm_release(vm_state *state);
+
+/**
+ * @brief Runs the program until it ends or a limit is reached
+ * 
+ * The program must have passed verify_program; operands are not checked
+ * while it runs. Limits are only checked on backward jumps, so a program
+ * can overrun its instruction limit by at most one pass through its code.
+ * Calling vm_run again on a stopped state, typically after raising its
+ * limits, resumes where it stopped. In a spawned thread, the RET of its
+ * subroutine ends the thread.
+ * 
+ * @param state State of the virtual machine
+ * @param memory_array Pointer to the memory array
+ * @return int EXEC_FINISHED, EXEC_INSTRUCTION_LIMIT, EXEC_TIME_LIMIT,
+ *             EXEC_RETURN_STACK, EXEC_INVALID_CODE, EXEC_THREAD_ERROR or
+ *             EXEC_BREAKPOINT
+ */
+int vm_run(vm_state *state, int *memory_array);
+
+/**
+ * @brief Reports why a virtual machine stopped before the end of the program
+ * 
+ * @param state State of the virtual machine after it ran
+ * @return int 1 if a reason was reported, 0 if the program finished
+ */
+int report_stop(const vm_state *state);
+
+/**
+ * @brief Runs a program, with a thread group when it can spawn threads
+ * 
+ * Programs without SPAWN are run by vm_run directly. Otherwise the memory
+ * array is copied into the shared memory of a thread group for the run,
+ * and the program ends when its main thread and every thread it started
+ * have ended.
+ * 
+ * @param state State of the virtual machine, for the main thread
+ * @param memory_array Memory array of MEMORY_SIZE cells
+ * @return int EXEC_* status of the main thread
+ */
+int vm_run_threads(vm_state *state, int *memory_array);
+
+/**
+ * @brief Passes PRINT values to the print function of a thread
+ * 
+ * The threads of a group take turns, so the function is never called by
+ * two threads at once.
+ * 
+ * @param state State of the printing thread, with a print function
+ * @param values Values printed
+ * @param count Number of values
+ */
+void vm_print(const vm_state *state, const int *values, int count);
+
+/**
+ * @brief Starts a VM thread at a subroutine for SPAWN
+ * 
+ * The new thread starts with a copy of the spawning thread's registers
+ * and its own empty return stack, and ends when the subroutine returns.
+ * Spawned threads do not READ input; they see the end of input.
+ * 
+ * @param state State of the spawning thread
+ * @param target Index of the first instruction of the subroutine
+ * @return int 1 if the thread was started, 0 otherwise
+ */
+int spawn_thread(vm_state *state, int target);
+
+/**
+ * @brief Waits for every thread a thread spawned, for JOIN
+ * 
+ * Threads that stopped before their end are reported.
+ * 
+ * @param state State of the joining thread
+ */
+void join_threads(vm_state *state);
+
+/**
+ * @brief Runs a program under the interactive debugger
+ * 
+ * Commands are read from stdin, one per line, before each instruction
+ * the program stops at; the program stands at its first instruction to
+ * begin with. Text READs take their values from the same stdin.
+ * 
+ * @param code Instructions of the program, patched while it is debugged
+ * @param code_length Number of instructions
+ * @param memory_array Memory array the program runs on
+ */
+void debug_program(intermediate_lang *code, int code_length, int *memory_array);
+
+/**
+ * @brief Maps a binary input file into memory
+ * 
+ * The file holds 32-bit integers in native byte order. Trailing bytes that
+ * do not make up a whole integer are ignored.
+ * 
+ * @param filename File to map
+ * @param map Receives the mapping
+ * @return int 1 on success, 0 on failure
+ */
+int map_input_file(const char *filename, input_map *map);
+
+/**
+ * @brief Releases a mapping made by map_input_file
+ * 
+ * @param map Mapping to release
+ */
+void unmap_input_file(input_map *map);
+
+/**
+ * @brief Executes the compiled program
+ * 
+ * This function runs the virtual machine that executes the
+ * intermediate language instructions, within the limits set by
+ * instruction_limit and time_limit_ms. READ takes its values from
+ * input_filename when it is set, and from stdin otherwise. With
+ * debug_mode set, the program runs under the interactive debugger.
+ * 
+ * @param memory_array Pointer to the memory array
  * @param memory_index Index of the last used memory location
  */
 void executor(int *memory_array, int memory_index);
 
+/**
+ * @brief Executes a program image loaded by load_program_image
+ * 
+ * The code is run in place from the shared mapping and the memory array
+ * is the image's copy-on-write data segment.
+ * 
+ * @param image Loaded program image
+ */
+void execute_image(program_image *image);
+
+/**
+ * @brief Writes the compiled program to a program image file
+ * 
+ * @param filename Image file to write
+ * @param memory_array Memory array holding the CONST values
+ * @return int 1 on success, 0 on failure
+ */
+int save_program_image(const char *filename, const int *memory_array);
+
+/**
+ * @brief Maps a program image file for execution
+ * 
+ * The code is mapped read-only and shared, the data segment copy-on-write.
+ * The code is verified before the image is accepted.
+ * 
+ * @param filename Image file to map
+ * @param image Receives the mapping
+ * @return int 1 on success, 0 on failure
+ */
+int load_program_image(const char *filename, program_image *image);
+
+/**
+ * @brief Releases a mapping made by load_program_image
+ * 
+ * @param image Image to release
+ */
+void release_program_image(program_image *image);
+
+/**
+ * @brief Evaluates a condition based on two operands and a condition code
+ * 
+ * @param operand1 First operand
+ * @param operand2 Second operand
+ * @param opcode Condition code (OP_EQ, OP_LT, etc.)
+ * @return int 1 if condition is true, 0 otherwise
+ */
+int check_condition(int operand1, int operand2, int opcode);
+
+/**
+ * @brief Describes how an instruction uses one of its parameters
+ * 
+ * @param opcode Operation code of the instruction
+ * @param index Parameter index (0-4)
+ * @return int One of the OPERAND_* kinds
+ */
+int operand_kind(int opcode, int index);
+
+/**
+ * @brief Gets the number of memory cells a parameter refers to
+ * 
+ * @param instr Instruction
+ * @param index Parameter index (0-4)
+ * @return int Count from the next slot for whole-array operands, 1 otherwise
+ */
+int operand_cells(const intermediate_lang *instr, int index);
+
+/**
+ * @brief Replaces generic instructions with specialized ones
+ * 
+ * Each IF gets an opcode with its comparison built in. When memory_array
+ * is given, CONST operands that are never written become immediates:
+ * ADD, SUB and MUL with one such operand use ADD_IMM or MUL_IMM, and a
+ * MOV from one becomes LOAD_IMM. Run after the other passes, which only
+ * know the generic forms.
+ * 
+ * @param first Index of the first instruction to specialize
+ * @param last Index of the last instruction to specialize
+ * @param memory_array Memory array holding the CONST values, or NULL when
+ *                     they cannot be relied on, as in lazy mode
+ * @return int Number of instructions specialized
+ */
+int specialize_instructions(int first, int last, const int *memory_array);
+
+/**
+ * @brief Finds the end of the memory image
+ * 
+ * The image holds the registers followed by every declared variable.
+ * 
+ * @return int First address past the image
+ */
+int memory_image_end(void);
+
+/**
+ * @brief Checks a range of instructions before they are run
+ * 
+ * @param first Index of the first instruction to check
+ * @param last Index of the last instruction to check
+ * @return int Number of problems found, 0 if the instructions can be run
+ */
+int verify_instructions(int first, int last);
+
+/**
+ * @brief Checks every instruction of the program before it is run
+ * 
+ * Every operand address must lie within the memory image, every branch
+ * target must be an instruction and every condition code must be known.
+ * Each problem is reported on stderr with the instruction number, its
+ * mnemonic and the offending operand.
+ * 
+ * @return int Number of problems found, 0 if the program can be run
+ */
+int verify_program(void);
+
+/**
+ * @brief Gets the mnemonic of an opcode
+ * 
+ * @param opcode Operation code
+ * @return const char* Mnemonic, or "?" for an unknown opcode
+ */
+const char *opcode_name(int opcode);
+
+/**
+ * @brief Starts collecting statistics
+ * 
+ * Until this is called, stats_begin and stats_end do nothing. On Linux
+ * the hardware counters are opened here when the kernel allows it.
+ */
+void stats_start(void);
+
+/**
+ * @brief Enters a phase
+ * 
+ * Phases can be entered again while active; only the outermost entry
+ * is timed.
+ * 
+ * @param phase STATS_* phase
+ */
+void stats_begin(int phase);
+
+/**
+ * @brief Leaves a phase entered with stats_begin
+ * 
+ * @param phase STATS_* phase
+ */
+void stats_end(int phase);
+
+/**
+ * @brief Counting replacement for malloc
+ * 
+ * The compiler allocates through it so the statistics report can
+ * attribute allocations to phases.
+ * 
+ * @param size Bytes to allocate
+ * @return void* The allocated block, or NULL
+ */
+void *stats_malloc(size_t size);
+
+/**
+ * @brief Counting replacement for realloc
+ * 
+ * @param block Block to resize, or NULL
+ * @param size New size in bytes
+ * @return void* The resized block, or NULL
+ */
+void *stats_realloc(void *block, size_t size);
+
+/**
+ * @brief Counting replacement for calloc
+ * 
+ * @param count Number of elements
+ * @param size Bytes per element
+ * @return void* The zeroed block, or NULL
+ */
+void *stats_calloc(size_t count, size_t size);
+
+/**
+ * @brief Writes the statistics report and closes the counters
+ * 
+ * The report holds the time, allocations and hardware counter deltas of
+ * every phase as JSON. Counters that could not be opened are null.
+ * 
+ * @param filename Report file to write
+ * @param source Source or image file the run was for
+ * @return int 1 on success, 0 on failure
+ */
+int stats_write_report(const char *filename, const char *source);
+
+/**
+ * @brief Checks code loaded from a program image
+ * 
+ * The image carries no symbol table, so the end of its memory image is
+ * given by the caller. Lazy mode placeholders (OP_COMPILE) are rejected,
+ * since there is no source to compile them from.
+ * 
+ * @param code Instructions of the program
+ * @param length Number of instructions
+ * @param end First address past the memory image
+ * @return int Number of problems found, 0 if the code can be run
+ */
+int verify_code(const intermediate_lang *code, int length, int end);
+
+/**
+ * @brief Lists the instructions that may execute after an instruction
+ * 
+ * @param index Index of the instruction in the intermediate table
+ * @param successors Receives up to two successor indices; an index equal to
+ *                   intermediate_index means the program ends
+ * @return int Number of successors stored
+ */
+int instruction_successors(int index, int *successors);
+
+/**
+ * @brief Computes which memory cells are live before and after each instruction
+ * 
+ * DATA cells are treated as live when the program ends; registers are not.
+ * 
+ * @param live_in Array of intermediate_index sets, or NULL
+ * @param live_out Array of intermediate_index sets, or NULL
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int compute_liveness(live_set *live_in, live_set *live_out);
+
+/**
+ * @brief Runs the optimization passes over the intermediate language table
+ * 
+ * Inlines calls to short straight-line subroutines, folds IF statements
+ * whose outcome is known at compile time, simplifies arithmetic on CONST
+ * values (multiplications by powers of two become shifts), then removes
+ * unreachable instructions, dead stores and jumps to the next instruction
+ * until nothing changes. READ and PRINT are always kept, as are stores to
+ * DATA cells in a program that spawns threads, and every jump target and
+ * label is re-linked after instructions are removed. Unless
+ * the program spawns threads, copies are then propagated and repeated
+ * computations reused through the SSA form, and DATA scalars used inside
+ * loops are promoted into free registers.
+ * 
+ * @param memory_array Memory array holding the CONST values
+ * @return int Number of instructions removed
+ */
+int optimize_program(int *memory_array);
+
+/**
+ * @brief Finds the memory cells whose values are known at compile time
+ * 
+ * A cell has a known value when it belongs to a CONST declaration and no
+ * instruction ever writes to it.
+ * 
+ * @param known Receives a flag per memory cell
+ */
+void find_known_values(int *known);
+
+/**
+ * @brief Builds the SSA form of the intermediate language table
+ * 
+ * The first MEMORY_SIZE values are the initial values of the cells.
+ * 
+ * @param ssa SSA form to fill in
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int build_ssa(ssa_form *ssa);
+
+/**
+ * @brief Gives equal values equal numbers
+ * 
+ * CONST cells that no instruction writes are numbered as the constant
+ * they hold, so they match a LOAD_IMM of the same value.
+ * 
+ * @param ssa SSA form built by build_ssa
+ * @param memory_array Memory array holding the CONST values
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int number_ssa_values(ssa_form *ssa, const int *memory_array);
+
+/**
+ * @brief Rewrites the intermediate language table from the value numbers
+ * 
+ * Operands are read from the cell that first held their value while it
+ * still does, and a computation whose value some cell already holds
+ * becomes a MOV from that cell, or a MOV of its destination onto itself
+ * when the destination holds it. The number of instructions stays the
+ * same.
+ * 
+ * @param ssa SSA form numbered by number_ssa_values
+ * @param operands Receives the number of operands rewritten
+ * @param computations Receives the number of computations replaced
+ */
+void lower_ssa(ssa_form *ssa, int *operands, int *computations);
+
+/**
+ * @brief Frees an SSA form
+ * 
+ * @param ssa SSA form
+ */
+void release_ssa(ssa_form *ssa);
+
+/**
+ * @brief Runs copy propagation and global value numbering over the program
+ * 
+ * @param memory_array Memory array holding the CONST values
+ * @return int Number of operands and computations rewritten
+ */
+int optimize_ssa(const int *memory_array);
+
+/**
+ * @brief Writes the profile recorded by a run of the virtual machine
+ * 
+ * @param filename Profile file to write
+ * @param code Instructions that were run
+ * @param code_length Number of instructions
+ * @param branches_taken Per instruction, times it branched
+ * @param branch_entries Per instruction, times execution arrived by a branch
+ * @return int 1 on success, 0 on failure
+ */
+int save_profile(const char *filename, const intermediate_lang *code, int code_length,
+                 const long long *branches_taken, const long long *branch_entries);
+
+/**
+ * @brief Lays out the compiled program using a recorded profile
+ * 
+ * IFs that usually branch are inverted so their likely successor falls
+ * through, blocks are chained to their likely successors and the hot
+ * blocks are placed first. The profile is only used when it was recorded
+ * for the same code.
+ * 
+ * @param filename Profile file
+ * @return int 1 if the layout was applied, 0 if the profile could not be used
+ */
+int apply_profile(const char *filename);
+
+/**
+ * @brief Forgets the EXPORT and IMPORT declarations of the last module
+ */
+void reset_module_symbols(void);
+
+/**
+ * @brief Processes an EXPORT declaration
+ * 
+ * @param name Label or variable the module makes visible to other modules
+ */
+void declare_export(const char *name);
+
+/**
+ * @brief Processes an IMPORT declaration
+ * 
+ * @param name Label or variable the module uses from another module
+ */
+void declare_import(const char *name);
+
+/**
+ * @brief Gets the placeholder operand for an imported symbol
+ * 
+ * @param name Symbol name
+ * @return int Placeholder, or -1 if the name is not imported
+ */
+int find_import(const char *name);
+
+/**
+ * @brief Gets the number of IMPORT declarations of the module being compiled
+ * 
+ * @return int Number of imported symbols
+ */
+int module_import_count(void);
+
+/**
+ * @brief Writes the compiled module to a relocatable object file
+ * 
+ * The instructions must have been compiled and their labels resolved, but
+ * not verified or optimized: that happens once the program is linked.
+ * 
+ * @param filename Object file to write
+ * @param memory_array Memory array holding the CONST values
+ * @return int 1 on success, 0 on failure
+ */
+int save_object(const char *filename, const int *memory_array);
+
+/**
+ * @brief Links relocatable objects into the program to run
+ * 
+ * The objects are placed in the order given, so the program starts with
+ * the first one. The intermediate, symbol and block tables and the memory
+ * array are replaced by the linked program; the block table holds the
+ * exported labels.
+ * 
+ * @param filenames Object files
+ * @param count Number of object files
+ * @param memory_array Memory array receiving the initial values
+ * @param memory_index Pointer to the current memory index
+ * @return int 1 if the objects were linked, 0 otherwise
+ */
+int link_objects(const char **filenames, int count, int *memory_array, int *memory_index);
+
+/**
+ * @brief Runs the daemon until it is interrupted
+ * 
+ * The daemon listens on a Unix socket and keeps every program it compiles
+ * resident, keyed by path and modification time. Each connection is one
+ * run request, served by one of the worker threads, which streams the
+ * PRINT output back to the client.
+ * 
+ * @param socket_path Path of the Unix socket to listen on
+ * @param workers Number of worker threads
+ * @param optimize 1 to run the optimizer on compiled programs
+ * @return int Exit code
+ */
+int daemon_serve(const char *socket_path, int workers, int optimize);
+
+/**
+ * @brief Runs a program on a daemon, with stdin as its input
+ * 
+ * @param socket_path Path of the daemon's Unix socket
+ * @param filename Source file to run
+ * @return int Exit code: 0 if the program finished, 1 otherwise
+ */
+int daemon_request(const char *socket_path, const char *filename);
+
+/**
+ * @brief Compiles a program from text in memory
+ * 
+ * The text is a complete source, as it would be read from a .asm file.
+ * Problems are reported on stderr like for a source file. Programs must
+ * be compiled from one thread at a time.
+ * 
+ * @param source Program text
+ * @param length Length of the text in characters
+ * @param optimize 1 to run the optimizer
+ * @return asm_program* Program, to be freed with asm_release_program, or
+ *                      NULL if it was rejected
+ */
+asm_program *asm_compile(const char *source, long length, int optimize);
+
+/**
+ * @brief Finds a DATA or CONST variable of a compiled program
+ * 
+ * @param program Compiled program
+ * @param name Name of the variable
+ * @param size Receives the number of cells of the variable, if not NULL
+ * @return int Address of the variable in the memory array, or -1 if the
+ *             program has no variable of that name
+ */
+int asm_find_variable(const asm_program *program, const char *name, int *size);
+
+/**
+ * @brief Runs a compiled program
+ * 
+ * Every run starts from the program's initial memory. The print function
+ * is also called from threads the program starts with SPAWN, but never by
+ * two threads at once, so it needs no locking of its own.
+ * 
+ * @param program Compiled program
+ * @param options Input, output and limits of the run, or NULL for none
+ * @param memory Receives the MEMORY_SIZE cells of the final memory array,
+ *               if not NULL
+ * @return int EXEC_* status of the run
+ */
+int asm_run(const asm_program *program, const asm_run_options *options, int *memory);
+
+/**
+ * @brief Print function storing the values in an asm_output_buffer
+ * 
+ * Values past the capacity are counted but not stored.
+ * 
+ * @param context asm_output_buffer receiving the values
+ * @param values Values printed
+ * @param count Number of values
+ */
+void asm_collect_output(void *context, const int *values, int count);
+
+/**
+ * @brief Frees a compiled program
+ * 
+ * @param program Program from asm_compile, or NULL
+ */
+void asm_release_program(asm_program *program);
+
+/**
+ * @brief Frees the compiler tables once the host is done compiling
+ * 
+ * Compiled programs stay valid. A later asm_compile allocates the tables
+ * again.
+ */
+void asm_shutdown(void);
+
 #endif /* FUNCTION_HEADERS_H */
@@ -0,0 +1,579 @@
+/**
+ * @file daemon.c
+ * @brief Resident virtual machine server for the Assembly Language Compiler
+ *
+ * In daemon mode the compiler listens on a Unix socket and keeps every
+ * program it has compiled in memory, keyed by path and modification time.
+ * Each connection is one run request: the client sends the absolute path
+ * of the source and the text to use as input, and a worker thread runs the
+ * resident program and streams its PRINT output back. A program is only
+ * compiled again when its file changes, so a request costs only its
+ * execution time.
+ *
+ * Protocol, one request per connection:
+ *   client: "RUN <bytes> <path>\n" followed by <bytes> of input text;
+ *           the path is the rest of the line, spaces included
+ *   server: the PRINT output, then "END <status> <instructions>\n" or
+ *           "ERROR <message>\n"
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+/* External variables from main.c */
+extern int intermediate_index;
+extern intermediate_lang **intermediate_table;
+extern long instruction_limit;
+extern long time_limit_ms;
+extern long call_stack_depth;
+extern int compiler_messages;
+
+#ifndef _WIN32
+
+/* Resident programs, newest first */
+static resident_program *resident_programs = NULL;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The compiler works on global tables, so one program is compiled at a time */
+static pthread_mutex_t compile_lock = PTHREAD_MUTEX_INITIALIZER;
+static int daemon_optimize = 1;
+
+/* Accepted connections waiting for a worker */
+static int pending[DAEMON_QUEUE_SIZE];
+static int pending_first = 0, pending_count = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_filled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_drained = PTHREAD_COND_INITIALIZER;
+
+/* READ at the end of an empty payload */
+static const int no_input[1] = { 0 };
+
+/**
+ * @brief Drops one reference to a resident program
+ *
+ * The program is freed with its last reference.
+ *
+ * @param program Program to release
+ */
+static void release_resident(resident_program *program) {
+    int unused;
+
+    pthread_mutex_lock(&cache_lock);
+    unused = (--program->references == 0);
+    pthread_mutex_unlock(&cache_lock);
+
+    if (unused) {
+        free(program->code);
+        free(program);
+    }
+}
+
+/**
+ * @brief Compiles a source file into a new resident program
+ *
+ * @param path Absolute path of the source
+ * @param info Status of the source, for its modification time and size
+ * @return resident_program* Program holding one reference, or NULL if the
+ *                           source could not be compiled
+ */
+static resident_program *compile_resident(const char *path, const struct stat *info) {
+    resident_program *program = NULL;
+    int memory_index = VARIABLE_MEMORY_START - 1;
+    int memory_array[MEMORY_SIZE] = { 0 };
+    source_reader source = { NULL, NULL, NULL };
+    FILE *fp;
+
+    pthread_mutex_lock(&compile_lock);
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not open file %s\n", path);
+        pthread_mutex_unlock(&compile_lock);
+        return NULL;
+    }
+
+    if (compiler_messages) {
+        printf("Compiling %s\n", path);
+        fflush(stdout);
+    }
+    source.fp = fp;
+    reset_compiler();
+    compile_declarations(&source, memory_array, &memory_index);
+    if (compile_instructions(&source, memory_array, daemon_optimize)) {
+        program = (resident_program*)stats_malloc(sizeof(resident_program));
+        if (program != NULL) {
+            program->code = (intermediate_lang*)stats_malloc(sizeof(intermediate_lang) * (intermediate_index + 1));
+        }
+        if (program == NULL || program->code == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for resident program\n");
+            free(program);
+            program = NULL;
+        }
+    }
+    fclose(fp);
+
+    if (program != NULL) {
+        strncpy(program->path, path, DAEMON_PATH_LENGTH - 1);
+        program->path[DAEMON_PATH_LENGTH - 1] = '\0';
+        program->modified = (long long)info->st_mtime;
+        program->size = (long long)info->st_size;
+        program->code_length = intermediate_index;
+        for (int i = 0; i < intermediate_index; i++) {
+            program->code[i] = *intermediate_table[i];
+        }
+        memcpy(program->memory, memory_array, sizeof(memory_array));
+        program->references = 1;
+        program->next = NULL;
+    }
+
+    pthread_mutex_unlock(&compile_lock);
+    return program;
+}
+
+/**
+ * @brief Gets the resident program for a source file, compiling it if needed
+ *
+ * @param path Absolute path of the source
+ * @return resident_program* Program holding a reference for the caller, or
+ *                           NULL if it could not be compiled
+ */
+static resident_program *acquire_resident(const char *path) {
+    resident_program *program, *compiled, **link;
+    struct stat info;
+
+    if (stat(path, &info) != 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    for (program = resident_programs; program != NULL; program = program->next) {
+        if (strcmp(program->path, path) == 0 && program->modified == (long long)info.st_mtime &&
+            program->size == (long long)info.st_size) {
+            program->references++;
+            pthread_mutex_unlock(&cache_lock);
+            return program;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    compiled = compile_resident(path, &info);
+    if (compiled == NULL) {
+        return NULL;
+    }
+
+    /* Replace the stale version; runs still using it keep their reference */
+    pthread_mutex_lock(&cache_lock);
+    for (link = &resident_programs; *link != NULL; link = &(*link)->next) {
+        if (strcmp((*link)->path, path) == 0) {
+            program = *link;
+            *link = program->next;
+            if (--program->references == 0) {
+                free(program->code);
+                free(program);
+            }
+            break;
+        }
+    }
+    compiled->next = resident_programs;
+    resident_programs = compiled;
+    compiled->references++;  /* One for the cache, one for the caller */
+    pthread_mutex_unlock(&cache_lock);
+
+    return compiled;
+}
+
+/**
+ * @brief Parses the input text of a request into values for READ
+ *
+ * @param text Input text, whitespace-separated integers
+ * @param length Length of the text
+ * @param count Receives the number of values
+ * @return int* Values, to be freed by the caller, or NULL on failure
+ */
+static int *parse_input(const char *text, long length, long *count) {
+    /* A value takes at least two characters, counting its separator */
+    int *values = (int*)stats_malloc(sizeof(int) * (length / 2 + 1));
+    const char *end = text + length;
+
+    *count = 0;
+    if (values == NULL) {
+        return NULL;
+    }
+
+    while (text < end) {
+        char *next;
+        long value = strtol(text, &next, 10);
+
+        if (next == text) {
+            text++;  /* Skip anything that is not a number */
+            continue;
+        }
+        values[(*count)++] = (int)value;
+        text = next;
+    }
+
+    return values;
+}
+
+/**
+ * @brief Gets the name of an execution status for the END line
+ *
+ * @param status EXEC_* status
+ * @return const char* Name of the status
+ */
+static const char *status_name(int status) {
+    switch (status) {
+        case EXEC_FINISHED:
+            return "finished";
+        case EXEC_INSTRUCTION_LIMIT:
+            return "instruction_limit";
+        case EXEC_TIME_LIMIT:
+            return "time_limit";
+        case EXEC_RETURN_STACK:
+            return "return_stack";
+        case EXEC_THREAD_ERROR:
+            return "thread_error";
+        default:
+            return "invalid_code";
+    }
+}
+
+/**
+ * @brief Serves one run request
+ *
+ * @param client Connected socket; closed when the request is done
+ */
+static void serve_request(int client) {
+    FILE *in = fdopen(client, "r");
+    FILE *out = NULL;
+    char header[DAEMON_PATH_LENGTH + 32], path[DAEMON_PATH_LENGTH];
+    char *text = NULL;
+    int *values = NULL;
+    long length = 0, count = 0;
+    int offset = 0;
+    resident_program *program = NULL;
+
+    if (in == NULL) {
+        close(client);
+        return;
+    }
+
+    out = fdopen(dup(client), "w");
+    if (out == NULL) {
+        fclose(in);
+        return;
+    }
+
+    /* Line buffered, so each PRINT reaches the client as the program runs */
+    setvbuf(out, NULL, _IOLBF, 0);
+
+    if (fgets(header, sizeof(header), in) == NULL ||
+        sscanf(header, "RUN %ld %n", &length, &offset) != 1 || offset == 0 ||
+        length < 0 || length > DAEMON_MAX_INPUT) {
+        fprintf(out, "ERROR invalid request\n");
+        goto done;
+    }
+
+    /* The path is the rest of the line, so it may contain spaces */
+    header[strcspn(header, "\n")] = '\0';
+    if (header[offset] == '\0' || strlen(header + offset) >= DAEMON_PATH_LENGTH) {
+        fprintf(out, "ERROR invalid request\n");
+        goto done;
+    }
+    strcpy(path, header + offset);
+
+    text = (char*)stats_malloc(length + 1);
+    if (text == NULL || fread(text, 1, length, in) != (size_t)length) {
+        fprintf(out, "ERROR could not read the input\n");
+        goto done;
+    }
+    text[length] = '\0';
+
+    values = parse_input(text, length, &count);
+    if (values == NULL) {
+        fprintf(out, "ERROR out of memory\n");
+        goto done;
+    }
+
+    program = acquire_resident(path);
+    if (program == NULL) {
+        fprintf(out, "ERROR %s could not be compiled\n", path);
+        goto done;
+    }
+
+    {
+        int memory_array[MEMORY_SIZE];
+        vm_state state;
+
+        memcpy(memory_array, program->memory, sizeof(memory_array));
+        vm_init(&state, program->code, program->code_length, memory_array);
+        state.instruction_limit = instruction_limit;
+        state.time_limit_ms = time_limit_ms;
+        state.return_stack_size = (int)call_stack_depth;
+        state.input = (count > 0) ? values : no_input;
+        state.input_count = count;
+        state.output = out;
+
+        vm_run_threads(&state, memory_array);
+        vm_release(&state);
+        fprintf(out, "END %s %lld\n", status_name(state.status), state.executed);
+    }
+
+done:
+    if (program != NULL) {
+        release_resident(program);
+    }
+    free(values);
+    free(text);
+    fclose(out);
+    fclose(in);
+}
+
+/**
+ * @brief Takes requests from the queue and serves them, forever
+ *
+ * @param argument Unused
+ * @return void* Never returns
+ */
+static void *worker_main(void *argument) {
+    (void)argument;
+
+    for (;;) {
+        int client;
+
+        pthread_mutex_lock(&queue_lock);
+        while (pending_count == 0) {
+            pthread_cond_wait(&queue_filled, &queue_lock);
+        }
+        client = pending[pending_first];
+        pending_first = (pending_first + 1) % DAEMON_QUEUE_SIZE;
+        pending_count--;
+        pthread_cond_signal(&queue_drained);
+        pthread_mutex_unlock(&queue_lock);
+
+        serve_request(client);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Runs the daemon until it is interrupted
+ *
+ * @param socket_path Path of the Unix socket to listen on
+ * @param workers Number of worker threads
+ * @param optimize 1 to run the optimizer on compiled programs
+ * @return int Exit code
+ */
+int daemon_serve(const char *socket_path, int workers, int optimize) {
+    struct sockaddr_un address;
+    int server;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long\n", socket_path);
+        return 1;
+    }
+
+    /* A client that goes away must not take the daemon with it */
+    signal(SIGPIPE, SIG_IGN);
+    daemon_optimize = optimize;
+
+    server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        fprintf(stderr, "Error: Could not create socket\n");
+        return 1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+
+    if (bind(server, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(server, DAEMON_QUEUE_SIZE) != 0) {
+        fprintf(stderr, "Error: Could not listen on %s\n", socket_path);
+        close(server);
+        return 1;
+    }
+
+    if (workers < 1) {
+        workers = 1;
+    }
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, NULL) != 0) {
+            fprintf(stderr, "Error: Could not start worker %d\n", i + 1);
+            close(server);
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+
+    printf("Listening on %s with %d worker(s)\n", socket_path, workers);
+    fflush(stdout);
+
+    for (;;) {
+        int client = accept(server, NULL, NULL);
+
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error: Could not accept a connection\n");
+            break;
+        }
+
+        pthread_mutex_lock(&queue_lock);
+        while (pending_count == DAEMON_QUEUE_SIZE) {
+            pthread_cond_wait(&queue_drained, &queue_lock);
+        }
+        pending[(pending_first + pending_count) % DAEMON_QUEUE_SIZE] = client;
+        pending_count++;
+        pthread_cond_signal(&queue_filled);
+        pthread_mutex_unlock(&queue_lock);
+    }
+
+    close(server);
+    unlink(socket_path);
+    return 1;
+}
+
+/**
+ * @brief Runs a program on a daemon, with stdin as its input
+ *
+ * The PRINT output is copied to stdout as it arrives.
+ *
+ * @param socket_path Path of the daemon's Unix socket
+ * @param filename Source file to run
+ * @return int Exit code: 0 if the program finished, 1 otherwise
+ */
+int daemon_request(const char *socket_path, const char *filename) {
+    struct sockaddr_un address;
+    char path[PATH_MAX], line[LINE_SIZE * 4];
+    char *text = NULL;
+    size_t length = 0, capacity = 0;
+    int server, result = 1;
+    FILE *in, *out;
+
+    if (realpath(filename, path) == NULL) {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return 1;
+    }
+
+    /* The whole input goes with the request */
+    for (;;) {
+        if (length == capacity) {
+            char *grown;
+            capacity = (capacity > 0) ? capacity * 2 : 4096;
+            grown = (char*)stats_realloc(text, capacity);
+            if (grown == NULL) {
+                fprintf(stderr, "Error: Memory allocation failed for input\n");
+                free(text);
+                return 1;
+            }
+            text = grown;
+        }
+        size_t read = fread(text + length, 1, capacity - length, stdin);
+        if (read == 0) {
+            break;
+        }
+        length += read;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+
+    server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || connect(server, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Error: Could not connect to %s\n", socket_path);
+        if (server >= 0) {
+            close(server);
+        }
+        free(text);
+        return 1;
+    }
+
+    out = fdopen(dup(server), "w");
+    in = fdopen(server, "r");
+    if (in == NULL || out == NULL) {
+        fprintf(stderr, "Error: Could not connect to %s\n", socket_path);
+        free(text);
+        return 1;
+    }
+
+    fprintf(out, "RUN %lu %s\n", (unsigned long)length, path);
+    fwrite(text, 1, length, out);
+    fclose(out);
+    free(text);
+
+    while (fgets(line, sizeof(line), in)) {
+        if (strncmp(line, "END ", 4) == 0) {
+            char status[32];
+            long long executed = 0;
+
+            if (sscanf(line, "END %31s %lld", status, &executed) == 2 && strcmp(status, "finished") == 0) {
+                result = 0;
+            } else {
+                fprintf(stderr, "\nExecution stopped: %s after %lld instructions\n", status, executed);
+            }
+            break;
+        }
+        if (strncmp(line, "ERROR ", 6) == 0) {
+            fprintf(stderr, "Error: %s", line + 6);
+            break;
+        }
+        fputs(line, stdout);
+        fflush(stdout);  /* Relay each line as it arrives, also into a pipe */
+    }
+
+    fclose(in);
+    return result;
+}
+
+#else
+
+/**
+ * @brief Runs the daemon until it is interrupted
+ *
+ * @param socket_path Path of the Unix socket to listen on
+ * @param workers Number of worker threads
+ * @param optimize 1 to run the optimizer on compiled programs
+ * @return int Exit code
+ */
+int daemon_serve(const char *socket_path, int workers, int optimize) {
+    (void)socket_path;
+    (void)workers;
+    (void)optimize;
+    fprintf(stderr, "Error: Daemon mode needs Unix sockets and is not available on Windows\n");
+    return 1;
+}
+
+/**
+ * @brief Runs a program on a daemon, with stdin as its input
+ *
+ * @param socket_path Path of the daemon's Unix socket
+ * @param filename Source file to run
+ * @return int Exit code
+ */
+int daemon_request(const char *socket_path, const char *filename) {
+    (void)socket_path;
+    (void)filename;
+    fprintf(stderr, "Error: Daemon mode needs Unix sockets and is not available on Windows\n");
+    return 1;
+}
+
+#endif
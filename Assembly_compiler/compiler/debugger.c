@@ -0,0 +1,525 @@
+/**
+ * @file debugger.c
+ * @brief Interactive debugger for the Assembly Language Compiler
+ *
+ * Breakpoints are patched into the code the virtual machine runs: the
+ * opcode of the instruction is replaced by OP_TRAP, which stops vm_run
+ * there, and the debugger keeps the original opcode. Code without a
+ * breakpoint runs exactly as it does outside the debugger, with no check
+ * per instruction.
+ *
+ * To go on from a breakpoint, the original opcode is put back and the
+ * instruction is stepped over before the trap is patched in again. A step
+ * patches temporary traps into every instruction that can run next (the
+ * next instruction, the branch target, or the return address of a RET)
+ * and runs until one of them is reached.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+/* External variables from main.c */
+extern int symbol_index;
+extern int blocks_index;
+extern symbol_table **symbol_tab;
+extern blocks_table **block_tab;
+extern long instruction_limit;
+extern long time_limit_ms;
+extern long call_stack_depth;
+extern const char *input_filename;
+
+/* Register names by address */
+static const char *register_names[VARIABLE_MEMORY_START] = {
+    "AX", "BX", "CX", "DX", "EX", "FX", "GX", "HX"
+};
+
+/**
+ * @brief Finds the breakpoint at an instruction
+ *
+ * @param session Debugging session
+ * @param index Index of the instruction
+ * @return int Index in the breakpoint list, or -1 if there is none
+ */
+static int find_breakpoint(const debug_session *session, int index) {
+    for (int k = 0; k < session->breakpoint_count; k++) {
+        if (session->breakpoints[k].instruction == index) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Gets the opcode an instruction had before it was patched
+ *
+ * @param session Debugging session
+ * @param index Index of the instruction
+ * @return int Original operation code
+ */
+static int original_opcode(const debug_session *session, int index) {
+    int k = find_breakpoint(session, index);
+    return (k >= 0) ? session->breakpoints[k].opcode : session->code[index].opcode;
+}
+
+/**
+ * @brief Finds the label at an instruction
+ *
+ * @param index Index of the instruction
+ * @return const char* Label name, or NULL if no label refers to it
+ */
+static const char *label_at(int index) {
+    for (int i = 0; i < blocks_index; i++) {
+        if (block_tab[i]->instr_no == index + 1) {
+            return block_tab[i]->name;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Writes the name of a memory cell
+ *
+ * @param address Memory address
+ * @param name Receives the register or variable name, with an index for
+ *             array elements, or the address itself
+ */
+static void cell_name(int address, char *name) {
+    if (address >= 0 && address < VARIABLE_MEMORY_START) {
+        strcpy(name, register_names[address]);
+        return;
+    }
+
+    for (int i = 0; i < symbol_index; i++) {
+        int size = (symbol_tab[i]->size == CONST_VARIABLE_SIZE) ? 1 : symbol_tab[i]->size;
+        if (address >= symbol_tab[i]->address && address < symbol_tab[i]->address + size) {
+            if (size > 1) {
+                sprintf(name, "%s[%d]", symbol_tab[i]->variable_name, address - symbol_tab[i]->address);
+            } else {
+                strcpy(name, symbol_tab[i]->variable_name);
+            }
+            return;
+        }
+    }
+
+    sprintf(name, "%d", address);
+}
+
+/**
+ * @brief Prints an instruction with its operands named
+ *
+ * @param session Debugging session
+ * @param index Index of the instruction
+ */
+static void show_instruction(const debug_session *session, int index) {
+    const intermediate_lang *instr = &session->code[index];
+    int opcode = original_opcode(session, index);
+    const char *label = label_at(index);
+    char name[PARAMETERS_LENGTH];
+
+    printf("%s%s%5d  %s", (find_breakpoint(session, index) >= 0) ? "*" : " ",
+           (index == session->state.pc) ? ">" : " ", index + 1, opcode_name(opcode));
+
+    for (int j = 0; j < 5; j++) {
+        switch (operand_kind(opcode, j)) {
+            case OPERAND_READ:
+            case OPERAND_WRITE:
+            case OPERAND_UPDATE:
+                cell_name(instr->parameters[j], name);
+                printf(" %s", name);
+                break;
+
+            case OPERAND_TARGET:
+                printf(" ->%d", instr->parameters[j]);
+                break;
+
+            case OPERAND_IMMEDIATE:
+            case OPERAND_COUNT:
+                printf(" #%d", instr->parameters[j]);
+                break;
+
+            case OPERAND_CONDITION:
+                printf(" %s", opcode_name(instr->parameters[j]));
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if (label != NULL) {
+        printf("    (%s:)", label);
+    }
+    printf("\n");
+}
+
+/**
+ * @brief Works out where a breakpoint argument points
+ *
+ * @param argument Instruction number or label name
+ * @param code_length Number of instructions
+ * @return int Index of the instruction, or -1 if there is no such place
+ */
+static int resolve_location(const char *argument, int code_length) {
+    char *end;
+    long number = strtol(argument, &end, 10);
+    int index;
+
+    if (*argument != '\0' && *end == '\0') {
+        index = (int)number - 1;
+    } else {
+        index = find_label(argument);
+        if (index < 0) {
+            fprintf(stderr, "Error: No label named '%s'\n", argument);
+            return -1;
+        }
+        index--;
+    }
+
+    if (index < 0 || index >= code_length) {
+        fprintf(stderr, "Error: No instruction at '%s'\n", argument);
+        return -1;
+    }
+    return index;
+}
+
+/**
+ * @brief Sets a breakpoint by patching a trap into the instruction
+ *
+ * @param session Debugging session
+ * @param index Index of the instruction
+ * @return int 1 if the breakpoint is set, 0 otherwise
+ */
+static int set_breakpoint(debug_session *session, int index) {
+    if (find_breakpoint(session, index) >= 0) {
+        return 1;
+    }
+
+    if (session->breakpoint_count == session->breakpoint_capacity) {
+        int capacity = (session->breakpoint_capacity == 0) ? 8 : session->breakpoint_capacity * 2;
+        breakpoint *grown = (breakpoint*)stats_realloc(session->breakpoints, sizeof(breakpoint) * capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for breakpoint\n");
+            return 0;
+        }
+        session->breakpoints = grown;
+        session->breakpoint_capacity = capacity;
+    }
+
+    session->breakpoints[session->breakpoint_count].instruction = index;
+    session->breakpoints[session->breakpoint_count].opcode = session->code[index].opcode;
+    session->breakpoint_count++;
+    session->code[index].opcode = OP_TRAP;
+    return 1;
+}
+
+/**
+ * @brief Removes a breakpoint and restores the original opcode
+ *
+ * @param session Debugging session
+ * @param index Index of the instruction
+ */
+static void clear_breakpoint(debug_session *session, int index) {
+    int k = find_breakpoint(session, index);
+
+    if (k < 0) {
+        return;
+    }
+    session->code[index].opcode = session->breakpoints[k].opcode;
+    session->breakpoints[k] = session->breakpoints[--session->breakpoint_count];
+}
+
+/**
+ * @brief Lists the instructions that can run right after one
+ *
+ * @param session Debugging session
+ * @param index Index of the instruction
+ * @param next Receives up to two instruction indices
+ * @return int Number of indices stored
+ */
+static int next_instructions(const debug_session *session, int index, int *next) {
+    const vm_state *state = &session->state;
+    int opcode = original_opcode(session, index);
+    int count = 0;
+
+    if (opcode == OP_RET) {
+        if (state->return_depth > 0) {
+            next[count++] = state->return_stack[state->return_depth - 1];
+        }
+        return count;
+    }
+
+    /* A CALL goes on after the subroutine returns, which a trap there would not catch */
+    if (opcode != OP_JUMP && opcode != OP_CALL) {
+        next[count++] = index + 1;
+    }
+
+    for (int j = 0; j < 5; j++) {
+        if (operand_kind(opcode, j) == OPERAND_TARGET) {
+            next[count++] = session->code[index].parameters[j] - 1;
+            break;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Runs the instruction at the program counter and stops after it
+ *
+ * An instruction that branches to itself runs until it moves on.
+ *
+ * @param session Debugging session
+ */
+static void step_instruction(debug_session *session) {
+    vm_state *state = &session->state;
+    int pc = state->pc;
+    int next[2], patched[2], saved[2];
+    int count = next_instructions(session, pc, next);
+    int k = find_breakpoint(session, pc);
+    int patches = 0;
+
+    /* Temporary traps on every way on; a breakpoint there already traps */
+    for (int n = 0; n < count; n++) {
+        if (next[n] >= 0 && next[n] < session->code_length && next[n] != pc &&
+            find_breakpoint(session, next[n]) < 0 && session->code[next[n]].opcode != OP_TRAP) {
+            patched[patches] = next[n];
+            saved[patches++] = session->code[next[n]].opcode;
+            session->code[next[n]].opcode = OP_TRAP;
+        }
+    }
+
+    /* Put the instruction back while it runs */
+    if (k >= 0) {
+        session->code[pc].opcode = session->breakpoints[k].opcode;
+    }
+
+    vm_run(state, session->memory);
+
+    if (k >= 0) {
+        session->code[pc].opcode = OP_TRAP;
+    }
+    for (int n = 0; n < patches; n++) {
+        session->code[patched[n]].opcode = saved[n];
+    }
+}
+
+/**
+ * @brief Runs until a breakpoint is reached or the program stops
+ *
+ * @param session Debugging session
+ */
+static void continue_program(debug_session *session) {
+    /* A breakpoint where the program stands is stepped over first */
+    if (find_breakpoint(session, session->state.pc) >= 0) {
+        step_instruction(session);
+        if (session->state.status != EXEC_BREAKPOINT || find_breakpoint(session, session->state.pc) >= 0) {
+            return;
+        }
+    }
+    vm_run(&session->state, session->memory);
+}
+
+/**
+ * @brief Prints the value of a register or variable
+ *
+ * @param session Debugging session
+ * @param name Register or variable name, optionally with an element index
+ */
+static void print_variable(const debug_session *session, const char *name) {
+    char base[PARAMETERS_LENGTH];
+    int index = -1;
+
+    if (sscanf(name, "%[^[][%d]", base, &index) < 1) {
+        fprintf(stderr, "Error: Give the name of a register or variable\n");
+        return;
+    }
+
+    for (int r = 0; r < VARIABLE_MEMORY_START; r++) {
+        if (strcmp(base, register_names[r]) == 0) {
+            printf("%s = %d\n", base, session->memory[r]);
+            return;
+        }
+    }
+
+    for (int i = 0; i < symbol_index; i++) {
+        int size = (symbol_tab[i]->size == CONST_VARIABLE_SIZE) ? 1 : symbol_tab[i]->size;
+        int address = symbol_tab[i]->address;
+
+        if (strcmp(symbol_tab[i]->variable_name, base) != 0) {
+            continue;
+        }
+
+        if (index >= size) {
+            fprintf(stderr, "Error: %s has %d elements\n", base, size);
+        } else if (index >= 0) {
+            printf("%s[%d] = %d\n", base, index, session->memory[address + index]);
+        } else if (size == 1) {
+            printf("%s = %d\n", base, session->memory[address]);
+        } else {
+            printf("%s =", base);
+            for (int k = 0; k < size && address + k < MEMORY_SIZE; k++) {
+                printf(" %d", session->memory[address + k]);
+            }
+            printf("\n");
+        }
+        return;
+    }
+
+    fprintf(stderr, "Error: No register or variable named '%s'\n", base);
+}
+
+/**
+ * @brief Prints where the program stopped
+ *
+ * @param session Debugging session
+ * @return int 1 while the program can go on, 0 once it has ended
+ */
+static int show_stop(debug_session *session) {
+    vm_state *state = &session->state;
+
+    if (state->status == EXEC_BREAKPOINT) {
+        show_instruction(session, state->pc);
+        return 1;
+    }
+
+    if (!report_stop(state)) {
+        printf("\n--- End of Execution ---\n");
+    }
+    printf("Program ended after %lld instructions\n", state->executed);
+    return 0;
+}
+
+/**
+ * @brief Prints the debugger commands
+ */
+static void show_help(void) {
+    printf("Commands:\n"
+           "  break <label|number>   b   Stop before the instruction\n"
+           "  delete <label|number>  d   Remove a breakpoint\n"
+           "  info                   i   List the breakpoints\n"
+           "  step                   s   Run one instruction\n"
+           "  continue               c   Run to the next breakpoint or the end\n"
+           "  list                   l   Show the instructions around the current one\n"
+           "  registers              r   Show AX to HX\n"
+           "  print <name>           p   Show a register, variable or array element\n"
+           "  quit                   q   Stop debugging\n");
+}
+
+/**
+ * @brief Runs a program under the interactive debugger
+ *
+ * Commands are read from stdin, one per line, before each instruction
+ * the program stops at; the program stands at its first instruction to
+ * begin with. Text READs take their values from the same stdin.
+ *
+ * @param code Instructions of the program, patched while it is debugged
+ * @param code_length Number of instructions
+ * @param memory_array Memory array the program runs on
+ */
+void debug_program(intermediate_lang *code, int code_length, int *memory_array) {
+    debug_session session;
+    input_map input;
+    char line[PARAMETERS_LENGTH * 2];
+    int running = 1;
+
+    for (int i = 0; i < code_length; i++) {
+        if (code[i].opcode == OP_SPAWN) {
+            fprintf(stderr, "Error: The debugger cannot run programs that SPAWN threads\n");
+            return;
+        }
+    }
+
+    memset(&session, 0, sizeof(session));
+    session.code = code;
+    session.code_length = code_length;
+    session.memory = memory_array;
+
+    vm_init(&session.state, code, code_length, memory_array);
+    session.state.instruction_limit = instruction_limit;
+    session.state.time_limit_ms = time_limit_ms;
+    session.state.return_stack_size = (int)call_stack_depth;
+    session.state.status = EXEC_BREAKPOINT;
+
+    if (input_filename != NULL) {
+        if (!map_input_file(input_filename, &input)) {
+            return;
+        }
+        session.state.input = input.values;
+        session.state.input_count = input.count;
+    }
+
+    printf("Debugging %d instructions; type help for the commands\n", code_length);
+    show_instruction(&session, 0);
+
+    while (1) {
+        char command[16] = "", argument[PARAMETERS_LENGTH] = "";
+        int index;
+
+        printf("(debug) ");
+        fflush(stdout);
+        if (fgets(line, sizeof(line), stdin) == NULL) {
+            break;
+        }
+        if (sscanf(line, "%15s %49s", command, argument) < 1) {
+            continue;
+        }
+
+        if (strcmp(command, "break") == 0 || strcmp(command, "b") == 0) {
+            if ((index = resolve_location(argument, code_length)) >= 0 && set_breakpoint(&session, index)) {
+                printf("Breakpoint at instruction %d\n", index + 1);
+            }
+        } else if (strcmp(command, "delete") == 0 || strcmp(command, "d") == 0) {
+            if ((index = resolve_location(argument, code_length)) >= 0) {
+                clear_breakpoint(&session, index);
+            }
+        } else if (strcmp(command, "info") == 0 || strcmp(command, "i") == 0) {
+            if (session.breakpoint_count == 0) {
+                printf("No breakpoints\n");
+            }
+            for (int k = 0; k < session.breakpoint_count; k++) {
+                show_instruction(&session, session.breakpoints[k].instruction);
+            }
+        } else if (strcmp(command, "step") == 0 || strcmp(command, "s") == 0 ||
+                   strcmp(command, "continue") == 0 || strcmp(command, "c") == 0) {
+            if (!running) {
+                printf("The program has ended\n");
+                continue;
+            }
+            if (command[0] == 's') {
+                step_instruction(&session);
+            } else {
+                continue_program(&session);
+            }
+            running = show_stop(&session);
+        } else if (strcmp(command, "list") == 0 || strcmp(command, "l") == 0) {
+            int first = session.state.pc - 3;
+            for (int i = (first < 0) ? 0 : first; i < code_length && i <= session.state.pc + 3; i++) {
+                show_instruction(&session, i);
+            }
+        } else if (strcmp(command, "registers") == 0 || strcmp(command, "r") == 0) {
+            for (int r = 0; r < VARIABLE_MEMORY_START; r++) {
+                printf("%s = %-12d%s", register_names[r], memory_array[r], (r % 4 == 3) ? "\n" : "");
+            }
+        } else if (strcmp(command, "print") == 0 || strcmp(command, "p") == 0) {
+            print_variable(&session, argument);
+        } else if (strcmp(command, "quit") == 0 || strcmp(command, "q") == 0) {
+            break;
+        } else if (strcmp(command, "help") == 0 || strcmp(command, "h") == 0) {
+            show_help();
+        } else {
+            fprintf(stderr, "Error: Unknown command '%s'; type help for the commands\n", command);
+        }
+    }
+
+    /* Leave the code as it was compiled */
+    while (session.breakpoint_count > 0) {
+        clear_breakpoint(&session, session.breakpoints[0].instruction);
+    }
+
+    vm_release(&session.state);
+    if (input_filename != NULL) {
+        unmap_input_file(&input);
+    }
+    free(session.breakpoints);
+}
@@ -11,6 +11,22 @@
 
 #include "FunctionHeaders.h"
 
+#include <time.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* Character reads for whole-array READ, without locking stdin every time */
+#ifdef _WIN32
+#define read_char() _getchar_nolock()
+#else
+#define read_char() getchar_unlocked()
+#endif
+
 /* External variables from main.c */
 extern int symbol_index;
 extern int intermediate_index;
@@ -18,6 +34,12 @@ extern int blocks_index;
 extern intermediate_lang **intermediate_table;
 extern symbol_table **symbol_tab;
 extern blocks_table **block_tab;
+extern long instruction_limit;
+extern long time_limit_ms;
+extern long call_stack_depth;
+extern const char *input_filename;
+extern const char *profile_output;
+extern int debug_mode;
 
 /**
  * @brief Displays the contents of the symbol table
@@ -67,7 +89,8 @@ void display_intermediate_table(void) {
                intermediate_table[i]->instruc_no, 
                intermediate_table[i]->opcode);
         
-        for (int j = 0; intermediate_table[i]->parameters[j] != -1; j++) {
+        for (int j = 0; j < 5 && (intermediate_table[i]->parameters[j] != -1 ||
+                                  operand_kind(intermediate_table[i]->opcode, j) == OPERAND_IMMEDIATE); j++) {
             printf("%d ", intermediate_table[i]->parameters[j]);
         }
         printf("\n");
@@ -103,6 +126,76 @@ void display_block_table(void) {
     return;
 }
 
+/* Layout of the last object file written, used for incremental updates */
+static long object_blocks_offset = -1;
+static long object_instructions_offset = -1;
+static int object_blocks_count = 0;
+static int object_instructions_count = 0;
+static int object_rows_fixed = 0;
+
+/**
+ * @brief Formats one row of the instruction table
+ * 
+ * Parameters are padded to OBJECT_PARAMS_WIDTH so that rows have a fixed
+ * width and can be rewritten in place.
+ * 
+ * @param index Index of the instruction in the intermediate table
+ * @param row Buffer of at least 128 bytes receiving the row
+ * @return int Length of the row
+ */
+static int format_instruction_row(int index, char *row) {
+    char params[64];
+    int length = 0;
+    
+    params[0] = '\0';
+    /* An immediate can be -1, which is otherwise the end marker */
+    for (int j = 0; j < 5 && (intermediate_table[index]->parameters[j] != -1 ||
+                              operand_kind(intermediate_table[index]->opcode, j) == OPERAND_IMMEDIATE); j++) {
+        length += sprintf(params + length, "%d ", intermediate_table[index]->parameters[j]);
+    }
+    
+    return sprintf(row, "%-5d %-5d %-*s\n",
+                   intermediate_table[index]->instruc_no,
+                   intermediate_table[index]->opcode,
+                   OBJECT_PARAMS_WIDTH, params);
+}
+
+/**
+ * @brief Cuts a file off at a given length
+ * 
+ * @param fp Open file
+ * @param length New length in bytes
+ * @return int 0 on success
+ */
+static int truncate_file(FILE *fp, long length) {
+#ifdef _WIN32
+    return _chsize(_fileno(fp), length);
+#else
+    return ftruncate(fileno(fp), length);
+#endif
+}
+
+/**
+ * @brief Writes instruction table rows from a given row to the end
+ * 
+ * @param fp Output file, positioned at the first row
+ * @param first_row Index of the first row to write
+ * @return int 1 if every row had the fixed width, 0 otherwise
+ */
+static int write_instruction_rows(FILE *fp, int first_row) {
+    char row[128];
+    int fixed = 1;
+    
+    for (int i = first_row; i < intermediate_index; i++) {
+        if (format_instruction_row(i, row) != OBJECT_ROW_WIDTH) {
+            fixed = 0;
+        }
+        fputs(row, fp);
+    }
+    
+    return fixed;
+}
+
 /**
  * @brief Writes the compiler output to a file
  * 
@@ -135,6 +228,7 @@ void dump_to_file(void) {
     fprintf(fp, "%-10s %-10s\n", "Label", "Address");
     fprintf(fp, "------------------------------------\n");
     
+    object_blocks_offset = ftell(fp);
     for (int i = 0; i < blocks_index; i++) {
         fprintf(fp, "%-10s %-10d\n", 
                 block_tab[i]->name, 
@@ -146,20 +240,70 @@ void dump_to_file(void) {
     fprintf(fp, "%-5s %-5s %-20s\n", "Line", "Op", "Parameters");
     fprintf(fp, "---------------------------------------------\n");
     
-    for (int i = 0; i < intermediate_index; i++) {
-        fprintf(fp, "%-5d %-5d ", 
-                intermediate_table[i]->instruc_no, 
-                intermediate_table[i]->opcode);
+    object_instructions_offset = ftell(fp);
+    object_rows_fixed = write_instruction_rows(fp, 0);
+    object_blocks_count = blocks_index;
+    object_instructions_count = intermediate_index;
+    
+    fclose(fp);
+    printf("Compilation successful. Output written to output.obj\n");
+    return;
+}
+
+/**
+ * @brief Rewrites part of the instruction table in the output file
+ * 
+ * The block table and the given instruction rows are rewritten in place.
+ * When the number of instructions changed, every row from first_row on is
+ * rewritten and the file is truncated to its new length. If the file
+ * layout does not allow an in-place update, the whole file is rewritten.
+ * 
+ * @param first_row Index of the first changed instruction
+ * @param last_row Index of the last changed instruction
+ */
+void update_object_file(int first_row, int last_row) {
+    char row[128];
+    FILE *fp;
+    
+    if (!object_rows_fixed || object_blocks_count != blocks_index ||
+        (fp = fopen("output.obj", "r+")) == NULL) {
+        dump_to_file();
+        return;
+    }
+    
+    /* Labels may have moved; block rows have a fixed width */
+    fseek(fp, object_blocks_offset, SEEK_SET);
+    for (int i = 0; i < blocks_index; i++) {
+        fprintf(fp, "%-10s %-10d\n", block_tab[i]->name, block_tab[i]->instr_no);
+    }
+    
+    if (object_instructions_count != intermediate_index) {
+        /* Rows after the change have moved: rewrite the tail */
+        long end = object_instructions_offset + (long)intermediate_index * OBJECT_ROW_WIDTH;
         
-        for (int j = 0; intermediate_table[i]->parameters[j] != -1; j++) {
-            fprintf(fp, "%d ", intermediate_table[i]->parameters[j]);
+        fseek(fp, object_instructions_offset + (long)first_row * OBJECT_ROW_WIDTH, SEEK_SET);
+        object_rows_fixed = write_instruction_rows(fp, first_row);
+        fflush(fp);
+        if (truncate_file(fp, end) != 0) {
+            fprintf(stderr, "Error: Could not truncate output file\n");
+        }
+        object_instructions_count = intermediate_index;
+    } else {
+        for (int i = first_row; i <= last_row && i < intermediate_index; i++) {
+            if (format_instruction_row(i, row) != OBJECT_ROW_WIDTH) {
+                object_rows_fixed = 0;
+                break;
+            }
+            fseek(fp, object_instructions_offset + (long)i * OBJECT_ROW_WIDTH, SEEK_SET);
+            fputs(row, fp);
         }
-        fprintf(fp, "\n");
     }
     
     fclose(fp);
-    printf("Compilation successful. Output written to output.obj\n");
-    return;
+    
+    if (!object_rows_fixed) {
+        dump_to_file();
+    }
 }
 
 /**
@@ -194,40 +338,276 @@ int check_condition(int operand1, int operand2, int opcode) {
 }
 
 /**
- * @brief Executes the compiled program
+ * @brief Reads a monotonic wall clock
  * 
- * This function runs the virtual machine that executes the
- * intermediate language instructions.
+ * @return long long Milliseconds since an arbitrary starting point
+ */
+static long long current_time_ms(void) {
+#ifdef _WIN32
+    return (long long)GetTickCount64();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+/**
+ * @brief Prepares a virtual machine to run the program from the start
+ * 
+ * Registers are cleared, no limits are set and the return stack gets
+ * the default depth of CALL_STACK_SIZE. The code is not copied, so it
+ * must outlive the state; several states can run the same code.
  * 
+ * @param state State to initialize
+ * @param code Instructions of the program
+ * @param code_length Number of instructions
  * @param memory_array Pointer to the memory array
- * @param memory_index Index of the last used memory location
  */
-void executor(int *memory_array, int memory_index) {
-    printf("\n--- Program Execution ---\n\n");
-    
-    if (intermediate_index <= 0) {
-        printf("No instructions to execute\n");
-        return;
-    }
-    
+void vm_init(vm_state *state, const intermediate_lang *code, int code_length, int *memory_array) {
     /* Initialize registers to 0 */
     for (int i = 0; i < VARIABLE_MEMORY_START; i++) {
         memory_array[i] = 0;
     }
     
+    state->code = code;
+    state->code_length = code_length;
+    state->pc = 0;
+    state->executed = 0;
+    state->instruction_limit = 0;
+    state->time_limit_ms = 0;
+    state->elapsed_ms = 0;
+    state->status = EXEC_FINISHED;
+    state->return_stack = NULL;
+    state->return_depth = 0;
+    state->return_stack_size = CALL_STACK_SIZE;
+    state->input = NULL;
+    state->input_count = 0;
+    state->input_position = 0;
+    state->output = stdout;
+    state->print = NULL;
+    state->print_context = NULL;
+    state->branches_taken = NULL;
+    state->branch_entries = NULL;
+    state->threads = NULL;
+    state->thread = 0;
+}
+
+/**
+ * @brief Frees the return stack of a virtual machine
+ * 
+ * @param state State to release
+ */
+void vm_release(vm_state *state) {
+    free(state->return_stack);
+    state->return_stack = NULL;
+    state->return_depth = 0;
+}
+
+/**
+ * @brief Reads one decimal value from stdin for READ
+ * 
+ * Invalid input is reported and read as 0.
+ * 
+ * @param value Receives the value
+ * @return int 1 if a value was read, 0 at the end of input
+ */
+static int read_text_value(int *value) {
+    int result, c;
+    
+    printf("Input: ");
+    result = scanf("%d", value);
+    if (result == EOF) {
+        return 0;
+    }
+    
+    if (result != 1) {
+        fprintf(stderr, "Error: Invalid input\n");
+        /* Clear input buffer */
+        while ((c = getchar()) != '\n' && c != EOF);
+        *value = 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Reads decimal values from stdin for READ of a whole array
+ * 
+ * The digits are converted by hand straight from the stdio buffer, which
+ * costs far less than one scanf call per element. An invalid value is
+ * reported, the rest of its line is skipped and it reads as 0.
+ * 
+ * @param values Receives the values
+ * @param count Number of values to read
+ * @return int Number of values read before the end of input
+ */
+static int read_text_values(int *values, int count) {
+    int n;
+    
+    printf("Input: ");
+    fflush(stdout);
+    
+    for (n = 0; n < count; n++) {
+        unsigned int value = 0;
+        int negative = 0, digits = 0;
+        int c = read_char();
+        
+        while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            c = read_char();
+        }
+        if (c == EOF) {
+            break;
+        }
+        
+        if (c == '-' || c == '+') {
+            negative = (c == '-');
+            c = read_char();
+        }
+        while (c >= '0' && c <= '9') {
+            value = value * 10 + (unsigned int)(c - '0');
+            digits++;
+            c = read_char();
+        }
+        
+        if (digits == 0) {
+            fprintf(stderr, "Error: Invalid input\n");
+            /* Clear input buffer */
+            while (c != '\n' && c != EOF) {
+                c = read_char();
+            }
+            values[n] = 0;
+            continue;
+        }
+        
+        if (c != EOF) {
+            ungetc(c, stdin);
+        }
+        values[n] = negative ? (int)(0u - value) : (int)value;
+    }
+    
+    return n;
+}
+
+/**
+ * @brief Prints every value of an array for PRINT of a whole array
+ * 
+ * The lines are formatted by hand into one buffer and written with a
+ * single call, instead of one printf per element.
+ * 
+ * @param output Stream to print to
+ * @param values Values to print
+ * @param count Number of values, at most MEMORY_SIZE
+ */
+static void print_values(FILE *output, const int *values, int count) {
+    /* "Output: ", a sign, 10 digits and a newline per value */
+    char buffer[MEMORY_SIZE * 20];
+    char *out = buffer;
+    
+    for (int n = 0; n < count; n++) {
+        unsigned int magnitude = (values[n] < 0) ? 0u - (unsigned int)values[n] : (unsigned int)values[n];
+        char digits[10];
+        int length = 0;
+        
+        do {
+            digits[length++] = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        
+        memcpy(out, "Output: ", 8);
+        out += 8;
+        if (values[n] < 0) {
+            *out++ = '-';
+        }
+        while (length > 0) {
+            *out++ = digits[--length];
+        }
+        *out++ = '\n';
+    }
+    
+    fwrite(buffer, 1, out - buffer, output);
+}
+
+/**
+ * @brief Runs the program until it ends or a limit is reached
+ * 
+ * The program must have passed verify_program, so the handlers below use
+ * operand addresses and branch targets without checking them. Executed
+ * instructions are counted per straight-line run when a branch is taken,
+ * and the limits are only checked on backward jumps (the time limit every
+ * TIME_CHECK_INTERVAL of them), so the common path pays nothing for them. A
+ * program can therefore overrun its instruction limit by at most one pass
+ * through its code. Calling vm_run again on a stopped state, typically
+ * after raising its limits, resumes where it stopped. A CALL beyond the
+ * return stack depth or a RET without a CALL stops the program at that
+ * instruction, and so does a lazily compiled block that fails
+ * verification or a SPAWN that cannot start its thread. In a spawned
+ * thread, the RET of its subroutine ends the thread instead. A trap the
+ * debugger patched in stops the program before the instruction it covers.
+ * 
+ * @param state State of the virtual machine
+ * @param memory_array Pointer to the memory array
+ * @return int EXEC_FINISHED, EXEC_INSTRUCTION_LIMIT, EXEC_TIME_LIMIT,
+ *             EXEC_RETURN_STACK, EXEC_INVALID_CODE, EXEC_THREAD_ERROR or
+ *             EXEC_BREAKPOINT
+ */
+int vm_run(vm_state *state, int *memory_array) {
+    const intermediate_lang *code = state->code;
+    int limited = (state->instruction_limit > 0 || state->time_limit_ms > 0);
+    int watched = (limited || state->branches_taken != NULL);  /* Branches need more than a jump */
+    long long started = current_time_ms();
+    int time_checks = 0;
+    int i = state->pc;
+    int segment_start = i;
+    
+    state->status = EXEC_FINISHED;
+    
+    /* The start of the program counts as an entry for the profile */
+    if (state->branch_entries != NULL && state->executed == 0) {
+        state->branch_entries[i]++;
+    }
+    
     /* Execute instructions */
-    for (int i = 0; i < intermediate_index;) {
-        int *params = intermediate_table[i]->parameters;
+    while (i < state->code_length) {
+        const int *params = code[i].parameters;
+        int target, count;
         
-        switch (intermediate_table[i]->opcode) {
+        switch (code[i].opcode) {
             case OP_READ:
-                printf("Input: ");
-                if (scanf("%d", &memory_array[params[0]]) != 1) {
-                    fprintf(stderr, "Error: Invalid input\n");
-                    /* Clear input buffer */
-                    while (getchar() != '\n');
-                    memory_array[params[0]] = 0;
+            case OP_READ_JUMP:
+                if (state->input != NULL) {
+                    /* Binary input is used in place, without parsing */
+                    if (state->input_position < state->input_count) {
+                        memory_array[params[0]] = state->input[state->input_position++];
+                        break;
+                    }
+                } else if (read_text_value(&memory_array[params[0]])) {
+                    break;
+                }
+                
+                /* End of input reads as 0 */
+                memory_array[params[0]] = 0;
+                if (code[i].opcode == OP_READ_JUMP) {
+                    target = params[1] - 1;
+                    goto branch;
+                }
+                break;
+                
+            case OP_READ_ARRAY:
+                if (state->input != NULL) {
+                    /* Copy as much of the array as the binary input still holds */
+                    count = (int)(state->input_count - state->input_position);
+                    if (count > params[1]) {
+                        count = params[1];
+                    }
+                    memcpy(&memory_array[params[0]], state->input + state->input_position,
+                           sizeof(int) * count);
+                    state->input_position += count;
+                } else {
+                    count = read_text_values(&memory_array[params[0]], params[1]);
                 }
+                
+                /* Elements past the end of input read as 0 */
+                memset(&memory_array[params[0] + count], 0, sizeof(int) * (params[1] - count));
                 break;
                 
             case OP_MOV_MEM_TO_REG:
@@ -247,32 +627,415 @@ void executor(int *memory_array, int memory_index) {
                 memory_array[params[0]] = memory_array[params[1]] * memory_array[params[2]];
                 break;
                 
+            case OP_SHL:
+                memory_array[params[0]] = (int)((unsigned int)memory_array[params[1]] << params[2]);
+                break;
+                
+            case OP_LOAD_IMM:
+                memory_array[params[0]] = params[1];
+                break;
+                
+            case OP_ADD_IMM:
+                memory_array[params[0]] = memory_array[params[1]] + params[2];
+                break;
+                
+            case OP_MUL_IMM:
+                memory_array[params[0]] = memory_array[params[1]] * params[2];
+                break;
+                
             case OP_PRINT:
-                printf("Output: %d\n", memory_array[params[0]]);
+                if (state->print != NULL) {
+                    vm_print(state, &memory_array[params[0]], 1);
+                } else {
+                    fprintf(state->output, "Output: %d\n", memory_array[params[0]]);
+                }
+                break;
+                
+            case OP_PRINT_ARRAY:
+                if (state->print != NULL) {
+                    vm_print(state, &memory_array[params[0]], params[1]);
+                } else {
+                    print_values(state->output, &memory_array[params[0]], params[1]);
+                }
                 break;
                 
             case OP_IF:
                 if (!check_condition(memory_array[params[0]], memory_array[params[1]], params[2])) {
                     /* Condition is false, jump to ELSE or ENDIF */
-                    i = params[3] - 1;
-                    continue;
+                    target = params[3] - 1;
+                    goto branch;
+                }
+                break;
+                
+            /* Specialized IFs: the comparison is part of the opcode */
+            case OP_IF_EQ:
+                if (memory_array[params[0]] != memory_array[params[1]]) {
+                    target = params[2] - 1;
+                    goto branch;
+                }
+                break;
+                
+            case OP_IF_LT:
+                if (memory_array[params[0]] >= memory_array[params[1]]) {
+                    target = params[2] - 1;
+                    goto branch;
+                }
+                break;
+                
+            case OP_IF_GT:
+                if (memory_array[params[0]] <= memory_array[params[1]]) {
+                    target = params[2] - 1;
+                    goto branch;
+                }
+                break;
+                
+            case OP_IF_LTEQ:
+                if (memory_array[params[0]] > memory_array[params[1]]) {
+                    target = params[2] - 1;
+                    goto branch;
+                }
+                break;
+                
+            case OP_IF_GTEQ:
+                if (memory_array[params[0]] < memory_array[params[1]]) {
+                    target = params[2] - 1;
+                    goto branch;
+                }
+                break;
+                
+            case OP_IF_NE:
+                if (memory_array[params[0]] == memory_array[params[1]]) {
+                    target = params[2] - 1;
+                    goto branch;
                 }
                 break;
                 
             case OP_JUMP:
                 /* Unconditional jump */
-                i = params[0] - 1;
+                target = params[0] - 1;
+                goto branch;
+                
+            case OP_LOOP:
+                /* Decrement (wrapping at INT_MIN) and branch while positive, so a count of 0 or less runs once */
+                memory_array[params[0]] = (int)((unsigned int)memory_array[params[0]] - 1u);
+                if (memory_array[params[0]] > 0) {
+                    target = params[1] - 1;
+                    goto branch;
+                }
+                break;
+                
+            case OP_FOR:
+                /* Skip the loop when the range is empty */
+                memory_array[params[0]] = memory_array[params[1]];
+                if (memory_array[params[0]] > memory_array[params[2]]) {
+                    target = params[3] - 1;
+                    goto branch;
+                }
+                break;
+                
+            case OP_NEXT:
+                /* Compare before incrementing, so a last value of INT_MAX cannot overflow */
+                if (memory_array[params[0]] < memory_array[params[1]]) {
+                    memory_array[params[0]]++;
+                    target = params[2] - 1;
+                    goto branch;
+                }
+                /* Leaving the loop still steps past the last value, wrapping at INT_MAX */
+                memory_array[params[0]] = (int)((unsigned int)memory_array[params[0]] + 1u);
+                break;
+                
+            case OP_CALL:
+                /* The return stack is only allocated by programs that call */
+                if (state->return_stack == NULL && state->return_stack_size > 0) {
+                    state->return_stack = (int*)stats_malloc(sizeof(int) * state->return_stack_size);
+                }
+                if (state->return_stack == NULL || state->return_depth >= state->return_stack_size) {
+                    goto stack_error;
+                }
+                state->return_stack[state->return_depth++] = i + 1;
+                target = params[0] - 1;
+                goto branch;
+                
+            case OP_RET:
+                if (state->return_depth <= 0) {
+                    if (state->thread > 0) {
+                        /* A spawned thread ends when its subroutine returns */
+                        state->executed += i + 1 - segment_start;
+                        i = segment_start = state->code_length;
+                        continue;
+                    }
+                    goto stack_error;
+                }
+                target = state->return_stack[--state->return_depth];
+                goto branch;
+                
+            case OP_SPAWN:
+                if (!spawn_thread(state, params[0] - 1)) {
+                    state->status = EXEC_THREAD_ERROR;
+                    goto stop;
+                }
+                break;
+                
+            case OP_JOIN:
+                join_threads(state);
+                break;
+                
+            /* Atomic on the shared cell; registers belong to one thread */
+            case OP_XADD:
+                count = ATOMIC_XADD(&memory_array[params[1]], memory_array[params[2]]);
+                memory_array[params[0]] = count;
+                break;
+                
+            case OP_CAS:
+                count = ATOMIC_CAS(&memory_array[params[1]], memory_array[params[2]], memory_array[params[3]]);
+                memory_array[params[0]] = count;
+                break;
+                
+            case OP_TRAP:
+                /* Breakpoint: the debugger holds the real opcode */
+                state->status = EXEC_BREAKPOINT;
+                goto stop;
+                
+            case OP_COMPILE:
+                /* Lazy mode: compile the block on first entry, then run it */
+                count = compile_block(i);
+                if (count < 0) {
+                    state->status = EXEC_INVALID_CODE;
+                    goto stop;
+                }
+                /* Lazily compiled code belongs to this run, never to a shared image */
+                for (int k = i; k <= count; k++) {
+                    ((intermediate_lang*)code)[k] = *intermediate_table[k];
+                }
                 continue;
                 
             default:
                 fprintf(stderr, "Warning: Unknown opcode %d at instruction %d\n", 
-                        intermediate_table[i]->opcode, intermediate_table[i]->instruc_no);
+                        code[i].opcode, code[i].instruc_no);
                 break;
         }
         
         i++;
+        continue;
+        
+    branch:
+        state->executed += i + 1 - segment_start;
+        if (watched) {
+            if (state->branches_taken != NULL) {
+                /* Edge counts are enough to work out how often each instruction ran */
+                state->branches_taken[i]++;
+                state->branch_entries[target]++;
+            }
+            if (target <= i && limited) {
+                /* Backward branch: the only place a program can loop */
+                if (state->instruction_limit > 0 && state->executed >= state->instruction_limit) {
+                    state->status = EXEC_INSTRUCTION_LIMIT;
+                } else if (state->time_limit_ms > 0 && ++time_checks >= TIME_CHECK_INTERVAL) {
+                    time_checks = 0;
+                    if (state->elapsed_ms + (current_time_ms() - started) >= state->time_limit_ms) {
+                        state->status = EXEC_TIME_LIMIT;
+                    }
+                }
+                
+                if (state->status != EXEC_FINISHED) {
+                    state->pc = target;
+                    state->elapsed_ms += current_time_ms() - started;
+                    fflush(state->output);
+                    return state->status;
+                }
+            }
+        }
+        i = segment_start = target;
     }
     
-    printf("\n--- End of Execution ---\n");
+    state->executed += i - segment_start;
+    state->elapsed_ms += current_time_ms() - started;
+    state->pc = i;
+    state->status = EXEC_FINISHED;
+    fflush(state->output);
+    return state->status;
+    
+stack_error:
+    state->status = EXEC_RETURN_STACK;
+    
+stop:
+    state->executed += i - segment_start;
+    state->elapsed_ms += current_time_ms() - started;
+    state->pc = i;
+    fflush(state->output);
+    return state->status;
+}
+
+/**
+ * @brief Reports why a virtual machine stopped before the end of the program
+ * 
+ * @param state State of the virtual machine after it ran
+ * @return int 1 if a reason was reported, 0 if the program finished
+ */
+int report_stop(const vm_state *state) {
+    char who[32];
+    
+    if (state->thread > 0) {
+        sprintf(who, "Thread %d stopped", state->thread);
+    } else {
+        strcpy(who, "Execution stopped");
+    }
+    
+    switch (state->status) {
+        case EXEC_INSTRUCTION_LIMIT:
+            fprintf(stderr, "\n%s: instruction limit of %ld reached "
+                    "after %lld instructions, at instruction %d\n",
+                    who, state->instruction_limit, state->executed, state->pc + 1);
+            return 1;
+            
+        case EXEC_TIME_LIMIT:
+            fprintf(stderr, "\n%s: time limit of %ld ms reached "
+                    "after %lld instructions, at instruction %d\n",
+                    who, state->time_limit_ms, state->executed, state->pc + 1);
+            return 1;
+            
+        case EXEC_RETURN_STACK:
+            if (state->code[state->pc].opcode == OP_RET) {
+                fprintf(stderr, "\n%s: RET without CALL at instruction %d\n",
+                        who, state->pc + 1);
+            } else {
+                fprintf(stderr, "\n%s: return stack depth of %d exceeded "
+                        "at instruction %d\n", who, state->return_stack_size, state->pc + 1);
+            }
+            return 1;
+            
+        case EXEC_INVALID_CODE:
+            fprintf(stderr, "\n%s: the block at instruction %d failed verification\n",
+                    who, state->pc + 1);
+            return 1;
+            
+        case EXEC_THREAD_ERROR:
+            fprintf(stderr, "\n%s: SPAWN could not start a thread at instruction %d\n",
+                    who, state->pc + 1);
+            return 1;
+            
+        case EXEC_BREAKPOINT:
+            fprintf(stderr, "\n%s: breakpoint at instruction %d\n", who, state->pc + 1);
+            return 1;
+            
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Runs code within the limits set on the command line
+ * 
+ * @param code Instructions of the program
+ * @param code_length Number of instructions
+ * @param memory_array Pointer to the memory array
+ */
+static void run_code(const intermediate_lang *code, int code_length, int *memory_array) {
+    vm_state state;
+    input_map input;
+    
+    vm_init(&state, code, code_length, memory_array);
+    state.instruction_limit = instruction_limit;
+    state.time_limit_ms = time_limit_ms;
+    state.return_stack_size = (int)call_stack_depth;
+    
+    if (input_filename != NULL) {
+        if (!map_input_file(input_filename, &input)) {
+            return;
+        }
+        state.input = input.values;
+        state.input_count = input.count;
+    }
+    
+    if (profile_output != NULL) {
+        state.branches_taken = (long long*)stats_calloc(code_length, sizeof(long long));
+        state.branch_entries = (long long*)stats_calloc(code_length + 1, sizeof(long long));
+        if (state.branches_taken == NULL || state.branch_entries == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for profile\n");
+            free(state.branches_taken);
+            free(state.branch_entries);
+            state.branches_taken = NULL;
+            state.branch_entries = NULL;
+        }
+    }
+    
+    vm_run_threads(&state, memory_array);
+    vm_release(&state);
+    
+    if (input_filename != NULL) {
+        unmap_input_file(&input);
+    }
+    
+    /* Whatever part of the program ran is worth keeping in the profile */
+    if (state.branches_taken != NULL) {
+        save_profile(profile_output, code, code_length, state.branches_taken, state.branch_entries);
+        free(state.branches_taken);
+        free(state.branch_entries);
+    }
+    
+    if (!report_stop(&state)) {
+        printf("\n--- End of Execution ---\n");
+    }
+}
+
+/**
+ * @brief Executes the compiled program
+ * 
+ * This function runs the virtual machine that executes the
+ * intermediate language instructions, within the limits set by
+ * instruction_limit and time_limit_ms. READ takes its values from
+ * input_filename when it is set, and from stdin otherwise. The
+ * instructions are copied into one contiguous array first, which is
+ * what the virtual machine runs. With debug_mode set, the program runs
+ * under the interactive debugger instead.
+ * 
+ * @param memory_array Pointer to the memory array
+ * @param memory_index Index of the last used memory location
+ */
+void executor(int *memory_array, int memory_index) {
+    intermediate_lang *code;
+    
+    printf("\n--- Program Execution ---\n\n");
+    
+    if (intermediate_index <= 0) {
+        printf("No instructions to execute\n");
+        return;
+    }
+    
+    code = (intermediate_lang*)stats_malloc(sizeof(intermediate_lang) * intermediate_index);
+    if (code == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for program code\n");
+        return;
+    }
+    
+    for (int i = 0; i < intermediate_index; i++) {
+        code[i] = *intermediate_table[i];
+    }
+    
+    if (debug_mode) {
+        debug_program(code, intermediate_index, memory_array);
+    } else {
+        run_code(code, intermediate_index, memory_array);
+    }
+    free(code);
     return;
 }
+
+/**
+ * @brief Executes a program image loaded by load_program_image
+ * 
+ * The code is run in place from the shared mapping and the memory array
+ * is the image's copy-on-write data segment.
+ * 
+ * @param image Loaded program image
+ */
+void execute_image(program_image *image) {
+    printf("\n--- Program Execution ---\n\n");
+    
+    if (image->code_length <= 0) {
+        printf("No instructions to execute\n");
+        return;
+    }
+    
+    run_code(image->code, image->code_length, image->memory);
+}
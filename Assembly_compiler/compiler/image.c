@@ -0,0 +1,262 @@
+/**
+ * @file image.c
+ * @brief Program images for the Assembly Language Compiler
+ *
+ * A program image holds the compiled instructions and the initial memory
+ * array in a binary file that can be run without the source. The code is
+ * mapped read-only and shared, so every process running the same image
+ * uses one copy of it from the page cache. The data segment is mapped
+ * copy-on-write on its own pages, so each process only pays for the pages
+ * it writes to.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* External variables from main.c */
+extern int intermediate_index;
+extern intermediate_lang **intermediate_table;
+
+/**
+ * @brief Writes the compiled program to a program image file
+ *
+ * The registers are stored cleared; every other cell is stored as it is
+ * in the memory array.
+ *
+ * @param filename Image file to write
+ * @param memory_array Memory array holding the CONST values
+ * @return int 1 on success, 0 on failure
+ */
+int save_program_image(const char *filename, const int *memory_array) {
+    image_header header;
+    int data[MEMORY_SIZE];
+    long code_end = (long)sizeof(image_header) + (long)sizeof(intermediate_lang) * intermediate_index;
+    FILE *fp;
+    int written = 1;
+
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.entry_size = (int)sizeof(intermediate_lang);
+    header.instruction_count = intermediate_index;
+    header.memory_size = MEMORY_SIZE;
+    header.image_end = memory_image_end();
+    header.data_offset = (int)((code_end + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT);
+
+    memcpy(data, memory_array, sizeof(data));
+    memset(data, 0, sizeof(int) * VARIABLE_MEMORY_START);
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not create program image %s\n", filename);
+        return 0;
+    }
+
+    written = (fwrite(&header, sizeof(header), 1, fp) == 1);
+    for (int i = 0; written && i < intermediate_index; i++) {
+        written = (fwrite(intermediate_table[i], sizeof(intermediate_lang), 1, fp) == 1);
+    }
+
+    /* The gap up to the data segment is left as a hole */
+    if (written) {
+        written = (fseek(fp, header.data_offset, SEEK_SET) == 0 &&
+                   fwrite(data, sizeof(data), 1, fp) == 1);
+    }
+
+    if (fclose(fp) != 0 || !written) {
+        fprintf(stderr, "Error: Could not write program image %s\n", filename);
+        return 0;
+    }
+
+    printf("Wrote program image %s: %d instructions, %d memory cells\n",
+           filename, header.instruction_count, header.image_end);
+    return 1;
+}
+
+/**
+ * @brief Checks the header of a mapped program image
+ *
+ * @param header Header at the start of the image
+ * @param size Size of the image file in bytes
+ * @return int 1 if the image can be used, 0 otherwise
+ */
+static int valid_header(const image_header *header, long long size) {
+    long long code_end;
+
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != IMAGE_VERSION) {
+        return 0;
+    }
+
+    /* Images from a build with another layout cannot be run in place */
+    if (header->entry_size != (int)sizeof(intermediate_lang) || header->memory_size != MEMORY_SIZE) {
+        return 0;
+    }
+
+    code_end = (long long)sizeof(image_header) + (long long)header->entry_size * header->instruction_count;
+    return header->instruction_count >= 0 && header->data_offset >= code_end &&
+           header->data_offset % IMAGE_ALIGNMENT == 0 &&
+           header->data_offset + (long long)sizeof(int) * MEMORY_SIZE <= size;
+}
+
+/**
+ * @brief Maps a program image file for execution
+ *
+ * The code is mapped read-only and shared, the data segment copy-on-write.
+ * The code is verified before the image is accepted.
+ *
+ * @param filename Image file to map
+ * @param image Receives the mapping
+ * @return int 1 on success, 0 on failure
+ */
+int load_program_image(const char *filename, program_image *image) {
+    const image_header *header;
+    long long size;
+    int errors;
+
+    image->code = NULL;
+    image->code_length = 0;
+    image->memory = NULL;
+    image->image_end = 0;
+    image->code_view = NULL;
+    image->code_size = 0;
+    image->data_view = NULL;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_size;
+    HANDLE mapping = NULL;
+
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Could not open program image %s\n", filename);
+        return 0;
+    }
+
+    if (!GetFileSizeEx(file, &file_size)) {
+        fprintf(stderr, "Error: Could not read the size of program image %s\n", filename);
+        CloseHandle(file);
+        return 0;
+    }
+    size = file_size.QuadPart;
+
+    if (size >= (long long)sizeof(image_header)) {
+        /* Write-copy protection lets the data view be mapped copy-on-write */
+        mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        image->code_view = (mapping != NULL) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    }
+    CloseHandle(file);
+#else
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open program image %s\n", filename);
+        return 0;
+    }
+
+    if (fstat(fd, &info) != 0) {
+        fprintf(stderr, "Error: Could not read the size of program image %s\n", filename);
+        close(fd);
+        return 0;
+    }
+    size = info.st_size;
+
+    if (size >= (long long)sizeof(image_header)) {
+        image->code_view = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+        if (image->code_view == MAP_FAILED) {
+            image->code_view = NULL;
+        }
+    }
+#endif
+
+    image->code_size = (size_t)size;
+    header = (const image_header*)image->code_view;
+
+    if (header == NULL || !valid_header(header, size)) {
+        fprintf(stderr, "Error: %s is not a program image for this compiler\n", filename);
+    } else {
+#ifdef _WIN32
+        image->data_view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, (DWORD)header->data_offset,
+                                         sizeof(int) * MEMORY_SIZE);
+#else
+        image->data_view = mmap(NULL, sizeof(int) * MEMORY_SIZE, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE, fd, (off_t)header->data_offset);
+        if (image->data_view == MAP_FAILED) {
+            image->data_view = NULL;
+        }
+#endif
+        if (image->data_view == NULL) {
+            fprintf(stderr, "Error: Could not map the data segment of program image %s\n", filename);
+        }
+    }
+
+    /* The views stay valid after the file and mapping handles are closed */
+#ifdef _WIN32
+    if (mapping != NULL) {
+        CloseHandle(mapping);
+    }
+#else
+    close(fd);
+#endif
+
+    if (image->data_view == NULL) {
+        release_program_image(image);
+        return 0;
+    }
+
+    image->code = (const intermediate_lang*)((const char*)image->code_view + sizeof(image_header));
+    image->code_length = header->instruction_count;
+    image->memory = (int*)image->data_view;
+    image->image_end = header->image_end;
+
+    /* The image may not come from this compiler, so it is checked like source */
+    errors = verify_code(image->code, image->code_length, image->image_end);
+    if (errors > 0) {
+        fprintf(stderr, "Error: Program image %s rejected, %d problem(s) found\n", filename, errors);
+        release_program_image(image);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Releases a mapping made by load_program_image
+ *
+ * @param image Image to release
+ */
+void release_program_image(program_image *image) {
+#ifdef _WIN32
+    if (image->data_view != NULL) {
+        UnmapViewOfFile(image->data_view);
+    }
+    if (image->code_view != NULL) {
+        UnmapViewOfFile(image->code_view);
+    }
+#else
+    if (image->data_view != NULL) {
+        munmap(image->data_view, sizeof(int) * MEMORY_SIZE);
+    }
+    if (image->code_view != NULL) {
+        munmap(image->code_view, image->code_size);
+    }
+#endif
+
+    image->code = NULL;
+    image->code_length = 0;
+    image->memory = NULL;
+    image->code_view = NULL;
+    image->code_size = 0;
+    image->data_view = NULL;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file input.c
+ * @brief Binary input files for the Assembly Language Compiler
+ *
+ * This file maps a file of 32-bit integers into memory so that READ can
+ * take its values straight from the mapping, without parsing or copying.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Stands in for the mapping of an empty file, which cannot be mapped */
+static const int empty_input[1] = { 0 };
+
+/**
+ * @brief Maps a binary input file into memory
+ *
+ * The file holds 32-bit integers in native byte order. Trailing bytes that
+ * do not make up a whole integer are ignored.
+ *
+ * @param filename File to map
+ * @param map Receives the mapping
+ * @return int 1 on success, 0 on failure
+ */
+int map_input_file(const char *filename, input_map *map) {
+    long long size;
+
+    map->values = empty_input;
+    map->count = 0;
+    map->view = NULL;
+    map->size = 0;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_size;
+    HANDLE mapping;
+
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Could not open input file %s\n", filename);
+        return 0;
+    }
+
+    if (!GetFileSizeEx(file, &file_size)) {
+        fprintf(stderr, "Error: Could not read the size of input file %s\n", filename);
+        CloseHandle(file);
+        return 0;
+    }
+    size = file_size.QuadPart;
+
+    if (size > 0) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        map->view = (mapping != NULL) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (mapping != NULL) {
+            CloseHandle(mapping);  /* The view keeps the mapping alive */
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open input file %s\n", filename);
+        return 0;
+    }
+
+    if (fstat(fd, &info) != 0) {
+        fprintf(stderr, "Error: Could not read the size of input file %s\n", filename);
+        close(fd);
+        return 0;
+    }
+    size = info.st_size;
+
+    if (size > 0) {
+        map->view = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map->view == MAP_FAILED) {
+            map->view = NULL;
+        } else {
+            madvise(map->view, (size_t)size, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);  /* The mapping stays valid after the file is closed */
+#endif
+
+    if (size > 0 && map->view == NULL) {
+        fprintf(stderr, "Error: Could not map input file %s\n", filename);
+        return 0;
+    }
+
+    if (size % sizeof(int) != 0) {
+        fprintf(stderr, "Warning: Input file %s ends with a partial integer\n", filename);
+    }
+
+    if (map->view != NULL) {
+        map->values = (const int*)map->view;
+    }
+    map->count = (long)(size / sizeof(int));
+    map->size = (size_t)size;
+    return 1;
+}
+
+/**
+ * @brief Releases a mapping made by map_input_file
+ *
+ * @param map Mapping to release
+ */
+void unmap_input_file(input_map *map) {
+    if (map->view != NULL) {
+#ifdef _WIN32
+        UnmapViewOfFile(map->view);
+#else
+        munmap(map->view, map->size);
+#endif
+    }
+
+    map->values = empty_input;
+    map->count = 0;
+    map->view = NULL;
+    map->size = 0;
+}
@@ -0,0 +1,300 @@
+/**
+ * @file lazy.c
+ * @brief Lazy compilation for the Assembly Language Compiler
+ *
+ * In lazy mode the instruction section is only scanned before the program
+ * starts: every instruction gets its number and file offset, labels go into
+ * the block table and IF/ELSE/ENDIF and FOR/NEXT targets are worked out
+ * from the keywords alone. Each instruction starts out as OP_COMPILE; the
+ * first time the virtual machine reaches one, the basic block starting
+ * there is compiled and verified, and stays compiled for later visits.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+/* External variables from main.c */
+extern int intermediate_index;
+extern int blocks_index;
+extern intermediate_lang **intermediate_table;
+extern blocks_table **block_tab;
+
+/* Source file, kept open while the program runs */
+static FILE *lazy_file = NULL;
+
+/* Scan results, one entry per instruction */
+static lazy_instruction *lazy_index = NULL;
+static int lazy_count = 0;
+static int lazy_capacity = 0;
+
+/**
+ * @brief Adds an instruction to the scan results
+ *
+ * @param offset File offset of the source line
+ * @return int Index of the instruction, or -1 if memory allocation failed
+ */
+static int add_lazy_instruction(long offset) {
+    if (lazy_count >= lazy_capacity) {
+        int new_capacity = (lazy_capacity > 0) ? lazy_capacity * 2 : 256;
+        lazy_instruction *grown = (lazy_instruction*)stats_realloc(lazy_index,
+                                                                   sizeof(lazy_instruction) * new_capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for instruction index\n");
+            return -1;
+        }
+        lazy_index = grown;
+        lazy_capacity = new_capacity;
+    }
+
+    lazy_index[lazy_count].offset = offset;
+    lazy_index[lazy_count].target = -1;
+    lazy_index[lazy_count].partner = -1;
+    return lazy_count++;
+}
+
+/**
+ * @brief Indexes the instruction section without compiling it
+ *
+ * The file must be positioned right after START:. It is kept open and
+ * closed by lazy_release.
+ *
+ * @param fp Source file
+ * @return int 1 on success, 0 if the program cannot be run
+ */
+int lazy_scan(FILE *fp) {
+    control_stack stack = { NULL, -1, 0 };
+    char line[LINE_SIZE];
+    long offset = ftell(fp);
+    int errors = 0;
+
+    lazy_file = fp;
+    lazy_count = 0;
+
+    while (fgets(line, LINE_SIZE, fp)) {
+        char instruction[INSTRUCTION_LENGTH];
+        size_t length;
+        int index;
+
+        line[strcspn(line, "\n")] = '\0';
+        length = strlen(line);
+
+        /* Labels, blank lines and ENDIF do not generate code */
+        if (length > 0 && line[length - 1] == ':') {
+            if (blocks_index >= 50) {
+                fprintf(stderr, "Error: Too many labels\n");
+                errors++;
+            } else {
+                /* Long labels are cut to LABEL_LENGTH - 1 characters */
+                size_t name_length = (length - 1 < LABEL_LENGTH - 1) ? length - 1 : LABEL_LENGTH - 1;
+                memcpy(block_tab[blocks_index]->name, line, name_length);
+                block_tab[blocks_index]->name[name_length] = '\0';
+                block_tab[blocks_index]->instr_no = lazy_count + 1;
+                blocks_index++;
+            }
+            offset = ftell(fp);
+            continue;
+        }
+
+        if (sscanf(line, "%5s", instruction) != 1) {
+            offset = ftell(fp);
+            continue;
+        }
+
+        if (strcmp(instruction, "END") == 0) {
+            break;
+        }
+
+        if (strcmp(instruction, "ENDIF") == 0) {
+            if (stack.top < 0 || lazy_index[stack.entries[stack.top]].partner == -2) {
+                fprintf(stderr, "Error: ENDIF without IF after instruction %d\n", lazy_count);
+                errors++;
+            } else {
+                /* The IF, or the jump at its ELSE, lands after the ENDIF */
+                lazy_index[stack.entries[stack.top--]].target = lazy_count + 1;
+            }
+            offset = ftell(fp);
+            continue;
+        }
+
+        index = add_lazy_instruction(offset);
+        if (index < 0) {
+            release_control_stack(&stack);
+            return 0;
+        }
+        offset = ftell(fp);
+
+        if (strcmp(instruction, "IF") == 0 || strcmp(instruction, "FOR") == 0) {
+            if (!push_control(&stack, index)) {
+                errors++;
+                break;
+            }
+            /* A partner of -2 marks a FOR on the stack */
+            lazy_index[index].partner = (instruction[0] == 'F') ? -2 : -1;
+        } else if (strcmp(instruction, "ELSE") == 0) {
+            if (stack.top < 0 || lazy_index[stack.entries[stack.top]].partner == -2) {
+                fprintf(stderr, "Error: ELSE without IF at line %d\n", index + 1);
+                errors++;
+                continue;
+            }
+            /* The false branch starts right after the ELSE */
+            lazy_index[stack.entries[stack.top]].target = index + 2;
+            stack.entries[stack.top] = index;
+        } else if (strcmp(instruction, "NEXT") == 0) {
+            if (stack.top < 0 || lazy_index[stack.entries[stack.top]].partner != -2) {
+                fprintf(stderr, "Error: NEXT without FOR at line %d\n", index + 1);
+                errors++;
+                continue;
+            }
+            /* The FOR skips past the NEXT, the NEXT goes back into the body */
+            lazy_index[stack.entries[stack.top]].target = index + 2;
+            lazy_index[index].target = stack.entries[stack.top] + 2;
+            lazy_index[index].partner = stack.entries[stack.top--];
+        }
+    }
+
+    if (stack.top >= 0) {
+        fprintf(stderr, "Error: Unmatched IF/ELSE/FOR statements\n");
+        errors++;
+    }
+    release_control_stack(&stack);
+
+    if (errors > 0 || !ensure_intermediate_capacity(lazy_count)) {
+        return 0;
+    }
+
+    /* Every instruction compiles itself when it is first reached */
+    for (int i = 0; i < lazy_count; i++) {
+        intermediate_table[i]->instruc_no = i + 1;
+        intermediate_table[i]->opcode = OP_COMPILE;
+        intermediate_table[i]->parameters[0] = -1;  /* End marker */
+    }
+    intermediate_index = lazy_count;
+
+    return 1;
+}
+
+/**
+ * @brief Compiles one indexed instruction in place
+ *
+ * @param index Index of the instruction
+ * @return int Opcode of the compiled instruction, or -1 on failure
+ */
+static int compile_lazy_instruction(int index) {
+    control_stack stack = { NULL, -1, 0 };
+    char line[LINE_SIZE], instruction[INSTRUCTION_LENGTH];
+    intermediate_lang *instr = intermediate_table[index];
+    int instruction_no = index + 1;
+    int saved_index = intermediate_index;
+
+    if (fseek(lazy_file, lazy_index[index].offset, SEEK_SET) != 0 ||
+        fgets(line, LINE_SIZE, lazy_file) == NULL || sscanf(line, "%5s", instruction) != 1) {
+        fprintf(stderr, "Error: Could not read the source of instruction %d\n", instruction_no);
+        return -1;
+    }
+
+    if (strcmp(instruction, "ELSE") == 0) {
+        instr->opcode = OP_JUMP;
+        instr->parameters[0] = lazy_index[index].target;
+        instr->parameters[1] = -1;  /* End marker */
+        return instr->opcode;
+    }
+
+    if (strcmp(instruction, "NEXT") == 0) {
+        /* The counter and bound come from the matching FOR */
+        char for_line[LINE_SIZE], counter[VARIABLE_LENGTH], first[VARIABLE_LENGTH], last[VARIABLE_LENGTH];
+
+        if (fseek(lazy_file, lazy_index[lazy_index[index].partner].offset, SEEK_SET) != 0 ||
+            fgets(for_line, LINE_SIZE, lazy_file) == NULL ||
+            sscanf(for_line, " FOR %4s = %4s TO %4s", counter, first, last) != 3) {
+            fprintf(stderr, "Error: Invalid FOR statement for NEXT at line %d\n", instruction_no);
+            return -1;
+        }
+        instr->opcode = OP_NEXT;
+        instr->parameters[0] = getAddress(counter);
+        instr->parameters[1] = getAddress(last);
+        instr->parameters[2] = lazy_index[index].target;
+        instr->parameters[3] = -1;  /* End marker */
+        return instr->opcode;
+    }
+
+    /* The handlers append at intermediate_index, so point it at the slot */
+    intermediate_index = index;
+    compile_instruction(line, &instruction_no, &stack);
+    release_control_stack(&stack);  /* IF and FOR targets come from the scan */
+    if (intermediate_index == index) {
+        intermediate_index = saved_index;
+        return -1;  /* The handler reported the problem */
+    }
+    intermediate_index = saved_index;
+
+    /* IF and FOR targets are known from the scan */
+    if (instr->opcode == OP_IF || instr->opcode == OP_FOR) {
+        instr->parameters[3] = lazy_index[index].target;
+    }
+
+    return instr->opcode;
+}
+
+/**
+ * @brief Compiles the basic block that starts at an instruction
+ *
+ * Instructions are compiled up to the first one that can branch, or up to
+ * one that is already compiled. The new instructions are verified before
+ * they are run.
+ *
+ * @param index Index of the first instruction of the block
+ * @return int Index of the last instruction of the block, or -1 if the
+ *             block is invalid
+ */
+int compile_block(int index) {
+    int last = index;
+
+    for (;;) {
+        int opcode = compile_lazy_instruction(last);
+        int ends_block = 0;
+
+        if (opcode < 0) {
+            intermediate_table[last]->opcode = -1;  /* Rejected by the verifier */
+            break;
+        }
+
+        for (int j = 0; j < 5; j++) {
+            if (operand_kind(opcode, j) == OPERAND_TARGET) {
+                ends_block = 1;
+            }
+        }
+
+        if (ends_block || opcode == OP_RET || last + 1 >= lazy_count ||
+            intermediate_table[last + 1]->opcode != OP_COMPILE) {
+            break;
+        }
+        last++;
+    }
+
+    /* Labels that do not exist are reported and fail verification */
+    resolve_label_fixups();
+    if (verify_instructions(index, last) != 0) {
+        return -1;
+    }
+
+    /* Code that is not compiled yet may write a CONST, so no immediates */
+    specialize_instructions(index, last, NULL);
+    return last;
+}
+
+/**
+ * @brief Closes the source file and frees the scan results
+ */
+void lazy_release(void) {
+    if (lazy_file != NULL) {
+        fclose(lazy_file);
+        lazy_file = NULL;
+    }
+
+    free(lazy_index);
+    lazy_index = NULL;
+    lazy_count = 0;
+    lazy_capacity = 0;
+}
@@ -0,0 +1,211 @@
+/**
+ * @file library.c
+ * @brief Library API of the Assembly Language Compiler
+ *
+ * Lets another program host the compiler and the virtual machine in its
+ * own process. asm_compile compiles program text held in memory into an
+ * asm_program, and asm_run runs it with the caller's input values and a
+ * function receiving the PRINT values, then hands back the final memory.
+ * Neither touches the filesystem, reads stdin or writes progress messages
+ * to stdout; output.obj is not written.
+ *
+ * Compiling works on the global compiler tables, so programs must be
+ * compiled from one thread at a time. A compiled program is independent
+ * of the tables and can be run by several threads at once.
+ *
+ * Build the sources with COMPILER_LIBRARY defined to leave out main.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+/* External variables from main.c */
+extern int intermediate_index;
+extern intermediate_lang **intermediate_table;
+extern int symbol_index;
+extern symbol_table **symbol_tab;
+extern int compiler_messages;
+
+/* READ without input values reads the end of input */
+static const int no_input[1] = { 0 };
+
+/**
+ * @brief Drops the values a program PRINTs, when the caller gave no function
+ *
+ * @param context Unused
+ * @param values Unused
+ * @param count Unused
+ */
+static void discard_output(void *context, const int *values, int count) {
+    (void)context;
+    (void)values;
+    (void)count;
+}
+
+/**
+ * @brief Compiles a program from text in memory
+ *
+ * The text is a complete source, as it would be read from a .asm file.
+ * Problems are reported on stderr like for a source file.
+ *
+ * @param source Program text
+ * @param length Length of the text in characters
+ * @param optimize 1 to run the optimizer
+ * @return asm_program* Program, to be freed with asm_release_program, or
+ *                      NULL if it was rejected
+ */
+asm_program *asm_compile(const char *source, long length, int optimize) {
+    source_reader reader = { NULL, source, source + length };
+    int memory_array[MEMORY_SIZE] = { 0 };
+    int memory_index = VARIABLE_MEMORY_START - 1;  /* 0 to 7 are reserved for registers */
+    asm_program *program;
+
+    if (!init_compiler()) {
+        return NULL;
+    }
+
+    /* The host owns stdout; only diagnostics are written, to stderr */
+    compiler_messages = 0;
+    reset_compiler();
+    compile_declarations(&reader, memory_array, &memory_index);
+    if (!compile_instructions(&reader, memory_array, optimize)) {
+        return NULL;
+    }
+
+    program = (asm_program*)stats_calloc(1, sizeof(asm_program));
+    if (program != NULL) {
+        program->code = (intermediate_lang*)stats_malloc(sizeof(intermediate_lang) * (intermediate_index + 1));
+        program->symbols = (symbol_table*)stats_malloc(sizeof(symbol_table) * (symbol_index + 1));
+    }
+    if (program == NULL || program->code == NULL || program->symbols == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for compiled program\n");
+        asm_release_program(program);
+        return NULL;
+    }
+
+    program->code_length = intermediate_index;
+    for (int i = 0; i < intermediate_index; i++) {
+        program->code[i] = *intermediate_table[i];
+    }
+    program->symbol_count = symbol_index;
+    for (int i = 0; i < symbol_index; i++) {
+        program->symbols[i] = *symbol_tab[i];
+    }
+    memcpy(program->memory, memory_array, sizeof(memory_array));
+
+    return program;
+}
+
+/**
+ * @brief Finds a DATA or CONST variable of a compiled program
+ *
+ * @param program Compiled program
+ * @param name Name of the variable
+ * @param size Receives the number of cells of the variable, if not NULL
+ * @return int Address of the variable in the memory array, or -1 if the
+ *             program has no variable of that name
+ */
+int asm_find_variable(const asm_program *program, const char *name, int *size) {
+    for (int i = 0; i < program->symbol_count; i++) {
+        if (strcmp(program->symbols[i].variable_name, name) == 0) {
+            if (size != NULL) {
+                *size = program->symbols[i].size;
+            }
+            return program->symbols[i].address;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Runs a compiled program
+ *
+ * Every run starts from the program's initial memory. The print function
+ * is also called from threads the program starts with SPAWN, but never by
+ * two threads at once, so it needs no locking of its own.
+ *
+ * @param program Compiled program
+ * @param options Input, output and limits of the run, or NULL for none
+ * @param memory Receives the MEMORY_SIZE cells of the final memory array,
+ *               if not NULL
+ * @return int EXEC_* status of the run
+ */
+int asm_run(const asm_program *program, const asm_run_options *options, int *memory) {
+    int memory_array[MEMORY_SIZE];
+    vm_state state;
+
+    memcpy(memory_array, program->memory, sizeof(memory_array));
+    vm_init(&state, program->code, program->code_length, memory_array);
+    state.input = no_input;
+    state.print = discard_output;
+
+    if (options != NULL) {
+        if (options->input != NULL) {
+            state.input = options->input;
+            state.input_count = options->input_count;
+        }
+        if (options->print != NULL) {
+            state.print = options->print;
+            state.print_context = options->print_context;
+        }
+        state.instruction_limit = options->instruction_limit;
+        state.time_limit_ms = options->time_limit_ms;
+        if (options->call_stack_depth > 0) {
+            state.return_stack_size = options->call_stack_depth;
+        }
+    }
+
+    vm_run_threads(&state, memory_array);
+    vm_release(&state);
+
+    if (memory != NULL) {
+        memcpy(memory, memory_array, sizeof(memory_array));
+    }
+    return state.status;
+}
+
+/**
+ * @brief Print function storing the values in an asm_output_buffer
+ *
+ * Values past the capacity are counted but not stored.
+ *
+ * @param context asm_output_buffer receiving the values
+ * @param values Values printed
+ * @param count Number of values
+ */
+void asm_collect_output(void *context, const int *values, int count) {
+    asm_output_buffer *buffer = (asm_output_buffer*)context;
+
+    for (int i = 0; i < count; i++) {
+        if (buffer->count < buffer->capacity) {
+            buffer->values[buffer->count] = values[i];
+        }
+        buffer->count++;
+    }
+}
+
+/**
+ * @brief Frees a compiled program
+ *
+ * @param program Program from asm_compile, or NULL
+ */
+void asm_release_program(asm_program *program) {
+    if (program != NULL) {
+        free(program->code);
+        free(program->symbols);
+        free(program);
+    }
+}
+
+/**
+ * @brief Frees the compiler tables once the host is done compiling
+ *
+ * Compiled programs stay valid. A later asm_compile allocates the tables
+ * again.
+ */
+void asm_shutdown(void) {
+    release_compiler();
+}
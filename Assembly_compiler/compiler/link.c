@@ -0,0 +1,635 @@
+/**
+ * @file link.c
+ * @brief Separate compilation and linking for the Assembly Language Compiler
+ *
+ * A module names the labels and variables it shares with EXPORT name and
+ * the ones it uses from other modules with IMPORT name, next to its DATA
+ * and CONST declarations. Compiled with -m, a module becomes a relocatable
+ * object: its instructions are numbered from 1, its variables start at
+ * VARIABLE_MEMORY_START, and every operand naming an import holds a
+ * placeholder from IMPORT_ADDRESS_BASE up.
+ *
+ * The linker places the objects one after the other, the first one at the
+ * start of the program. Branch targets move with their module's code,
+ * addresses with its variables, and placeholders become the address or
+ * instruction the exporting module gives the name. The linked program is
+ * then verified, optimized and specialized like a program compiled from a
+ * single file, so only the modules that changed need to be compiled again.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+/* External variables from main.c */
+extern int symbol_index;
+extern int blocks_index;
+extern int intermediate_index;
+extern intermediate_lang **intermediate_table;
+extern symbol_table **symbol_tab;
+extern blocks_table **block_tab;
+
+/* EXPORT and IMPORT declarations of the module being compiled */
+static object_symbol *exports = NULL;
+static int export_count = 0;
+static int export_capacity = 0;
+static object_symbol *imports = NULL;
+static int import_count = 0;
+static int import_capacity = 0;
+
+/**
+ * @brief Adds a name to a list of declared symbols
+ *
+ * A name that is already in the list is not added again.
+ *
+ * @param list List of symbols
+ * @param count Pointer to the number of symbols in the list
+ * @param capacity Pointer to the number of symbols the list can hold
+ * @param name Name of the symbol
+ */
+static void add_declared_symbol(object_symbol **list, int *count, int *capacity, const char *name) {
+    object_symbol *symbol;
+
+    for (int i = 0; i < *count; i++) {
+        if (strncmp((*list)[i].name, name, LABEL_LENGTH - 1) == 0) {
+            return;
+        }
+    }
+
+    if (*count >= *capacity) {
+        int new_capacity = (*capacity > 0) ? *capacity * 2 : 16;
+        object_symbol *grown = (object_symbol*)stats_realloc(*list, sizeof(object_symbol) * new_capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for module symbols\n");
+            return;
+        }
+        *list = grown;
+        *capacity = new_capacity;
+    }
+
+    symbol = &(*list)[(*count)++];
+    memset(symbol, 0, sizeof(object_symbol));
+    strncpy(symbol->name, name, LABEL_LENGTH - 1);
+}
+
+/**
+ * @brief Forgets the EXPORT and IMPORT declarations of the last module
+ */
+void reset_module_symbols(void) {
+    export_count = 0;
+    import_count = 0;
+}
+
+/**
+ * @brief Processes an EXPORT declaration
+ *
+ * @param name Label or variable the module makes visible to other modules
+ */
+void declare_export(const char *name) {
+    add_declared_symbol(&exports, &export_count, &export_capacity, name);
+}
+
+/**
+ * @brief Processes an IMPORT declaration
+ *
+ * @param name Label or variable the module uses from another module
+ */
+void declare_import(const char *name) {
+    add_declared_symbol(&imports, &import_count, &import_capacity, name);
+}
+
+/**
+ * @brief Gets the placeholder operand for an imported symbol
+ *
+ * @param name Symbol name
+ * @return int Placeholder, or -1 if the name is not imported
+ */
+int find_import(const char *name) {
+    for (int i = 0; i < import_count; i++) {
+        if (strcmp(imports[i].name, name) == 0) {
+            return IMPORT_ADDRESS_BASE + i * IMPORT_ADDRESS_SPAN;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Gets the number of IMPORT declarations of the module being compiled
+ *
+ * @return int Number of imported symbols
+ */
+int module_import_count(void) {
+    return import_count;
+}
+
+/**
+ * @brief Finds a variable in the symbol table
+ *
+ * @param name Variable name
+ * @return int Index in the symbol table, or -1 if it is not declared
+ */
+static int find_variable(const char *name) {
+    for (int i = 0; i < symbol_index; i++) {
+        if (strcmp(symbol_tab[i]->variable_name, name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Gets the import an operand stands for
+ *
+ * @param value Operand value
+ * @param imports_in_module Number of imports of the module
+ * @return int Index of the import, or -1 if the operand is not a placeholder
+ */
+static int import_index(int value, int imports_in_module) {
+    int index;
+
+    if (value < IMPORT_ADDRESS_BASE) {
+        return -1;
+    }
+
+    index = (value - IMPORT_ADDRESS_BASE) / IMPORT_ADDRESS_SPAN;
+    return (index < imports_in_module) ? index : -1;
+}
+
+/**
+ * @brief Checks that an instruction of a module can be relocated
+ *
+ * Addresses must lie in the registers or the module's own variables and
+ * branch targets in its own code, unless they name an import.
+ *
+ * @param instr Instruction to check
+ * @param length Number of instructions in the module
+ * @param data_end First address past the module's variables
+ * @return int Number of problems found
+ */
+static int check_module_instruction(const intermediate_lang *instr, int length, int data_end) {
+    int errors = 0;
+
+    for (int j = 0; j < 5; j++) {
+        int kind = operand_kind(instr->opcode, j);
+        int value = instr->parameters[j];
+        int index = import_index(value, import_count);
+
+        if (kind & OPERAND_UPDATE) {
+            if (index >= 0) {
+                continue;
+            }
+            if (value < 0 || value >= data_end || value + operand_cells(instr, j) > data_end) {
+                fprintf(stderr, "Error: Instruction %d: operand %d refers to address %d, "
+                        "outside the module's variables 0-%d\n", instr->instruc_no, j + 1, value, data_end - 1);
+                errors++;
+            }
+        } else if (kind == OPERAND_TARGET) {
+            if (index >= 0 && (value - IMPORT_ADDRESS_BASE) % IMPORT_ADDRESS_SPAN == 0) {
+                continue;
+            }
+            if (value < 1 || value > length + 1) {
+                fprintf(stderr, "Error: Instruction %d: branch target %d is not an instruction "
+                        "of the module (1-%d)\n", instr->instruc_no, value, length + 1);
+                errors++;
+            }
+        }
+    }
+
+    return errors;
+}
+
+/**
+ * @brief Writes the compiled module to a relocatable object file
+ *
+ * The instructions must have been compiled and their labels resolved, but
+ * not verified or optimized: that happens once the program is linked.
+ *
+ * @param filename Object file to write
+ * @param memory_array Memory array holding the CONST values
+ * @return int 1 on success, 0 on failure
+ */
+int save_object(const char *filename, const int *memory_array) {
+    object_header header;
+    FILE *fp;
+    int errors = 0;
+    int written;
+
+    memcpy(header.magic, OBJECT_MAGIC, sizeof(header.magic));
+    header.version = OBJECT_VERSION;
+    header.entry_size = (int)sizeof(intermediate_lang);
+    header.instruction_count = intermediate_index;
+    header.data_end = memory_image_end();
+    header.symbol_count = symbol_index;
+    header.export_count = export_count;
+    header.import_count = import_count;
+
+    /* Exports take their values from the block and symbol tables */
+    for (int i = 0; i < export_count; i++) {
+        int target = find_label(exports[i].name);
+        int variable = find_variable(exports[i].name);
+
+        if (target >= 0) {
+            exports[i].kind = OBJECT_LABEL;
+            exports[i].value = target;
+            exports[i].size = 0;
+        } else if (variable >= 0) {
+            exports[i].kind = OBJECT_DATA;
+            exports[i].value = symbol_tab[variable]->address;
+            exports[i].size = symbol_tab[variable]->size;
+        } else {
+            fprintf(stderr, "Error: Exported symbol '%s' is not defined\n", exports[i].name);
+            errors++;
+        }
+    }
+
+    for (int i = 0; i < import_count; i++) {
+        if (find_label(imports[i].name) >= 0 || find_variable(imports[i].name) >= 0) {
+            fprintf(stderr, "Error: Imported symbol '%s' is also defined in this module\n", imports[i].name);
+            errors++;
+        }
+    }
+
+    for (int i = 0; i < intermediate_index; i++) {
+        errors += check_module_instruction(intermediate_table[i], intermediate_index, header.data_end);
+    }
+
+    if (errors > 0) {
+        fprintf(stderr, "Error: Module rejected, %d problem(s) found\n", errors);
+        return 0;
+    }
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not create object %s\n", filename);
+        return 0;
+    }
+
+    written = (fwrite(&header, sizeof(header), 1, fp) == 1);
+    for (int i = 0; written && i < intermediate_index; i++) {
+        written = (fwrite(intermediate_table[i], sizeof(intermediate_lang), 1, fp) == 1);
+    }
+    if (written && header.data_end > VARIABLE_MEMORY_START) {
+        written = (fwrite(&memory_array[VARIABLE_MEMORY_START], sizeof(int),
+                          header.data_end - VARIABLE_MEMORY_START, fp) ==
+                   (size_t)(header.data_end - VARIABLE_MEMORY_START));
+    }
+    for (int i = 0; written && i < symbol_index; i++) {
+        written = (fwrite(symbol_tab[i], sizeof(symbol_table), 1, fp) == 1);
+    }
+    if (written && export_count > 0) {
+        written = (fwrite(exports, sizeof(object_symbol), export_count, fp) == (size_t)export_count);
+    }
+    if (written && import_count > 0) {
+        written = (fwrite(imports, sizeof(object_symbol), import_count, fp) == (size_t)import_count);
+    }
+
+    if (fclose(fp) != 0 || !written) {
+        fprintf(stderr, "Error: Could not write object %s\n", filename);
+        return 0;
+    }
+
+    printf("Wrote object %s: %d instructions, %d memory cells, %d exports, %d imports\n",
+           filename, header.instruction_count, header.data_end - VARIABLE_MEMORY_START,
+           export_count, import_count);
+    return 1;
+}
+
+/**
+ * @brief Reads one section of an object file
+ *
+ * @param fp Object file
+ * @param size Size of one element
+ * @param count Number of elements
+ * @return void* Elements, or NULL if they could not be read; an empty
+ *               section gives a valid allocation
+ */
+static void *read_section(FILE *fp, size_t size, int count) {
+    void *section = stats_malloc(size * (count > 0 ? count : 1));
+
+    if (section != NULL && count > 0 && fread(section, size, count, fp) != (size_t)count) {
+        free(section);
+        return NULL;
+    }
+
+    return section;
+}
+
+/**
+ * @brief Loads a relocatable object file
+ *
+ * @param filename Object file to load
+ * @param module Receives the sections of the object
+ * @return int 1 on success, 0 on failure
+ */
+static int load_object(const char *filename, linked_module *module) {
+    object_header *header = &module->header;
+    FILE *fp = fopen(filename, "rb");
+
+    module->filename = filename;
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not open object %s\n", filename);
+        return 0;
+    }
+
+    if (fread(header, sizeof(object_header), 1, fp) != 1 ||
+        memcmp(header->magic, OBJECT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != OBJECT_VERSION || header->entry_size != (int)sizeof(intermediate_lang) ||
+        header->instruction_count < 0 || header->data_end < VARIABLE_MEMORY_START ||
+        header->data_end > MEMORY_SIZE || header->symbol_count < 0 ||
+        header->export_count < 0 || header->import_count < 0) {
+        fprintf(stderr, "Error: %s is not an object for this compiler\n", filename);
+        fclose(fp);
+        return 0;
+    }
+
+    module->code = (intermediate_lang*)read_section(fp, sizeof(intermediate_lang), header->instruction_count);
+    module->data = (int*)read_section(fp, sizeof(int), header->data_end - VARIABLE_MEMORY_START);
+    module->symbols = (symbol_table*)read_section(fp, sizeof(symbol_table), header->symbol_count);
+    module->exports = (object_symbol*)read_section(fp, sizeof(object_symbol), header->export_count);
+    module->imports = (object_symbol*)read_section(fp, sizeof(object_symbol), header->import_count);
+    module->resolved = (const object_symbol**)stats_calloc(header->import_count > 0 ? header->import_count : 1,
+                                                           sizeof(object_symbol*));
+    fclose(fp);
+
+    if (module->code == NULL || module->data == NULL || module->symbols == NULL ||
+        module->exports == NULL || module->imports == NULL || module->resolved == NULL) {
+        fprintf(stderr, "Error: Could not read object %s\n", filename);
+        return 0;
+    }
+
+    /* Names come from the file, so they are terminated here */
+    for (int i = 0; i < header->export_count; i++) {
+        module->exports[i].name[LABEL_LENGTH - 1] = '\0';
+    }
+    for (int i = 0; i < header->import_count; i++) {
+        module->imports[i].name[LABEL_LENGTH - 1] = '\0';
+    }
+    for (int i = 0; i < header->symbol_count; i++) {
+        module->symbols[i].variable_name[VARIABLE_LENGTH - 1] = '\0';
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Frees the sections of loaded objects
+ *
+ * @param modules Objects to free
+ * @param count Number of objects
+ */
+static void release_modules(linked_module *modules, int count) {
+    for (int i = 0; i < count; i++) {
+        free(modules[i].code);
+        free(modules[i].data);
+        free(modules[i].symbols);
+        free(modules[i].exports);
+        free(modules[i].imports);
+        free((void*)modules[i].resolved);
+    }
+    free(modules);
+}
+
+/**
+ * @brief Finds the module exporting a symbol
+ *
+ * @param modules Loaded objects
+ * @param count Number of objects to search
+ * @param name Symbol name
+ * @param owner Receives the index of the exporting module
+ * @return const object_symbol* Export, or NULL if no module exports the name
+ */
+static const object_symbol *find_export(const linked_module *modules, int count,
+                                        const char *name, int *owner) {
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < modules[i].header.export_count; j++) {
+            if (strcmp(modules[i].exports[j].name, name) == 0) {
+                *owner = i;
+                return &modules[i].exports[j];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Relocates the operands of one linked instruction
+ *
+ * @param instr Instruction, already copied into the intermediate table
+ * @param module Module the instruction comes from
+ * @return int Number of problems found
+ */
+static int relocate_instruction(intermediate_lang *instr, const linked_module *module) {
+    const object_symbol *array = NULL;
+    int array_offset = 0;
+    int errors = 0;
+
+    for (int j = 0; j < 5; j++) {
+        int kind = operand_kind(instr->opcode, j);
+        int value = instr->parameters[j];
+        int index = import_index(value, module->header.import_count);
+        const object_symbol *symbol = (index >= 0) ? module->resolved[index] : NULL;
+
+        if (kind & OPERAND_UPDATE) {
+            if (symbol == NULL) {
+                /* Registers stay where they are */
+                if (value >= VARIABLE_MEMORY_START) {
+                    instr->parameters[j] = value + module->data_base - VARIABLE_MEMORY_START;
+                }
+            } else if (symbol->kind != OBJECT_DATA) {
+                fprintf(stderr, "Error: %s: instruction %d uses the label '%s' as a variable\n",
+                        module->filename, instr->instruc_no, symbol->name);
+                errors++;
+            } else {
+                array = symbol;
+                array_offset = (value - IMPORT_ADDRESS_BASE) % IMPORT_ADDRESS_SPAN;
+                instr->parameters[j] = symbol->value + array_offset;
+
+                if (array_offset >= ((symbol->size == CONST_VARIABLE_SIZE) ? 1 : symbol->size)) {
+                    fprintf(stderr, "Error: %s: instruction %d indexes '%s' past its end\n",
+                            module->filename, instr->instruc_no, symbol->name);
+                    errors++;
+                }
+            }
+        } else if (kind == OPERAND_TARGET) {
+            if (symbol == NULL) {
+                instr->parameters[j] = value + module->code_base;
+            } else if (symbol->kind != OBJECT_LABEL) {
+                fprintf(stderr, "Error: %s: instruction %d branches to the variable '%s'\n",
+                        module->filename, instr->instruc_no, symbol->name);
+                errors++;
+            } else {
+                instr->parameters[j] = symbol->value;
+            }
+        } else if (kind == OPERAND_COUNT && array != NULL) {
+            /* The size of an imported array is only known to its module */
+            if (array->size == CONST_VARIABLE_SIZE) {
+                fprintf(stderr, "Error: %s: '%s' is not a DATA variable at instruction %d\n",
+                        module->filename, array->name, instr->instruc_no);
+                errors++;
+            } else {
+                instr->parameters[j] = array->size - array_offset;
+            }
+        }
+    }
+
+    return errors;
+}
+
+/**
+ * @brief Links relocatable objects into the program to run
+ *
+ * The objects are placed in the order given, so the program starts with
+ * the first one. Each object except the last is followed by a JUMP past the
+ * end of the program, so running off the end of a module still ends it.
+ * The intermediate, symbol and block tables and the memory array are
+ * replaced by the linked program; the block table holds the exported
+ * labels.
+ *
+ * @param filenames Object files
+ * @param count Number of object files
+ * @param memory_array Memory array receiving the initial values
+ * @param memory_index Pointer to the current memory index
+ * @return int 1 if the objects were linked, 0 otherwise
+ */
+int link_objects(const char **filenames, int count, int *memory_array, int *memory_index) {
+    linked_module *modules = (linked_module*)stats_calloc(count, sizeof(linked_module));
+    int code_length = 0, data_end = VARIABLE_MEMORY_START;
+    int errors = 0;
+
+    if (modules == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for objects\n");
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!load_object(filenames[i], &modules[i])) {
+            release_modules(modules, count);
+            return 0;
+        }
+    }
+
+    /* Lay out the code and the variables of the modules one after the other */
+    for (int i = 0; i < count; i++) {
+        modules[i].code_base = code_length;
+        modules[i].data_base = data_end;
+        code_length += modules[i].header.instruction_count + ((i < count - 1) ? 1 : 0);
+        data_end += modules[i].header.data_end - VARIABLE_MEMORY_START;
+    }
+
+    if (data_end > MEMORY_SIZE) {
+        fprintf(stderr, "Error: The linked variables need %d memory cells, only %d are available\n",
+                data_end - VARIABLE_MEMORY_START, MEMORY_SIZE - VARIABLE_MEMORY_START);
+        release_modules(modules, count);
+        return 0;
+    }
+
+    /* Exports take their place in the linked program */
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < modules[i].header.export_count; j++) {
+            object_symbol *symbol = &modules[i].exports[j];
+            int owner;
+
+            if (symbol->kind == OBJECT_LABEL) {
+                symbol->value += modules[i].code_base;
+            } else {
+                symbol->value += modules[i].data_base - VARIABLE_MEMORY_START;
+            }
+
+            if (find_export(modules, i, symbol->name, &owner) != NULL) {
+                fprintf(stderr, "Error: '%s' is exported by both %s and %s\n",
+                        symbol->name, modules[owner].filename, modules[i].filename);
+                errors++;
+            }
+        }
+    }
+
+    /* Every import must be exported by another module */
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < modules[i].header.import_count; j++) {
+            int owner;
+
+            modules[i].resolved[j] = find_export(modules, count, modules[i].imports[j].name, &owner);
+            if (modules[i].resolved[j] == NULL) {
+                fprintf(stderr, "Error: %s: undefined symbol '%s'\n",
+                        modules[i].filename, modules[i].imports[j].name);
+                errors++;
+            }
+        }
+    }
+
+    if (errors > 0 || !ensure_intermediate_capacity(code_length)) {
+        release_modules(modules, count);
+        return 0;
+    }
+
+    symbol_index = 0;
+    blocks_index = 0;
+    for (int i = 0; i < count; i++) {
+        const linked_module *module = &modules[i];
+        int length = module->header.instruction_count;
+
+        for (int j = 0; j < length; j++) {
+            intermediate_lang *instr = intermediate_table[module->code_base + j];
+
+            *instr = module->code[j];
+            errors += relocate_instruction(instr, module);
+            instr->instruc_no = module->code_base + j + 1;
+        }
+
+        /* Running off the end of a module ends the program */
+        if (i < count - 1) {
+            intermediate_lang *instr = intermediate_table[module->code_base + length];
+
+            instr->instruc_no = module->code_base + length + 1;
+            instr->opcode = OP_JUMP;
+            instr->parameters[0] = code_length + 1;
+            instr->parameters[1] = -1;  /* End marker */
+        }
+
+        memcpy(&memory_array[module->data_base], module->data,
+               sizeof(int) * (module->header.data_end - VARIABLE_MEMORY_START));
+
+        for (int j = 0; j < module->header.symbol_count; j++) {
+            if (symbol_index >= 25) {
+                fprintf(stderr, "Error: Too many variables in the linked program\n");
+                errors++;
+                break;
+            }
+            *symbol_tab[symbol_index] = module->symbols[j];
+            symbol_tab[symbol_index]->address += module->data_base - VARIABLE_MEMORY_START;
+            symbol_index++;
+        }
+
+        for (int j = 0; j < module->header.export_count; j++) {
+            if (module->exports[j].kind != OBJECT_LABEL) {
+                continue;
+            }
+            if (blocks_index >= 50) {
+                fprintf(stderr, "Error: Too many labels\n");
+                errors++;
+                break;
+            }
+            /* Both are LABEL_LENGTH arrays, terminated when the object was loaded */
+            memcpy(block_tab[blocks_index]->name, module->exports[j].name, LABEL_LENGTH);
+            block_tab[blocks_index]->instr_no = module->exports[j].value;
+            blocks_index++;
+        }
+    }
+
+    intermediate_index = code_length;
+    *memory_index = data_end;
+    release_modules(modules, count);
+
+    if (errors > 0) {
+        fprintf(stderr, "Error: Link failed, %d problem(s) found\n", errors);
+        return 0;
+    }
+
+    printf("Linked %d objects: %d instructions, %d memory cells\n",
+           count, code_length, data_end - VARIABLE_MEMORY_START);
+    return 1;
+}
@@ -11,8 +11,14 @@
 
 #include "FunctionHeaders.h"
 
+/* _getch, for the prompt before exiting */
+#ifdef _WIN32
+#include <conio.h>
+#endif
+
 /* Global variables */
 int intermediate_index = 0;
+int intermediate_capacity = 0;
 intermediate_lang **intermediate_table = NULL;
 
 int symbol_index = 0;
@@ -21,6 +27,95 @@ symbol_table **symbol_tab = NULL;
 int blocks_index = 0;
 blocks_table **block_tab = NULL;
 
+long instruction_limit = 0;     /* 0 means no limit */
+long time_limit_ms = 0;         /* 0 means no limit */
+long call_stack_depth = CALL_STACK_SIZE;
+const char *input_filename = NULL;  /* NULL reads text from stdin */
+const char *profile_output = NULL;  /* NULL records no profile */
+int debug_mode = 0;                 /* 1 runs the program under the debugger */
+int compiler_messages = 1;          /* 0 keeps progress messages off stdout */
+
+/* Branches to labels that were not defined yet */
+static label_fixup *label_fixups = NULL;
+static int fixup_index = 0;
+static int fixup_capacity = 0;
+
+/**
+ * @brief Grows the intermediate table so it can hold a number of instructions
+ * 
+ * The table at least doubles when it grows, so appending instructions one
+ * at a time stays cheap.
+ * 
+ * @param needed Number of instructions the table must be able to hold
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int ensure_intermediate_capacity(int needed) {
+    if (needed <= intermediate_capacity) {
+        return 1;
+    }
+    
+    int new_capacity = (intermediate_capacity > 0) ? intermediate_capacity * 2 : 50;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    
+    intermediate_lang **table = (intermediate_lang**)stats_realloc(intermediate_table,
+                                                                   sizeof(intermediate_lang*) * new_capacity);
+    if (table == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for intermediate table\n");
+        return 0;
+    }
+    intermediate_table = table;
+    
+    for (int i = intermediate_capacity; i < new_capacity; i++) {
+        intermediate_table[i] = (intermediate_lang*)stats_malloc(sizeof(intermediate_lang));
+        if (intermediate_table[i] == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for intermediate table entry\n");
+            intermediate_capacity = i;
+            return 0;
+        }
+    }
+    
+    intermediate_capacity = new_capacity;
+    return 1;
+}
+
+/**
+ * @brief Pushes an entry onto a control stack, growing it if needed
+ * 
+ * @param stack Control stack
+ * @param entry Entry to push
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int push_control(control_stack *stack, int entry) {
+    if (stack->top + 1 >= stack->capacity) {
+        int new_capacity = (stack->capacity > 0) ? stack->capacity * 2 : STACK_SIZE;
+        int *entries = (int*)stats_realloc(stack->entries, sizeof(int) * new_capacity);
+        
+        if (entries == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for control stack\n");
+            return 0;
+        }
+        stack->entries = entries;
+        stack->capacity = new_capacity;
+    }
+    
+    stack->entries[++stack->top] = entry;
+    return 1;
+}
+
+/**
+ * @brief Frees the entries of a control stack and empties it
+ * 
+ * @param stack Control stack
+ */
+void release_control_stack(control_stack *stack) {
+    free(stack->entries);
+    stack->entries = NULL;
+    stack->top = -1;
+    stack->capacity = 0;
+}
+
 /**
  * @brief Processes a CONST declaration
  * 
@@ -50,9 +145,10 @@ void const_func(char (*tokens)[10], int *memory, int *memory_index) {
         }
     }
     
+    /* The value goes into the cell the symbol table assigned */
+    memory[symbol_tab[symbol_index]->address] = atoi(tokens[3]);
+    *memory_index = symbol_tab[symbol_index]->address + 1;
     symbol_index++;
-    memory[*memory_index] = atoi(tokens[3]);
-    (*memory_index)++;
 }
 
 /**
@@ -172,6 +268,24 @@ int generate_opcode(const char *instruction) {
         return OP_ENDIF;
     if (strcmp(instruction, "END") == 0)
         return OP_END;
+    if (strcmp(instruction, "LOOP") == 0)
+        return OP_LOOP;
+    if (strcmp(instruction, "FOR") == 0)
+        return OP_FOR;
+    if (strcmp(instruction, "NEXT") == 0)
+        return OP_NEXT;
+    if (strcmp(instruction, "CALL") == 0)
+        return OP_CALL;
+    if (strcmp(instruction, "RET") == 0)
+        return OP_RET;
+    if (strcmp(instruction, "SPAWN") == 0)
+        return OP_SPAWN;
+    if (strcmp(instruction, "JOIN") == 0)
+        return OP_JOIN;
+    if (strcmp(instruction, "XADD") == 0)
+        return OP_XADD;
+    if (strcmp(instruction, "CAS") == 0)
+        return OP_CAS;
     
     fprintf(stderr, "Warning: Unknown instruction '%s'\n", instruction);
     return -1;
@@ -228,10 +342,121 @@ int getAddress(char *variable_name) {
         }
     }
     
+    /* Imported variables get their address from the linker */
+    int imported = find_import(variable_name);
+    if (imported >= 0) {
+        return imported + array_index;
+    }
+    
     fprintf(stderr, "Error: Variable '%s' not found\n", variable_name);
     return -1; /* Variable not found */
 }
 
+/**
+ * @brief Gets the number of elements of the variable at an address
+ * 
+ * @param address Memory address of the variable
+ * @return int Size from the symbol table, or 0 if no DATA variable starts there
+ */
+static int array_size(int address) {
+    for (int i = 0; i < symbol_index; i++) {
+        if (symbol_tab[i]->address == address && symbol_tab[i]->size != CONST_VARIABLE_SIZE) {
+            if (address + symbol_tab[i]->size > MEMORY_SIZE) {
+                return MEMORY_SIZE - address;
+            }
+            return symbol_tab[i]->size;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Looks up the instruction number of a label
+ * 
+ * @param name Label name
+ * @return int Instruction number, or -1 if the label is not defined
+ */
+int find_label(const char *name) {
+    for (int i = 0; i < blocks_index; i++) {
+        if (strcmp(block_tab[i]->name, name) == 0) {
+            return block_tab[i]->instr_no;
+        }
+    }
+    
+    return -1;
+}
+
+/**
+ * @brief Gets the branch target for a label
+ * 
+ * A label that is not defined yet is recorded so resolve_label_fixups can
+ * fill in the parameter once the whole program has been read.
+ * 
+ * @param name Label name
+ * @param slot Parameter index of the target in the current instruction
+ * @param mnemonic Instruction name for error messages
+ * @return int Instruction number, or WILDCARD_VALUE if it is filled in later
+ */
+static int label_target(const char *name, int slot, const char *mnemonic) {
+    int target = find_label(name);
+    
+    if (target >= 0) {
+        return target;
+    }
+    
+    /* Grow the fixup list */
+    if (fixup_index >= fixup_capacity) {
+        int new_capacity = (fixup_capacity > 0) ? fixup_capacity * 2 : 16;
+        label_fixup *fixups = (label_fixup*)stats_realloc(label_fixups, sizeof(label_fixup) * new_capacity);
+        if (fixups == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for label fixups\n");
+            return 0;
+        }
+        label_fixups = fixups;
+        fixup_capacity = new_capacity;
+    }
+    
+    label_fixups[fixup_index].instruction = intermediate_index;
+    label_fixups[fixup_index].slot = slot;
+    label_fixups[fixup_index].mnemonic = mnemonic;
+    strncpy(label_fixups[fixup_index].name, name, PARAMETERS_LENGTH - 1);
+    label_fixups[fixup_index].name[PARAMETERS_LENGTH - 1] = '\0';
+    fixup_index++;
+    
+    return WILDCARD_VALUE;  /* To be filled later */
+}
+
+/**
+ * @brief Fills in branches to labels that were defined after the branch
+ * 
+ * @return int Number of labels that are not defined anywhere
+ */
+int resolve_label_fixups(void) {
+    int missing = 0;
+    
+    for (int i = 0; i < fixup_index; i++) {
+        intermediate_lang *instr = intermediate_table[label_fixups[i].instruction];
+        int target = find_label(label_fixups[i].name);
+        
+        /* Imported labels get their instruction from the linker */
+        if (target < 0) {
+            target = find_import(label_fixups[i].name);
+        }
+        
+        if (target < 0) {
+            fprintf(stderr, "Error: Label '%s' not found for %s at line %d\n",
+                    label_fixups[i].name, label_fixups[i].mnemonic, instr->instruc_no);
+            target = 0;  /* Default to start */
+            missing++;
+        }
+        instr->parameters[label_fixups[i].slot] = target;
+    }
+    
+    fixup_index = 0;
+    return missing;
+}
+
 /**
  * @brief Processes a MOV instruction
  * 
@@ -280,7 +505,7 @@ void mov_func(char *param, int instruction_no) {
 }
 
 /**
- * @brief Processes binary operations (ADD, SUB, MUL)
+ * @brief Processes binary operations (ADD, SUB, MUL, XADD)
  * 
  * @param opcode Operation code
  * @param param Parameters for the instruction
@@ -326,16 +551,70 @@ void binaryOperations_func(int opcode, char *param, int instruction_no) {
     intermediate_index++;
 }
 
+/**
+ * @brief Processes a READ or PRINT of a whole array
+ * 
+ * The number of elements comes from the symbol table.
+ * 
+ * @param opcode OP_READ_ARRAY or OP_PRINT_ARRAY
+ * @param param Array operand, written as name[]
+ * @param instruction_no Current instruction number
+ */
+void array_func(int opcode, char *param, int instruction_no) {
+    int address = getAddress(param);
+    int size = (address >= VARIABLE_MEMORY_START) ? array_size(address) : 0;
+    
+    /* The size of an imported array is filled in by the linker */
+    if (address >= 0 && size == 0 && address < IMPORT_ADDRESS_BASE) {
+        fprintf(stderr, "Error: '%s' is not a DATA variable at line %d\n", param, instruction_no);
+    }
+    
+    /* Set up instruction */
+    intermediate_table[intermediate_index]->instruc_no = instruction_no;
+    intermediate_table[intermediate_index]->opcode = opcode;
+    intermediate_table[intermediate_index]->parameters[0] = address;
+    intermediate_table[intermediate_index]->parameters[1] = size;
+    intermediate_table[intermediate_index]->parameters[2] = -1;  /* End marker */
+    
+    intermediate_index++;
+}
+
 /**
  * @brief Processes a READ instruction
  * 
- * @param param Parameter for the instruction
+ * READ operand, label jumps to the label at the end of input instead of
+ * falling through. READ C[] reads every element of the array C.
+ * 
+ * @param param Parameters for the instruction
  * @param instruction_no Current instruction number
  */
 void read_func(char *param, int instruction_no) {
-    intermediate_table[intermediate_index]->parameters[0] = getAddress(param);
-    intermediate_table[intermediate_index]->parameters[1] = -1;  /* End marker */
-    intermediate_table[intermediate_index]->opcode = OP_READ;
+    char *operand = strtok(param, ", ");
+    char *label = strtok(NULL, ", ");
+    
+    if (operand == NULL) {
+        fprintf(stderr, "Error: Invalid READ instruction at line %d\n", instruction_no);
+        return;
+    }
+    
+    if (strstr(operand, "[]") != NULL) {
+        if (label != NULL) {
+            fprintf(stderr, "Error: READ of a whole array cannot jump at the end of input, line %d\n",
+                    instruction_no);
+        }
+        array_func(OP_READ_ARRAY, operand, instruction_no);
+        return;
+    }
+    
+    intermediate_table[intermediate_index]->parameters[0] = getAddress(operand);
+    if (label != NULL) {
+        intermediate_table[intermediate_index]->opcode = OP_READ_JUMP;
+        intermediate_table[intermediate_index]->parameters[1] = label_target(label, 1, "READ");
+        intermediate_table[intermediate_index]->parameters[2] = -1;  /* End marker */
+    } else {
+        intermediate_table[intermediate_index]->opcode = OP_READ;
+        intermediate_table[intermediate_index]->parameters[1] = -1;  /* End marker */
+    }
     intermediate_table[intermediate_index]->instruc_no = instruction_no;
     
     intermediate_index++;
@@ -344,10 +623,17 @@ void read_func(char *param, int instruction_no) {
 /**
  * @brief Processes a PRINT instruction
  * 
+ * PRINT C[] prints every element of the array C.
+ * 
  * @param param Parameter for the instruction
  * @param instruction_no Current instruction number
  */
 void print_func(char *param, int instruction_no) {
+    if (strstr(param, "[]") != NULL) {
+        array_func(OP_PRINT_ARRAY, param, instruction_no);
+        return;
+    }
+    
     intermediate_table[intermediate_index]->parameters[0] = getAddress(param);
     intermediate_table[intermediate_index]->parameters[1] = -1;  /* End marker */
     intermediate_table[intermediate_index]->opcode = OP_PRINT;
@@ -362,13 +648,12 @@ void print_func(char *param, int instruction_no) {
  * @param param Parameters for the instruction
  * @param instruction_no Current instruction number
  * @param stack Stack for tracking nested control structures
- * @param top Pointer to the stack top
  */
-void if_func(char *param, int instruction_no, int *stack, int *top) {
-    char operand1[VARIABLE_LENGTH], oper[4], operand2[VARIABLE_LENGTH];
+void if_func(char *param, int instruction_no, control_stack *stack) {
+    char operand1[VARIABLE_LENGTH], oper[INSTRUCTION_LENGTH], operand2[VARIABLE_LENGTH];
     
-    /* Parse parameters */
-    if (sscanf(param, "%s %s %s", operand1, oper, operand2) != 3) {
+    /* Parse parameters; LTEQ and GTEQ need the full width of oper */
+    if (sscanf(param, "%4s %5s %4s", operand1, oper, operand2) != 3) {
         fprintf(stderr, "Error: Invalid IF statement at line %d\n", instruction_no);
         return;
     }
@@ -382,12 +667,10 @@ void if_func(char *param, int instruction_no, int *stack, int *top) {
     intermediate_table[intermediate_index]->parameters[3] = WILDCARD_VALUE;  /* To be filled later */
     intermediate_table[intermediate_index]->parameters[4] = -1;  /* End marker */
     
-    /* Push into stack */
-    if (*top >= STACK_SIZE - 1) {
-        fprintf(stderr, "Error: Stack overflow at line %d\n", instruction_no);
+    /* Push into stack; ENDIF patches the instruction through its index */
+    if (!push_control(stack, intermediate_index)) {
         return;
     }
-    stack[++(*top)] = instruction_no;
     
     intermediate_index++;
 }
@@ -397,9 +680,8 @@ void if_func(char *param, int instruction_no, int *stack, int *top) {
  * 
  * @param instruction_no Current instruction number
  * @param stack Stack for tracking nested control structures
- * @param top Pointer to the stack top
  */
-void else_func(int instruction_no, int *stack, int *top) {
+void else_func(int instruction_no, control_stack *stack) {
     /* Set up instruction */
     intermediate_table[intermediate_index]->instruc_no = instruction_no;
     intermediate_table[intermediate_index]->opcode = OP_JUMP;
@@ -407,11 +689,9 @@ void else_func(int instruction_no, int *stack, int *top) {
     intermediate_table[intermediate_index]->parameters[1] = -1;  /* End marker */
     
     /* Push into stack */
-    if (*top >= STACK_SIZE - 1) {
-        fprintf(stderr, "Error: Stack overflow at line %d\n", instruction_no);
+    if (!push_control(stack, intermediate_index)) {
         return;
     }
-    stack[++(*top)] = instruction_no;
     
     intermediate_index++;
 }
@@ -419,61 +699,44 @@ void else_func(int instruction_no, int *stack, int *top) {
 /**
  * @brief Processes an ENDIF instruction
  * 
+ * The stack holds the indices of the open IF and ELSE instructions, so
+ * they are patched directly however long or deeply nested the branches are.
+ * 
  * @param instruction_no Current instruction number
  * @param stack Stack for tracking nested control structures
- * @param top Pointer to the stack top
  */
-void endif_func(int instruction_no, int *stack, int *top) {
-    if (*top < 0) {
+void endif_func(int instruction_no, control_stack *stack) {
+    if (stack->top < 0) {
         fprintf(stderr, "Error: Unmatched ENDIF at line %d\n", instruction_no);
         return;
     }
     
     /* Pop ELSE or IF from stack */
-    int popped_value = stack[(*top)--];
-    int i = intermediate_index;
-    
-    /* Find the instruction */
-    while (i > 0 && intermediate_table[i-1]->instruc_no != popped_value) {
-        i--;
-    }
-    
-    if (i <= 0) {
-        fprintf(stderr, "Error: Could not find matching IF/ELSE for ENDIF at line %d\n", instruction_no);
-        return;
-    }
+    intermediate_lang *popped = intermediate_table[stack->entries[stack->top--]];
     
-    /* Update the jump target */
-    intermediate_table[i-1]->parameters[0] = instruction_no;
-    
-    /* If it was an ELSE, we're done */
-    if (intermediate_table[i-1]->opcode == OP_JUMP) {
+    if (popped->opcode == OP_FOR) {
+        fprintf(stderr, "Error: ENDIF inside FOR loop without NEXT at line %d\n", instruction_no);
+        stack->top++;  /* Leave the FOR for its NEXT */
         return;
     }
     
-    /* If it was an IF, we need to update the false branch target */
-    if (*top < 0) {
-        fprintf(stderr, "Error: Unmatched IF-ENDIF at line %d\n", instruction_no);
+    /* If it was an IF without ELSE, the false branch goes past the ENDIF */
+    if (popped->opcode == OP_IF) {
+        popped->parameters[3] = instruction_no;
         return;
     }
     
-    /* Pop the matching IF */
-    int temp = popped_value;
-    popped_value = stack[(*top)--];
-    i = intermediate_index;
-    
-    /* Find the instruction */
-    while (i > 0 && intermediate_table[i-1]->instruc_no != popped_value) {
-        i--;
-    }
+    /* It was an ELSE: jump over the false branch */
+    popped->parameters[0] = instruction_no;
     
-    if (i <= 0) {
-        fprintf(stderr, "Error: Could not find matching IF for ENDIF at line %d\n", instruction_no);
+    /* The matching IF must still be on the stack */
+    if (stack->top < 0 || intermediate_table[stack->entries[stack->top]]->opcode != OP_IF) {
+        fprintf(stderr, "Error: Unmatched IF-ENDIF at line %d\n", instruction_no);
         return;
     }
     
-    /* Update the false branch target */
-    intermediate_table[i-1]->parameters[3] = temp + 1;
+    /* Pop the matching IF; the false branch starts right after the ELSE */
+    intermediate_table[stack->entries[stack->top--]]->parameters[3] = popped->instruc_no + 1;
 }
 
 /**
@@ -483,286 +746,970 @@ void endif_func(int instruction_no, int *stack, int *top) {
  * @param instruction_no Current instruction number
  */
 void jump_func(char *param, int instruction_no) {
-    int found = 0;
-    
     /* Set up instruction */
     intermediate_table[intermediate_index]->instruc_no = instruction_no;
     intermediate_table[intermediate_index]->opcode = OP_JUMP;
+    intermediate_table[intermediate_index]->parameters[0] = label_target(param, 0, "JUMP");
+    intermediate_table[intermediate_index]->parameters[1] = -1;  /* End marker */
     
-    /* Look up the target label */
-    for (int i = 0; i < blocks_index; i++) {
-        if (strcmp(block_tab[i]->name, param) == 0) {
-            intermediate_table[intermediate_index]->parameters[0] = block_tab[i]->instr_no;
-            intermediate_table[intermediate_index]->parameters[1] = -1;  /* End marker */
-            found = 1;
-            break;
-        }
-    }
+    intermediate_index++;
+}
+
+/**
+ * @brief Processes a CALL instruction
+ * 
+ * CALL label pushes the return address on the return stack and jumps to
+ * the label; the subroutine goes back with RET.
+ * 
+ * @param param Parameter for the instruction
+ * @param instruction_no Current instruction number
+ */
+void call_func(char *param, int instruction_no) {
+    /* Set up instruction */
+    intermediate_table[intermediate_index]->instruc_no = instruction_no;
+    intermediate_table[intermediate_index]->opcode = OP_CALL;
+    intermediate_table[intermediate_index]->parameters[0] = label_target(param, 0, "CALL");
+    intermediate_table[intermediate_index]->parameters[1] = -1;  /* End marker */
     
-    if (!found) {
-        fprintf(stderr, "Error: Label '%s' not found for JUMP at line %d\n", param, instruction_no);
-        intermediate_table[intermediate_index]->parameters[0] = 0;  /* Default to start */
-        intermediate_table[intermediate_index]->parameters[1] = -1;  /* End marker */
-    }
+    intermediate_index++;
+}
+
+/**
+ * @brief Processes a RET instruction
+ * 
+ * @param instruction_no Current instruction number
+ */
+void ret_func(int instruction_no) {
+    /* Set up instruction */
+    intermediate_table[intermediate_index]->instruc_no = instruction_no;
+    intermediate_table[intermediate_index]->opcode = OP_RET;
+    intermediate_table[intermediate_index]->parameters[0] = -1;  /* End marker */
     
     intermediate_index++;
 }
 
 /**
- * @brief Main function
+ * @brief Processes a SPAWN instruction
  * 
- * @return int Exit code
+ * SPAWN label starts a thread that runs the subroutine at the label, with
+ * a copy of the registers, while the spawning thread carries on.
+ * 
+ * @param param Parameter for the instruction
+ * @param instruction_no Current instruction number
  */
-int main(void) {
-    int stack[STACK_SIZE], top = -1;
-    int memory_array[MEMORY_SIZE];
-    int memory_index = VARIABLE_MEMORY_START - 1;  /* 0 to 7 are reserved for registers */
+void spawn_func(char *param, int instruction_no) {
+    /* Set up instruction */
+    intermediate_table[intermediate_index]->instruc_no = instruction_no;
+    intermediate_table[intermediate_index]->opcode = OP_SPAWN;
+    intermediate_table[intermediate_index]->parameters[0] = label_target(param, 0, "SPAWN");
+    intermediate_table[intermediate_index]->parameters[1] = -1;  /* End marker */
     
-    /* Allocate memory for tables */
-    symbol_tab = (symbol_table**)malloc(sizeof(symbol_table*) * 25);
-    if (symbol_tab == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed for symbol table\n");
-        return 1;
-    }
+    intermediate_index++;
+}
+
+/**
+ * @brief Processes a JOIN instruction
+ * 
+ * JOIN waits until every thread this thread spawned has ended.
+ * 
+ * @param instruction_no Current instruction number
+ */
+void join_func(int instruction_no) {
+    /* Set up instruction */
+    intermediate_table[intermediate_index]->instruc_no = instruction_no;
+    intermediate_table[intermediate_index]->opcode = OP_JOIN;
+    intermediate_table[intermediate_index]->parameters[0] = -1;  /* End marker */
     
-    for (int i = 0; i < 25; i++) {
-        symbol_tab[i] = (symbol_table*)malloc(sizeof(symbol_table));
-        if (symbol_tab[i] == NULL) {
-            fprintf(stderr, "Error: Memory allocation failed for symbol table entry\n");
-            return 1;
+    intermediate_index++;
+}
+
+/**
+ * @brief Processes a CAS instruction
+ * 
+ * CAS dest, cell, expected, new stores new in cell if cell holds
+ * expected, atomically, and puts the old value of cell in dest.
+ * 
+ * @param param Parameters for the instruction
+ * @param instruction_no Current instruction number
+ */
+void cas_func(char *param, int instruction_no) {
+    char operands[4][VARIABLE_LENGTH];
+    char *token = strtok(param, ", ");
+    
+    /* Parse parameters */
+    for (int j = 0; j < 4; j++) {
+        if (token == NULL) {
+            fprintf(stderr, "Error: Invalid CAS instruction at line %d\n", instruction_no);
+            return;
         }
+        strncpy(operands[j], token, VARIABLE_LENGTH - 1);
+        operands[j][VARIABLE_LENGTH - 1] = '\0';
+        token = strtok(NULL, ", ");
     }
     
-    intermediate_table = (intermediate_lang**)malloc(sizeof(intermediate_lang*) * 50);
-    if (intermediate_table == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed for intermediate table\n");
-        return 1;
+    /* Set up instruction */
+    intermediate_table[intermediate_index]->instruc_no = instruction_no;
+    intermediate_table[intermediate_index]->opcode = OP_CAS;
+    for (int j = 0; j < 4; j++) {
+        intermediate_table[intermediate_index]->parameters[j] = getAddress(operands[j]);
     }
+    intermediate_table[intermediate_index]->parameters[4] = -1;  /* End marker */
     
-    for (int i = 0; i < 50; i++) {
-        intermediate_table[i] = (intermediate_lang*)malloc(sizeof(intermediate_lang));
-        if (intermediate_table[i] == NULL) {
-            fprintf(stderr, "Error: Memory allocation failed for intermediate table entry\n");
-            return 1;
-        }
-    }
+    intermediate_index++;
+}
+
+/**
+ * @brief Processes a LOOP instruction
+ * 
+ * LOOP counter, label decrements the counter and jumps to the label
+ * while the counter is not zero.
+ * 
+ * @param param Parameters for the instruction
+ * @param instruction_no Current instruction number
+ */
+void loop_func(char *param, int instruction_no) {
+    char counter[VARIABLE_LENGTH];
+    char *token;
     
-    block_tab = (blocks_table**)malloc(sizeof(blocks_table*) * 50);
-    if (block_tab == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed for block table\n");
-        return 1;
+    /* Parse parameters */
+    token = strtok(param, ", ");
+    if (token == NULL) {
+        fprintf(stderr, "Error: Invalid LOOP instruction at line %d\n", instruction_no);
+        return;
     }
+    strncpy(counter, token, VARIABLE_LENGTH - 1);
+    counter[VARIABLE_LENGTH - 1] = '\0';
     
-    for (int i = 0; i < 50; i++) {
-        block_tab[i] = (blocks_table*)malloc(sizeof(blocks_table));
-        if (block_tab[i] == NULL) {
-            fprintf(stderr, "Error: Memory allocation failed for block table entry\n");
-            return 1;
-        }
+    token = strtok(NULL, ", ");
+    if (token == NULL) {
+        fprintf(stderr, "Error: Invalid LOOP instruction at line %d\n", instruction_no);
+        return;
     }
     
-    /* Get input file */
-    char filename[25];
-    printf("Enter the filename: ");
-    if (scanf("%24s", filename) != 1) {
-        fprintf(stderr, "Error: Invalid filename\n");
-        return 1;
-    }
+    /* Set up instruction */
+    intermediate_table[intermediate_index]->instruc_no = instruction_no;
+    intermediate_table[intermediate_index]->opcode = OP_LOOP;
+    intermediate_table[intermediate_index]->parameters[0] = getAddress(counter);
+    intermediate_table[intermediate_index]->parameters[1] = label_target(token, 1, "LOOP");
+    intermediate_table[intermediate_index]->parameters[2] = -1;  /* End marker */
     
-    /* Check file extension */
-    char *extension = strrchr(filename, '.');
-    if (extension == NULL || strcmp(extension, ".asm") != 0) {
-        fprintf(stderr, "Error: File extension expected .asm, found %s\n", 
-                extension ? extension : "none");
-        return 1;
-    }
+    intermediate_index++;
+}
+
+/**
+ * @brief Processes a FOR instruction
+ * 
+ * FOR counter = first TO last sets the counter to first and skips the
+ * loop when it is already past last. The exit target is filled in by NEXT.
+ * 
+ * @param param Parameters for the instruction
+ * @param instruction_no Current instruction number
+ * @param stack Stack for tracking nested control structures
+ */
+void for_func(char *param, int instruction_no, control_stack *stack) {
+    char counter[VARIABLE_LENGTH], first[VARIABLE_LENGTH], last[VARIABLE_LENGTH];
     
-    /* Open input file */
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "Error: Could not open file %s\n", filename);
-        return 1;
+    /* Parse parameters */
+    if (sscanf(param, "%4s = %4s TO %4s", counter, first, last) != 3) {
+        fprintf(stderr, "Error: Invalid FOR statement at line %d\n", instruction_no);
+        return;
     }
     
-    char line[LINE_SIZE];
+    /* Push into stack */
+    if (!push_control(stack, intermediate_index)) {
+        return;
+    }
+    
+    /* Set up instruction */
+    intermediate_table[intermediate_index]->instruc_no = instruction_no;
+    intermediate_table[intermediate_index]->opcode = OP_FOR;
+    intermediate_table[intermediate_index]->parameters[0] = getAddress(counter);
+    intermediate_table[intermediate_index]->parameters[1] = getAddress(first);
+    intermediate_table[intermediate_index]->parameters[2] = getAddress(last);
+    intermediate_table[intermediate_index]->parameters[3] = WILDCARD_VALUE;  /* To be filled later */
+    intermediate_table[intermediate_index]->parameters[4] = -1;  /* End marker */
+    
+    intermediate_index++;
+}
+
+/**
+ * @brief Processes a NEXT instruction
+ * 
+ * NEXT increments the counter of the matching FOR and jumps back to the
+ * first instruction of the loop while the counter has not passed the bound.
+ * 
+ * @param instruction_no Current instruction number
+ * @param stack Stack for tracking nested control structures
+ */
+void next_func(int instruction_no, control_stack *stack) {
+    if (stack->top < 0 || intermediate_table[stack->entries[stack->top]]->opcode != OP_FOR) {
+        fprintf(stderr, "Error: NEXT without FOR at line %d\n", instruction_no);
+        return;
+    }
+    
+    /* Pop FOR from stack */
+    intermediate_lang *loop = intermediate_table[stack->entries[stack->top--]];
+    
+    /* The FOR skips the loop by jumping past the NEXT */
+    loop->parameters[3] = instruction_no + 1;
+    
+    /* Set up instruction */
+    intermediate_table[intermediate_index]->instruc_no = instruction_no;
+    intermediate_table[intermediate_index]->opcode = OP_NEXT;
+    intermediate_table[intermediate_index]->parameters[0] = loop->parameters[0];
+    intermediate_table[intermediate_index]->parameters[1] = loop->parameters[2];
+    intermediate_table[intermediate_index]->parameters[2] = loop->instruc_no + 1;
+    intermediate_table[intermediate_index]->parameters[3] = -1;  /* End marker */
+    
+    intermediate_index++;
+}
+
+/**
+ * @brief Processes one line of the declaration section
+ * 
+ * The line is split into tokens and handed to data_func or const_func.
+ * EXPORT and IMPORT name the symbols a module shares with other modules.
+ * 
+ * @param line Source line, including its newline
+ * @param memory Memory array
+ * @param memory_index Pointer to the current memory index
+ */
+void process_declaration(const char *line, int *memory, int *memory_index) {
     char tokens[10][10];
-    char *buffer = (char*)malloc(10 * sizeof(char));
-    if (buffer == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed for buffer\n");
-        fclose(fp);
-        return 1;
+    char buffer[LINE_SIZE];
+    int row = 0, buffer_index = 0;
+    
+    /* Tokenize the line */
+    for (int i = 0; line[i] != '\0'; i++) {
+        if (line[i] == ' ' || line[i] == '\n') {
+            buffer[buffer_index] = '\0';
+            buffer_index = 0;
+            
+            if (buffer[0] != '\0' && row < 10) {  /* Skip empty tokens */
+                strncpy(tokens[row++], buffer, 9);
+                tokens[row-1][9] = '\0';
+            }
+        } else if (buffer_index < LINE_SIZE - 1) {
+            buffer[buffer_index++] = line[i];
+        }
     }
     
-    /* Process declarations before START */
-    printf("Processing declarations...\n");
-    while (fgets(line, LINE_SIZE, fp)) {
-        if (strcmp(line, "START:\n") == 0) {
-            break;
+    /* Process tokens */
+    if (row > 0) {
+        if (strcmp(tokens[0], "DATA") == 0) {
+            data_func(tokens, memory, memory_index);
+        } else if (strcmp(tokens[0], "CONST") == 0) {
+            const_func(tokens, memory, memory_index);
+        } else if (strcmp(tokens[0], "EXPORT") == 0 && row > 1) {
+            declare_export(tokens[1]);
+        } else if (strcmp(tokens[0], "IMPORT") == 0 && row > 1) {
+            declare_import(tokens[1]);
+        } else {
+            fprintf(stderr, "Warning: Unknown declaration: %s\n", tokens[0]);
         }
+    }
+}
+
+/**
+ * @brief Compiles one line of the instruction section
+ * 
+ * Labels are added to the block table; every other line generates at most
+ * one instruction at intermediate_index. Lines that do not generate code
+ * (labels, blank lines and ENDIF) give their instruction number back.
+ * 
+ * @param line Source line; its trailing newline is removed
+ * @param instruction_no Pointer to the current instruction number
+ * @param stack Stack for tracking nested control structures
+ * @return int 1 if the line was END, 0 otherwise
+ */
+int compile_instruction(char *line, int *instruction_no, control_stack *stack) {
+    char instruction[INSTRUCTION_LENGTH], param[PARAMETERS_LENGTH];
+    int opcode = -1;
+    
+    /* Remove trailing newline */
+    line[strcspn(line, "\n")] = '\0';
+    
+    /* Check for label */
+    if (line[0] != '\0' && line[strlen(line) - 1] == ':') {
+        line[strlen(line) - 1] = '\0';
+        (*instruction_no)--;  /* Label doesn't count as an instruction */
         
-        int row = 0, buffer_index = 0;
-        
-        /* Tokenize the line */
-        for (int i = 0; line[i] != '\0'; i++) {
-            if (line[i] == ' ' || line[i] == '\n') {
-                buffer[buffer_index] = '\0';
-                buffer_index = 0;
-                
-                if (buffer[0] != '\0') {  /* Skip empty tokens */
-                    strncpy(tokens[row++], buffer, 9);
-                    tokens[row-1][9] = '\0';
-                }
-                
-                free(buffer);
-                buffer = (char*)malloc(10 * sizeof(char));
-                if (buffer == NULL) {
-                    fprintf(stderr, "Error: Memory allocation failed for buffer\n");
-                    fclose(fp);
-                    return 1;
-                }
-            } else {
-                buffer[buffer_index++] = line[i];
-            }
+        if (blocks_index >= 50) {
+            fprintf(stderr, "Error: Too many labels\n");
+            return 0;
         }
         
-        /* Process tokens */
-        if (row > 0) {
-            if (strcmp(tokens[0], "DATA") == 0) {
-                data_func(tokens, memory_array, &memory_index);
-            } else if (strcmp(tokens[0], "CONST") == 0) {
-                const_func(tokens, memory_array, &memory_index);
+        strncpy(block_tab[blocks_index]->name, line, LABEL_LENGTH - 1);
+        block_tab[blocks_index]->name[LABEL_LENGTH - 1] = '\0';
+        block_tab[blocks_index]->instr_no = *instruction_no + 1;
+        blocks_index++;
+        return 0;
+    }
+    
+    /* Parse instruction and parameters */
+    if (sscanf(line, "%5s %[^*]", instruction, param) != 2) {
+        /* Handle instructions with no parameters */
+        if (sscanf(line, "%5s", instruction) != 1) {
+            (*instruction_no)--;  /* Blank line doesn't count as an instruction */
+            return 0;
+        }
+        param[0] = '\0';
+    }
+    
+    opcode = generate_opcode(instruction);
+    
+    /* Process instruction */
+    switch (opcode) {
+        case OP_MOV_MEM_TO_REG:
+            mov_func(param, *instruction_no);
+            break;
+            
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_XADD:
+            binaryOperations_func(opcode, param, *instruction_no);
+            break;
+            
+        case OP_JUMP:
+            if (strcmp(instruction, "ELSE") == 0) {
+                else_func(*instruction_no, stack);
             } else {
-                fprintf(stderr, "Warning: Unknown declaration: %s\n", tokens[0]);
+                jump_func(param, *instruction_no);
             }
+            break;
+            
+        case OP_IF:
+            if_func(param, *instruction_no, stack);
+            break;
+            
+        case OP_PRINT:
+            print_func(param, *instruction_no);
+            break;
+            
+        case OP_READ:
+            read_func(param, *instruction_no);
+            break;
+            
+        case OP_LOOP:
+            loop_func(param, *instruction_no);
+            break;
+            
+        case OP_FOR:
+            for_func(param, *instruction_no, stack);
+            break;
+            
+        case OP_NEXT:
+            next_func(*instruction_no, stack);
+            break;
+            
+        case OP_CALL:
+            call_func(param, *instruction_no);
+            break;
+            
+        case OP_RET:
+            ret_func(*instruction_no);
+            break;
+            
+        case OP_SPAWN:
+            spawn_func(param, *instruction_no);
+            break;
+            
+        case OP_JOIN:
+            join_func(*instruction_no);
+            break;
+            
+        case OP_CAS:
+            cas_func(param, *instruction_no);
+            break;
+            
+        case OP_ENDIF:
+            stats_begin(STATS_BACKPATCH);
+            endif_func(*instruction_no, stack);
+            stats_end(STATS_BACKPATCH);
+            (*instruction_no)--;  /* ENDIF doesn't generate code */
+            break;
+            
+        case OP_END:
+            return 1;  /* End of program */
+            
+        default:
+            fprintf(stderr, "Warning: Unknown instruction '%s' at line %d\n", 
+                    instruction, *instruction_no);
+            break;
+    }
+    
+    return 0;
+}
+
+/**
+ * @brief Clears the compiler tables before another program is compiled
+ */
+void reset_compiler(void) {
+    symbol_index = 0;
+    intermediate_index = 0;
+    blocks_index = 0;
+    fixup_index = 0;
+    reset_module_symbols();
+}
+
+/**
+ * @brief Allocates the compiler tables if they are not allocated yet
+ * 
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int init_compiler(void) {
+    if (symbol_tab != NULL) {
+        return 1;
+    }
+    
+    symbol_tab = (symbol_table**)stats_calloc(25, sizeof(symbol_table*));
+    if (symbol_tab == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for symbol table\n");
+        return 0;
+    }
+    
+    for (int i = 0; i < 25; i++) {
+        symbol_tab[i] = (symbol_table*)stats_malloc(sizeof(symbol_table));
+        if (symbol_tab[i] == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for symbol table entry\n");
+            release_compiler();
+            return 0;
         }
     }
     
+    if (!ensure_intermediate_capacity(50)) {
+        release_compiler();
+        return 0;
+    }
+    
+    block_tab = (blocks_table**)stats_calloc(50, sizeof(blocks_table*));
+    if (block_tab == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for block table\n");
+        release_compiler();
+        return 0;
+    }
+    
+    for (int i = 0; i < 50; i++) {
+        block_tab[i] = (blocks_table*)stats_malloc(sizeof(blocks_table));
+        if (block_tab[i] == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed for block table entry\n");
+            release_compiler();
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+/**
+ * @brief Frees the compiler tables
+ * 
+ * init_compiler allocates them again before the next program.
+ */
+void release_compiler(void) {
+    if (symbol_tab != NULL) {
+        for (int i = 0; i < 25; i++) {
+            free(symbol_tab[i]);
+        }
+        free(symbol_tab);
+        symbol_tab = NULL;
+    }
+    
+    for (int i = 0; i < intermediate_capacity; i++) {
+        free(intermediate_table[i]);
+    }
+    free(intermediate_table);
+    intermediate_table = NULL;
+    intermediate_capacity = 0;
+    
+    if (block_tab != NULL) {
+        for (int i = 0; i < 50; i++) {
+            free(block_tab[i]);
+        }
+        free(block_tab);
+        block_tab = NULL;
+    }
+    
+    free(label_fixups);
+    label_fixups = NULL;
+    fixup_capacity = 0;
+    reset_compiler();
+}
+
+/**
+ * @brief Reads the next line of a source, like fgets
+ * 
+ * A line longer than LINE_SIZE - 1 characters is split, as fgets does.
+ * 
+ * @param source Source file or in-memory text
+ * @param line Buffer of LINE_SIZE characters receiving the line
+ * @return char* line, or NULL at the end of the source
+ */
+char *read_source_line(source_reader *source, char *line) {
+    int length = 0;
+    
+    if (source->fp != NULL) {
+        return fgets(line, LINE_SIZE, source->fp);
+    }
+    
+    if (source->text >= source->end) {
+        return NULL;
+    }
+    
+    while (source->text < source->end && length < LINE_SIZE - 1) {
+        char c = *source->text++;
+        line[length++] = c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    line[length] = '\0';
+    return line;
+}
+
+/**
+ * @brief Processes the declarations before START:
+ * 
+ * @param source Source, positioned at its start
+ * @param memory_array Memory array receiving the CONST values
+ * @param memory_index Pointer to the current memory index
+ */
+void compile_declarations(source_reader *source, int *memory_array, int *memory_index) {
+    char line[LINE_SIZE];
+    
+    if (compiler_messages) {
+        printf("Processing declarations...\n");
+    }
+    stats_begin(STATS_DECLARATIONS);
+    while (read_source_line(source, line)) {
+        if (strcmp(line, "START:\n") == 0) {
+            break;
+        }
+        
+        process_declaration(line, memory_array, memory_index);
+    }
+    stats_end(STATS_DECLARATIONS);
+}
+
+/**
+ * @brief Compiles the instructions after START: and resolves their labels
+ * 
+ * @param source Source, positioned right after START:
+ */
+void read_instructions(source_reader *source) {
+    control_stack stack = { NULL, -1, 0 };
+    char line[LINE_SIZE];
+    int instruction_no = 0;
+    
     /* Process instructions after START */
-    printf("Processing instructions...\n");
-    char instruction[INSTRUCTION_LENGTH], param[PARAMETERS_LENGTH];
-    int opcode = -1, instruction_no = 0;
+    if (compiler_messages) {
+        printf("Processing instructions...\n");
+    }
+    stats_begin(STATS_INSTRUCTIONS);
     
-    while (!feof(fp)) {
+    while (1) {
         instruction_no++;
-        
-        if (fgets(line, LINE_SIZE, fp) == NULL) {
+    
+        if (read_source_line(source, line) == NULL) {
+            break;
+        }
+    
+        /* Make room for the instruction */
+        if (!ensure_intermediate_capacity(intermediate_index + 1)) {
             break;
         }
+    
+        if (compile_instruction(line, &instruction_no, &stack)) {
+            break;  /* End of program */
+        }
+    }
+    
+    /* Check for unmatched control structures */
+    if (stack.top >= 0) {
+        fprintf(stderr, "Error: Unmatched IF/ELSE/FOR statements\n");
+    }
+    release_control_stack(&stack);
+    
+    /* Link branches to labels defined further down */
+    resolve_label_fixups();
+    stats_end(STATS_INSTRUCTIONS);
+}
+
+/**
+ * @brief Verifies the compiled program and prepares it for execution
+ * 
+ * The program is optimized when requested and specialized for the
+ * virtual machine.
+ * 
+ * @param memory_array Memory array holding the CONST values
+ * @param optimize 1 to run the optimizer
+ * @return int 1 if the program can be run, 0 if it was rejected
+ */
+int prepare_program(int *memory_array, int optimize) {
+    /* The virtual machine does not check operands, so bad programs stop here */
+    stats_begin(STATS_VERIFY);
+    int errors = verify_program();
+    stats_end(STATS_VERIFY);
+    if (errors > 0) {
+        fprintf(stderr, "Error: Program rejected, %d problem(s) found\n", errors);
+        return 0;
+    }
+    
+    /* Optimize the intermediate code */
+    if (optimize) {
+        if (compiler_messages) {
+            printf("Optimizing...\n");
+        }
+        stats_begin(STATS_OPTIMIZE);
+        int removed = optimize_program(memory_array);
+        stats_end(STATS_OPTIMIZE);
+        if (removed > 0 && compiler_messages) {
+            printf("Removed %d unreachable or dead instructions\n", removed);
+        }
+    }
+    
+    /* Instruction selection for the virtual machine, also without -O0 */
+    specialize_instructions(0, intermediate_index - 1, memory_array);
+    return 1;
+}
+
+/**
+ * @brief Compiles the instructions after START: for execution
+ * 
+ * The instructions are compiled, their labels resolved and the program
+ * verified, then optimized when requested and specialized for the
+ * virtual machine.
+ * 
+ * @param source Source, positioned right after START:
+ * @param memory_array Memory array holding the CONST values
+ * @param optimize 1 to run the optimizer
+ * @return int 1 if the program can be run, 0 if it was rejected
+ */
+int compile_instructions(source_reader *source, int *memory_array, int optimize) {
+    read_instructions(source);
+    
+    /* Imports are only filled in when the module is linked */
+    if (module_import_count() > 0) {
+        fprintf(stderr, "Error: Program imports symbols; compile it with -m and link the objects\n");
+        return 0;
+    }
+    
+    return prepare_program(memory_array, optimize);
+}
+
+/* Built as a library, the program embedding the compiler has its own main */
+#ifndef COMPILER_LIBRARY
+/**
+ * @brief Main function
+ * 
+ * Usage: compiler [-O0] [-w] [-L] [-l count] [-t ms] [-d depth]
+ * [-i input.bin] [-o image.img | -r image.img] [-p profile | -u profile]
+ * [-s] [-g] [file.asm | object.o ...], or
+ * compiler -D socket [-j workers] [-O0] [-l count] [-t ms] [-d depth] to
+ * start a daemon, compiler -c socket file.asm to run on one and
+ * compiler -m object.o file.asm to compile a module. The filename is
+ * prompted for when it is not given on the command line; -O0 disables the
+ * optimizer, -w recompiles the file whenever it changes instead of running
+ * it, -L compiles each block only when it is first run, -l and -t stop the
+ * program after a number of instructions or milliseconds, -d sets how many
+ * CALLs may be nested and -i makes READ take 32-bit integers from a binary
+ * file. -o writes the compiled program to a program image instead of
+ * running it, and -r runs a program image without any source. -s writes
+ * the time, allocations and hardware counters of each phase to
+ * output.stats.json. -D keeps compiled programs resident and runs them for
+ * clients on a pool of -j worker threads; -c sends a program and stdin to
+ * the daemon and prints the output it streams back. -p records an execution
+ * profile of the run, and -u lays the program out using one. -m compiles
+ * a module to a relocatable object instead of running it; files ending in
+ * .o are linked, in the order given, and run like a compiled source file.
+ * -g runs the program, unoptimized, under the interactive debugger.
+ * 
+ * @param argc Number of command line arguments
+ * @param argv Command line arguments
+ * @return int Exit code
+ */
+int main(int argc, char *argv[]) {
+    int optimize = 1, watch = 0, lazy = 0, stats = 0;
+    int memory_array[MEMORY_SIZE] = { 0 };
+    const char *image_output = NULL, *image_input = NULL;
+    const char *daemon_socket = NULL, *client_socket = NULL;
+    const char *profile_input = NULL;
+    const char *module_output = NULL;
+    const char **objects = (const char**)stats_malloc(sizeof(const char*) * argc);
+    int object_count = 0;
+    int workers = DAEMON_WORKERS;
+    int memory_index = VARIABLE_MEMORY_START - 1;  /* 0 to 7 are reserved for registers */
+    
+    /* Allocate memory for tables */
+    if (objects == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for object list\n");
+        return 1;
+    }
+    
+    if (!init_compiler()) {
+        return 1;
+    }
+    
+    /* Get input file; a name from the command line is used as given, at any length */
+    const char *filename = "";
+    char typed_filename[FILENAME_SIZE];
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O0") == 0) {
+            optimize = 0;
+        } else if (strcmp(argv[i], "-w") == 0) {
+            watch = 1;
+        } else if (strcmp(argv[i], "-L") == 0) {
+            lazy = 1;
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            instruction_limit = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            time_limit_ms = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            call_stack_depth = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            input_filename = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            image_output = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            image_input = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "-g") == 0) {
+            debug_mode = 1;
+        } else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
+            daemon_socket = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            client_socket = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            profile_output = argv[++i];
+        } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            profile_input = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            module_output = argv[++i];
+        } else if (strlen(argv[i]) > 2 && strcmp(argv[i] + strlen(argv[i]) - 2, ".o") == 0) {
+            objects[object_count++] = argv[i];
+        } else {
+            filename = argv[i];
+        }
+    }
+    
+    /* The daemon serves programs named by its clients */
+    if (daemon_socket != NULL) {
+        if (stats || lazy || watch || debug_mode || image_output != NULL || image_input != NULL ||
+            profile_output != NULL || profile_input != NULL || module_output != NULL || object_count > 0) {
+            fprintf(stderr, "Error: -D cannot be combined with -s, -L, -w, -g, -o, -r, -p, -u, -m or objects\n");
+            return 1;
+        }
+        return daemon_serve(daemon_socket, workers, optimize);
+    }
+    
+    if (stats && !watch) {
+        stats_start();
+    }
+    
+    /* A profile describes one fixed layout of eagerly compiled code */
+    if ((profile_output != NULL || profile_input != NULL) &&
+        (lazy || watch || (profile_output != NULL && profile_input != NULL))) {
+        fprintf(stderr, "Error: -p and -u cannot be combined with each other, -L or -w\n");
+        return 1;
+    }
+    
+    /* The debugger patches eagerly compiled code it owns */
+    if (debug_mode && (lazy || watch || image_input != NULL || image_output != NULL ||
+                       profile_output != NULL || module_output != NULL || client_socket != NULL)) {
+        fprintf(stderr, "Error: -g cannot be combined with -L, -w, -r, -o, -p, -m or -c\n");
+        return 1;
+    }
+    
+    /* Variables stay in memory and labels in place only in unoptimized code */
+    if (debug_mode) {
+        optimize = 0;
+    }
+    
+    if (profile_input != NULL && image_input != NULL) {
+        fprintf(stderr, "Error: -u needs the source, it cannot be combined with -r\n");
+        return 1;
+    }
+    
+    /* A program image runs without its source */
+    if (image_input != NULL) {
+        program_image image;
         
-        /* Remove trailing newline */
-        line[strcspn(line, "\n")] = '\0';
+        if (!load_program_image(image_input, &image)) {
+            return 1;
+        }
+        printf("\nExecuting program image %s...\n", image_input);
+        stats_begin(STATS_EXECUTE);
+        execute_image(&image);
+        stats_end(STATS_EXECUTE);
+        release_program_image(&image);
+        stats_write_report(STATS_REPORT_FILE, image_input);
+        return 0;
+    }
+    
+    if (image_output != NULL && (lazy || watch)) {
+        fprintf(stderr, "Error: -o cannot be combined with -L or -w\n");
+        return 1;
+    }
+    
+    /* A module is compiled on its own and only runs once it is linked */
+    if (module_output != NULL && (lazy || watch || client_socket != NULL || image_output != NULL ||
+                                  profile_output != NULL || profile_input != NULL || object_count > 0)) {
+        fprintf(stderr, "Error: -m cannot be combined with -L, -w, -c, -o, -p, -u or objects\n");
+        return 1;
+    }
+    
+    if (object_count > 0 && (lazy || watch || client_socket != NULL || filename[0] != '\0')) {
+        fprintf(stderr, "Error: Objects cannot be linked with -L, -w, -c or a source file\n");
+        return 1;
+    }
+    
+    if (object_count > 0) {
+        printf("Linking...\n");
+        stats_begin(STATS_LINK);
+        int linked = link_objects(objects, object_count, memory_array, &memory_index);
+        stats_end(STATS_LINK);
+        if (!linked || !prepare_program(memory_array, optimize)) {
+            return 1;
+        }
         
-        /* Check for label */
-        if (line[strlen(line) - 1] == ':') {
-            line[strlen(line) - 1] = '\0';
-            
-            if (blocks_index >= 50) {
-                fprintf(stderr, "Error: Too many labels\n");
-                continue;
+        /* Reports are named after the object holding the start of the program */
+        filename = objects[0];
+    } else {
+        if (filename[0] == '\0') {
+            printf("Enter the filename: ");
+            if (scanf("%255s", typed_filename) != 1) {
+                fprintf(stderr, "Error: Invalid filename\n");
+                return 1;
             }
-            
-            strncpy(block_tab[blocks_index]->name, line, LABEL_LENGTH - 1);
-            block_tab[blocks_index]->name[LABEL_LENGTH - 1] = '\0';
-            block_tab[blocks_index]->instr_no = instruction_no;
-            blocks_index++;
-            
-            instruction_no--;  /* Label doesn't count as an instruction */
-            continue;
+            filename = typed_filename;
         }
         
-        /* Parse instruction and parameters */
-        if (sscanf(line, "%5s %[^*]", instruction, param) != 2) {
-            /* Handle instructions with no parameters */
-            if (sscanf(line, "%5s", instruction) != 1) {
-                fprintf(stderr, "Error: Invalid instruction format at line %d\n", instruction_no);
-                continue;
-            }
-            param[0] = '\0';
+        /* Check file extension */
+        const char *extension = strrchr(filename, '.');
+        if (extension == NULL || strcmp(extension, ".asm") != 0) {
+            fprintf(stderr, "Error: File extension expected .asm, found %s\n", 
+                    extension ? extension : "none");
+            return 1;
         }
         
-        opcode = generate_opcode(instruction);
+        /* The daemon compiles and runs the program */
+        if (client_socket != NULL) {
+            return daemon_request(client_socket, filename);
+        }
         
-        /* Process instruction */
-        switch (opcode) {
-            case OP_MOV_MEM_TO_REG:
-                mov_func(param, instruction_no);
-                break;
-                
-            case OP_ADD:
-            case OP_SUB:
-            case OP_MUL:
-                binaryOperations_func(opcode, param, instruction_no);
-                break;
-                
-            case OP_JUMP:
-                if (strcmp(instruction, "ELSE") == 0) {
-                    else_func(instruction_no, stack, &top);
-                } else {
-                    jump_func(param, instruction_no);
-                }
-                break;
-                
-            case OP_IF:
-                if_func(param, instruction_no, stack, &top);
-                break;
-                
-            case OP_PRINT:
-                print_func(param, instruction_no);
-                break;
-                
-            case OP_READ:
-                read_func(param, instruction_no);
-                break;
-                
-            case OP_ENDIF:
-                endif_func(instruction_no, stack, &top);
-                instruction_no--;  /* ENDIF doesn't generate code */
-                break;
-                
-            case OP_END:
-                goto ending;  /* End of program */
-                
-            default:
-                fprintf(stderr, "Warning: Unknown instruction '%s' at line %d\n", 
-                        instruction, instruction_no);
-                break;
+        /* Watch mode keeps recompiling until interrupted */
+        if (watch) {
+            return watch_source(filename);
+        }
+        
+        /* Open input file */
+        FILE *fp = fopen(filename, "r");
+        if (fp == NULL) {
+            fprintf(stderr, "Error: Could not open file %s\n", filename);
+            return 1;
+        }
+        
+        source_reader source = { fp, NULL, NULL };
+        compile_declarations(&source, memory_array, &memory_index);
+        
+        /* The object is verified and optimized when it is linked */
+        if (module_output != NULL) {
+            read_instructions(&source);
+            fclose(fp);
+            int saved = save_object(module_output, memory_array);
+            stats_write_report(STATS_REPORT_FILE, filename);
+            return saved ? 0 : 1;
+        }
+        
+        if (lazy) {
+            if (module_import_count() > 0) {
+                fprintf(stderr, "Error: Program imports symbols; compile it with -m and link the objects\n");
+                fclose(fp);
+                return 1;
+            }
+            
+            /* Only index the instructions; blocks are compiled when they first run */
+            printf("Indexing instructions...\n");
+            stats_begin(STATS_INSTRUCTIONS);
+            int scanned = lazy_scan(fp);
+            stats_end(STATS_INSTRUCTIONS);
+            if (!scanned) {
+                fprintf(stderr, "Error: Program rejected\n");
+                lazy_release();
+                return 1;
+            }
+        } else {
+            int compiled = compile_instructions(&source, memory_array, optimize);
+            fclose(fp);
+            if (!compiled) {
+                return 1;
+            }
         }
     }
     
-ending:
-    /* Check for unmatched control structures */
-    if (top >= 0) {
-        fprintf(stderr, "Error: Unmatched IF/ELSE statements\n");
+    if (!lazy) {
+        /* Lay the blocks out for the paths the training run took */
+        if (profile_input != NULL) {
+            printf("Applying profile %s...\n", profile_input);
+            stats_begin(STATS_OPTIMIZE);
+            int laid_out = apply_profile(profile_input);
+            stats_end(STATS_OPTIMIZE);
+            
+            /* A profile that cannot be used leaves the verified code as it was */
+            if (laid_out) {
+                /* The layout rewrote branch targets, so check them again */
+                stats_begin(STATS_VERIFY);
+                int errors = verify_program();
+                stats_end(STATS_VERIFY);
+                if (errors > 0) {
+                    fprintf(stderr, "Error: Program rejected after profile layout, %d problem(s) found\n", errors);
+                    return 1;
+                }
+            }
+        }
+        
+        /* Dump intermediate code to file */
+        stats_begin(STATS_DUMP);
+        dump_to_file();
+        stats_end(STATS_DUMP);
+        
+        /* The image is run later, possibly by many processes at once */
+        if (image_output != NULL) {
+            int saved = save_program_image(image_output, memory_array);
+            stats_write_report(STATS_REPORT_FILE, filename);
+            return saved ? 0 : 1;
+        }
     }
     
-    /* Clean up */
-    free(buffer);
-    fclose(fp);
-    
-    /* Dump intermediate code to file */
-    dump_to_file();
-    
     /* Execute the program */
     printf("\nExecuting program...\n");
+    stats_begin(STATS_EXECUTE);
     executor(memory_array, memory_index);
+    stats_end(STATS_EXECUTE);
     
-    /* Free allocated memory */
-    for (int i = 0; i < 25; i++) {
-        free(symbol_tab[i]);
+    /* In lazy mode only the blocks that ran are compiled */
+    if (lazy) {
+        stats_begin(STATS_DUMP);
+        dump_to_file();
+        stats_end(STATS_DUMP);
+        lazy_release();
     }
-    free(symbol_tab);
     
-    for (int i = 0; i < 50; i++) {
-        free(intermediate_table[i]);
-    }
-    free(intermediate_table);
+    stats_write_report(STATS_REPORT_FILE, filename);
     
-    for (int i = 0; i < 50; i++) {
-        free(block_tab[i]);
-    }
-    free(block_tab);
+    /* Free allocated memory */
+    release_compiler();
+    free(objects);
     
+#ifdef _WIN32
+    /* Keep the console window open */
     printf("\nPress any key to exit...\n");
     _getch();
+#endif
     return 0;
 }
+#endif /* COMPILER_LIBRARY */
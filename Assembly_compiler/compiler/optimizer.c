@@ -0,0 +1,1369 @@
+/**
+ * @file optimizer.c
+ * @brief Optimization passes for the Assembly Language Compiler
+ *
+ * This file contains the analyses and transformations that run over the
+ * intermediate language table after code generation, before the program
+ * is written to the output file and executed.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+/* External variables from main.c */
+extern int symbol_index;
+extern int compiler_messages;
+extern int intermediate_index;
+extern int intermediate_capacity;
+extern int blocks_index;
+extern intermediate_lang **intermediate_table;
+extern symbol_table **symbol_tab;
+extern blocks_table **block_tab;
+
+/**
+ * @brief Describes how an instruction uses one of its parameters
+ *
+ * @param opcode Operation code of the instruction
+ * @param index Parameter index (0-4)
+ * @return int One of the OPERAND_* kinds
+ */
+int operand_kind(int opcode, int index) {
+    switch (opcode) {
+        case OP_MOV_MEM_TO_REG:
+        case OP_MOV_REG_TO_MEM:
+            if (index == 0) return OPERAND_WRITE;
+            if (index == 1) return OPERAND_READ;
+            return OPERAND_NONE;
+
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+            if (index == 0) return OPERAND_WRITE;
+            if (index == 1 || index == 2) return OPERAND_READ;
+            return OPERAND_NONE;
+
+        case OP_READ:
+            return (index == 0) ? OPERAND_WRITE : OPERAND_NONE;
+
+        case OP_READ_JUMP:
+            if (index == 0) return OPERAND_WRITE;
+            if (index == 1) return OPERAND_TARGET;
+            return OPERAND_NONE;
+
+        case OP_PRINT:
+            return (index == 0) ? OPERAND_READ : OPERAND_NONE;
+
+        case OP_READ_ARRAY:
+            if (index == 0) return OPERAND_WRITE;
+            if (index == 1) return OPERAND_COUNT;
+            return OPERAND_NONE;
+
+        case OP_PRINT_ARRAY:
+            if (index == 0) return OPERAND_READ;
+            if (index == 1) return OPERAND_COUNT;
+            return OPERAND_NONE;
+
+        case OP_IF:
+            if (index == 0 || index == 1) return OPERAND_READ;
+            if (index == 2) return OPERAND_CONDITION;
+            if (index == 3) return OPERAND_TARGET;
+            return OPERAND_NONE;
+
+        case OP_JUMP:
+            return (index == 0) ? OPERAND_TARGET : OPERAND_NONE;
+
+        case OP_LOOP:
+            if (index == 0) return OPERAND_UPDATE;
+            if (index == 1) return OPERAND_TARGET;
+            return OPERAND_NONE;
+
+        case OP_FOR:
+            if (index == 0) return OPERAND_WRITE;
+            if (index == 1 || index == 2) return OPERAND_READ;
+            if (index == 3) return OPERAND_TARGET;
+            return OPERAND_NONE;
+
+        case OP_NEXT:
+            if (index == 0) return OPERAND_UPDATE;
+            if (index == 1) return OPERAND_READ;
+            if (index == 2) return OPERAND_TARGET;
+            return OPERAND_NONE;
+
+        case OP_CALL:
+        case OP_SPAWN:
+            return (index == 0) ? OPERAND_TARGET : OPERAND_NONE;
+
+        case OP_XADD:
+            if (index == 0) return OPERAND_WRITE;
+            if (index == 1) return OPERAND_UPDATE;
+            if (index == 2) return OPERAND_READ;
+            return OPERAND_NONE;
+
+        case OP_CAS:
+            if (index == 0) return OPERAND_WRITE;
+            if (index == 1) return OPERAND_UPDATE;
+            if (index == 2 || index == 3) return OPERAND_READ;
+            return OPERAND_NONE;
+
+        case OP_SHL:
+            if (index == 0) return OPERAND_WRITE;
+            if (index == 1) return OPERAND_READ;
+            if (index == 2) return OPERAND_IMMEDIATE;
+            return OPERAND_NONE;
+
+        case OP_LOAD_IMM:
+            if (index == 0) return OPERAND_WRITE;
+            if (index == 1) return OPERAND_IMMEDIATE;
+            return OPERAND_NONE;
+
+        case OP_IF_EQ:
+        case OP_IF_LT:
+        case OP_IF_GT:
+        case OP_IF_LTEQ:
+        case OP_IF_GTEQ:
+        case OP_IF_NE:
+            if (index == 0 || index == 1) return OPERAND_READ;
+            if (index == 2) return OPERAND_TARGET;
+            return OPERAND_NONE;
+
+        case OP_ADD_IMM:
+        case OP_MUL_IMM:
+            if (index == 0) return OPERAND_WRITE;
+            if (index == 1) return OPERAND_READ;
+            if (index == 2) return OPERAND_IMMEDIATE;
+            return OPERAND_NONE;
+
+        default:
+            return OPERAND_NONE;
+    }
+}
+
+/**
+ * @brief Gets the number of memory cells a parameter refers to
+ *
+ * @param instr Instruction
+ * @param index Parameter index (0-4)
+ * @return int Count from the next slot for whole-array operands, 1 otherwise
+ */
+int operand_cells(const intermediate_lang *instr, int index) {
+    if (index < 4 && operand_kind(instr->opcode, index + 1) == OPERAND_COUNT) {
+        return instr->parameters[index + 1];
+    }
+    return 1;
+}
+
+/**
+ * @brief Lists the instructions that may execute after an instruction
+ *
+ * A CALL leads both to the subroutine and to the instruction after it,
+ * where the subroutine returns. A RET has no static successors; the
+ * liveness analysis treats every cell as live after it.
+ *
+ * @param index Index of the instruction in the intermediate table
+ * @param successors Receives up to two successor indices; an index equal to
+ *                   intermediate_index means the program ends
+ * @return int Number of successors stored
+ */
+int instruction_successors(int index, int *successors) {
+    intermediate_lang *instr = intermediate_table[index];
+    int count = 0;
+
+    if (instr->opcode == OP_RET) {
+        return 0;
+    }
+
+    /* Every instruction except an unconditional jump falls through */
+    if (instr->opcode != OP_JUMP) {
+        successors[count++] = index + 1;
+    }
+
+    for (int j = 0; j < 5; j++) {
+        if (operand_kind(instr->opcode, j) == OPERAND_TARGET) {
+            successors[count++] = instr->parameters[j] - 1;
+            break;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Checks whether an instruction must be kept for its side effects
+ *
+ * @param opcode Operation code of the instruction
+ * @return int 1 if the instruction does more than write its destination
+ */
+static int has_side_effects(int opcode) {
+    switch (opcode) {
+        case OP_MOV_MEM_TO_REG:
+        case OP_MOV_REG_TO_MEM:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_SHL:
+        case OP_LOAD_IMM:
+        case OP_ADD_IMM:
+        case OP_MUL_IMM:
+            return 0;
+
+        default:
+            /* READ consumes input, PRINT produces output, branches steer */
+            return 1;
+    }
+}
+
+/**
+ * @brief Checks that every branch target refers to an instruction
+ *
+ * The passes below renumber instructions, which is only safe when every
+ * target is in range. A target one past the last instruction ends the program.
+ *
+ * @return int 1 if all targets are valid, 0 otherwise
+ */
+static int targets_are_valid(void) {
+    for (int i = 0; i < intermediate_index; i++) {
+        for (int j = 0; j < 5; j++) {
+            if (operand_kind(intermediate_table[i]->opcode, j) != OPERAND_TARGET) {
+                continue;
+            }
+
+            int target = intermediate_table[i]->parameters[j];
+            if (target < 1 || target > intermediate_index + 1) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Removes instructions from the intermediate table
+ *
+ * Kept instructions are renumbered, and every branch target and label that
+ * referred to a removed instruction is re-linked to the next kept one.
+ *
+ * @param keep Flag per instruction, 0 to remove it
+ * @return int Number of instructions removed
+ */
+static int compact_instructions(const int *keep) {
+    int count = intermediate_index;
+    int kept = 0;
+
+    /* map[old instruction number] = new instruction number */
+    int *map = (int*)stats_malloc(sizeof(int) * (count + 2));
+    intermediate_lang **removed = (intermediate_lang**)stats_malloc(sizeof(intermediate_lang*) * (count + 1));
+    if (map == NULL || removed == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed in optimizer\n");
+        free(map);
+        free(removed);
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (keep[i]) {
+            map[i + 1] = ++kept;
+        }
+    }
+    map[count + 1] = kept + 1;
+
+    for (int i = count - 1; i >= 0; i--) {
+        if (!keep[i]) {
+            map[i + 1] = map[i + 2];
+        }
+    }
+
+    /* Re-link branch targets */
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < 5; j++) {
+            if (operand_kind(intermediate_table[i]->opcode, j) == OPERAND_TARGET) {
+                intermediate_table[i]->parameters[j] = map[intermediate_table[i]->parameters[j]];
+            }
+        }
+    }
+
+    /* Re-link labels */
+    for (int i = 0; i < blocks_index; i++) {
+        if (block_tab[i]->instr_no >= 1 && block_tab[i]->instr_no <= count + 1) {
+            block_tab[i]->instr_no = map[block_tab[i]->instr_no];
+        }
+    }
+
+    /* Move kept entries to the front; removed ones stay allocated at the end */
+    int next = 0, removed_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (keep[i]) {
+            intermediate_table[next] = intermediate_table[i];
+            intermediate_table[next]->instruc_no = next + 1;
+            next++;
+        } else {
+            removed[removed_count++] = intermediate_table[i];
+        }
+    }
+    for (int i = 0; i < removed_count; i++) {
+        intermediate_table[next + i] = removed[i];
+    }
+
+    intermediate_index = kept;
+
+    free(map);
+    free(removed);
+    return removed_count;
+}
+
+/**
+ * @brief Finds the memory cells whose values are known at compile time
+ *
+ * A cell has a known value when it belongs to a CONST declaration and no
+ * instruction ever writes to it.
+ *
+ * @param known Receives a flag per memory cell
+ */
+void find_known_values(int *known) {
+    for (int cell = 0; cell < MEMORY_SIZE; cell++) {
+        known[cell] = 0;
+    }
+
+    for (int i = 0; i < symbol_index; i++) {
+        if (symbol_tab[i]->size == CONST_VARIABLE_SIZE && symbol_tab[i]->address < MEMORY_SIZE) {
+            known[symbol_tab[i]->address] = 1;
+        }
+    }
+
+    for (int i = 0; i < intermediate_index; i++) {
+        for (int j = 0; j < 5; j++) {
+            int first = intermediate_table[i]->parameters[j];
+            if (!(operand_kind(intermediate_table[i]->opcode, j) & OPERAND_WRITE)) {
+                continue;
+            }
+            for (int cell = first; cell >= 0 && cell < first + operand_cells(intermediate_table[i], j) &&
+                 cell < MEMORY_SIZE; cell++) {
+                known[cell] = 0;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Replaces IF statements whose outcome is known at compile time
+ *
+ * An IF that is always true is removed so execution falls into the THEN
+ * branch; one that is always false becomes a jump to its false target.
+ *
+ * @param memory_array Memory array holding the CONST values
+ * @param keep Flag per instruction, cleared for removed IFs
+ * @return int Number of IF statements folded
+ */
+static int fold_conditions(const int *memory_array, int *keep) {
+    int known[MEMORY_SIZE];
+    int folded = 0;
+
+    find_known_values(known);
+
+    for (int i = 0; i < intermediate_index; i++) {
+        int *params = intermediate_table[i]->parameters;
+        int result;
+
+        if (intermediate_table[i]->opcode != OP_IF) {
+            continue;
+        }
+
+        if (params[0] == params[1]) {
+            /* Comparing a cell with itself */
+            result = check_condition(0, 0, params[2]);
+        } else if (known[params[0]] && known[params[1]]) {
+            result = check_condition(memory_array[params[0]], memory_array[params[1]], params[2]);
+        } else {
+            continue;
+        }
+
+        if (result) {
+            keep[i] = 0;
+        } else {
+            intermediate_table[i]->opcode = OP_JUMP;
+            params[0] = params[3];
+            params[1] = -1;  /* End marker */
+        }
+        folded++;
+    }
+
+    return folded;
+}
+
+/**
+ * @brief Turns an instruction into a copy between two cells
+ *
+ * A copy of a cell onto itself is removed instead.
+ *
+ * @param index Index of the instruction
+ * @param dest Destination address
+ * @param src Source address
+ * @param keep Flag per instruction, cleared if the copy is removed
+ */
+static void make_move(int index, int dest, int src, int *keep) {
+    int *params = intermediate_table[index]->parameters;
+
+    if (dest == src) {
+        keep[index] = 0;
+        return;
+    }
+
+    /* Same opcode choice as mov_func */
+    intermediate_table[index]->opcode = (dest < VARIABLE_MEMORY_START) ? OP_MOV_REG_TO_MEM : OP_MOV_MEM_TO_REG;
+    params[0] = dest;
+    params[1] = src;
+    params[2] = -1;  /* End marker */
+}
+
+/**
+ * @brief Turns an instruction into a store of a constant
+ *
+ * @param index Index of the instruction
+ * @param dest Destination address
+ * @param value Value to store
+ */
+static void make_load(int index, int dest, int value) {
+    int *params = intermediate_table[index]->parameters;
+
+    intermediate_table[index]->opcode = OP_LOAD_IMM;
+    params[0] = dest;
+    params[1] = value;
+    params[2] = -1;  /* End marker */
+}
+
+/**
+ * @brief Gets the shift count equivalent to multiplying by a value
+ *
+ * @param value Multiplier
+ * @return int n if value is 2^n with n >= 1, -1 otherwise
+ */
+static int shift_count(int value) {
+    int count = 0;
+
+    if (value < 2 || (value & (value - 1)) != 0) {
+        return -1;
+    }
+
+    while (value > 1) {
+        value >>= 1;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Simplifies arithmetic using CONST values
+ *
+ * Operations on two known values are folded into a constant store.
+ * Multiplying by 0 stores 0, by 1 copies and by a power of two becomes a
+ * shift. Adding or subtracting 0 copies, and subtracting a cell from
+ * itself stores 0. Copies of a cell onto itself are removed. Arithmetic
+ * wraps around like in the virtual machine.
+ *
+ * @param memory_array Memory array holding the CONST values
+ * @param keep Flag per instruction, cleared for removed instructions
+ * @return int Number of instructions simplified
+ */
+static int simplify_arithmetic(const int *memory_array, int *keep) {
+    int known[MEMORY_SIZE];
+    int simplified = 0;
+
+    find_known_values(known);
+
+    for (int i = 0; i < intermediate_index; i++) {
+        int *params = intermediate_table[i]->parameters;
+        int opcode = intermediate_table[i]->opcode;
+        int dest = params[0], a = params[1], b = params[2];
+        unsigned int x, y;
+
+        if (opcode == OP_MOV_MEM_TO_REG || opcode == OP_MOV_REG_TO_MEM) {
+            if (dest == a) {
+                keep[i] = 0;
+                simplified++;
+            }
+            continue;
+        }
+
+        if (opcode != OP_ADD && opcode != OP_SUB && opcode != OP_MUL) {
+            continue;
+        }
+
+        if (known[a] && known[b]) {
+            x = (unsigned int)memory_array[a];
+            y = (unsigned int)memory_array[b];
+            make_load(i, dest, (int)((opcode == OP_ADD) ? x + y : (opcode == OP_SUB) ? x - y : x * y));
+            simplified++;
+            continue;
+        }
+
+        /* Put the known operand of a commutative operation second */
+        if (opcode != OP_SUB && known[a]) {
+            a = params[2];
+            b = params[1];
+        }
+
+        if (opcode == OP_SUB && a == b) {
+            make_load(i, dest, 0);
+        } else if (!known[b]) {
+            continue;
+        } else if (opcode != OP_MUL && memory_array[b] == 0) {
+            make_move(i, dest, a, keep);
+        } else if (opcode == OP_MUL && memory_array[b] == 0) {
+            make_load(i, dest, 0);
+        } else if (opcode == OP_MUL && memory_array[b] == 1) {
+            make_move(i, dest, a, keep);
+        } else if (opcode == OP_MUL && shift_count(memory_array[b]) > 0) {
+            intermediate_table[i]->opcode = OP_SHL;
+            params[1] = a;
+            params[2] = shift_count(memory_array[b]);
+        } else {
+            continue;
+        }
+        simplified++;
+    }
+
+    return simplified;
+}
+
+/**
+ * @brief Replaces generic instructions with specialized ones
+ *
+ * Each IF gets an opcode with its comparison built in, so the virtual
+ * machine does not dispatch on the condition code again. When memory_array
+ * is given, CONST operands that are never written become immediates: ADD,
+ * SUB and MUL with one such operand use ADD_IMM or MUL_IMM (SUB adds the
+ * negated value), and a MOV from one becomes LOAD_IMM. This runs after the
+ * other passes, which only know the generic forms.
+ *
+ * @param first Index of the first instruction to specialize
+ * @param last Index of the last instruction to specialize
+ * @param memory_array Memory array holding the CONST values, or NULL when
+ *                     they cannot be relied on, as in lazy mode
+ * @return int Number of instructions specialized
+ */
+int specialize_instructions(int first, int last, const int *memory_array) {
+    int known[MEMORY_SIZE];
+    int specialized = 0;
+
+    if (memory_array != NULL) {
+        find_known_values(known);
+    } else {
+        memset(known, 0, sizeof(known));
+    }
+
+    for (int i = first; i <= last; i++) {
+        int *params = intermediate_table[i]->parameters;
+        int opcode = intermediate_table[i]->opcode;
+
+        switch (opcode) {
+            case OP_IF:
+                intermediate_table[i]->opcode = OP_IF_EQ + (params[2] - OP_EQ);
+                params[2] = params[3];
+                params[3] = -1;  /* End marker */
+                break;
+
+            case OP_MOV_MEM_TO_REG:
+            case OP_MOV_REG_TO_MEM:
+                if (!known[params[1]]) {
+                    continue;
+                }
+                intermediate_table[i]->opcode = OP_LOAD_IMM;
+                params[1] = memory_array[params[1]];
+                break;
+
+            case OP_ADD:
+            case OP_MUL:
+                if (known[params[1]] && !known[params[2]]) {
+                    /* Commutative: put the constant second */
+                    int constant = params[1];
+                    params[1] = params[2];
+                    params[2] = constant;
+                }
+                /* Fall through */
+            case OP_SUB:
+                if (!known[params[2]]) {
+                    continue;
+                }
+                intermediate_table[i]->opcode = (opcode == OP_MUL) ? OP_MUL_IMM : OP_ADD_IMM;
+                params[2] = (opcode == OP_SUB) ? (int)(0u - (unsigned int)memory_array[params[2]])
+                                               : memory_array[params[2]];
+                break;
+
+            default:
+                continue;
+        }
+        specialized++;
+    }
+
+    return specialized;
+}
+
+/**
+ * @brief Marks instructions that cannot be reached from the first one
+ *
+ * @param keep Flag per instruction, cleared for unreachable instructions
+ * @return int Number of unreachable instructions
+ */
+static int mark_unreachable(int *keep) {
+    int *reached = (int*)stats_calloc(intermediate_index + 1, sizeof(int));
+    int *worklist = (int*)stats_malloc(sizeof(int) * (intermediate_index + 1));
+    int pending = 0, unreachable = 0;
+
+    if (reached == NULL || worklist == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed in optimizer\n");
+        free(reached);
+        free(worklist);
+        return 0;
+    }
+
+    reached[0] = 1;
+    worklist[pending++] = 0;
+
+    while (pending > 0) {
+        int index = worklist[--pending];
+        int successors[2];
+
+        if (index >= intermediate_index) {
+            continue;
+        }
+
+        int count = instruction_successors(index, successors);
+        for (int s = 0; s < count; s++) {
+            if (!reached[successors[s]]) {
+                reached[successors[s]] = 1;
+                worklist[pending++] = successors[s];
+            }
+        }
+    }
+
+    for (int i = 0; i < intermediate_index; i++) {
+        if (keep[i] && !reached[i]) {
+            keep[i] = 0;
+            unreachable++;
+        }
+    }
+
+    free(reached);
+    free(worklist);
+    return unreachable;
+}
+
+/**
+ * @brief Computes which memory cells are live before and after each instruction
+ *
+ * DATA cells are treated as live when the program ends; registers are not.
+ *
+ * @param live_in Array of intermediate_index sets, or NULL
+ * @param live_out Array of intermediate_index sets, or NULL
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int compute_liveness(live_set *live_in, live_set *live_out) {
+    int count = intermediate_index;
+    live_set *in = (live_set*)stats_calloc(count + 1, sizeof(live_set));
+    live_set *out = (live_set*)stats_calloc(count + 1, sizeof(live_set));
+    int changed = 1;
+
+    if (in == NULL || out == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed in optimizer\n");
+        free(in);
+        free(out);
+        return 0;
+    }
+
+    /* The program end reads every DATA cell */
+    for (int cell = VARIABLE_MEMORY_START; cell < MEMORY_SIZE; cell++) {
+        in[count].bits[cell / 32] |= 1u << (cell % 32);
+    }
+
+    while (changed) {
+        changed = 0;
+
+        for (int i = count - 1; i >= 0; i--) {
+            intermediate_lang *instr = intermediate_table[i];
+            int successors[2];
+            int succ_count = instruction_successors(i, successors);
+            live_set new_in;
+
+            /* A RET may return to any caller, which may read anything */
+            memset(&out[i], (instr->opcode == OP_RET) ? 0xff : 0, sizeof(live_set));
+            for (int s = 0; s < succ_count; s++) {
+                for (int w = 0; w < LIVE_WORDS; w++) {
+                    out[i].bits[w] |= in[successors[s]].bits[w];
+                }
+            }
+
+            new_in = out[i];
+            for (int j = 0; j < 5; j++) {
+                int cell = instr->parameters[j];
+                int end = cell + operand_cells(instr, j);
+                if ((operand_kind(instr->opcode, j) & OPERAND_WRITE) && cell >= 0 && end <= MEMORY_SIZE) {
+                    for (; cell < end; cell++) {
+                        new_in.bits[cell / 32] &= ~(1u << (cell % 32));
+                    }
+                }
+            }
+            for (int j = 0; j < 5; j++) {
+                int cell = instr->parameters[j];
+                int end = cell + operand_cells(instr, j);
+                if ((operand_kind(instr->opcode, j) & OPERAND_READ) && cell >= 0 && end <= MEMORY_SIZE) {
+                    for (; cell < end; cell++) {
+                        new_in.bits[cell / 32] |= 1u << (cell % 32);
+                    }
+                }
+            }
+
+            if (memcmp(&new_in, &in[i], sizeof(live_set)) != 0) {
+                in[i] = new_in;
+                changed = 1;
+            }
+        }
+    }
+
+    if (live_in != NULL) {
+        memcpy(live_in, in, sizeof(live_set) * count);
+    }
+    if (live_out != NULL) {
+        memcpy(live_out, out, sizeof(live_set) * count);
+    }
+
+    free(in);
+    free(out);
+    return 1;
+}
+
+/**
+ * @brief Checks whether the program can start threads
+ *
+ * @return int 1 if the intermediate table holds a SPAWN
+ */
+static int program_spawns(void) {
+    for (int i = 0; i < intermediate_index; i++) {
+        if (intermediate_table[i]->opcode == OP_SPAWN) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Marks writes whose value is overwritten or never read
+ *
+ * When the program spawns threads, stores to DATA cells are always kept:
+ * another thread may be waiting to read them.
+ *
+ * @param keep Flag per instruction, cleared for dead stores
+ * @return int Number of dead stores
+ */
+static int mark_dead_stores(int *keep) {
+    live_set *live_out = (live_set*)stats_malloc(sizeof(live_set) * (intermediate_index + 1));
+    int shared = program_spawns() ? VARIABLE_MEMORY_START : MEMORY_SIZE;
+    int dead = 0;
+
+    if (live_out == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed in optimizer\n");
+        return 0;
+    }
+
+    if (!compute_liveness(NULL, live_out)) {
+        free(live_out);
+        return 0;
+    }
+
+    for (int i = 0; i < intermediate_index; i++) {
+        int cell = intermediate_table[i]->parameters[0];
+
+        if (!keep[i] || has_side_effects(intermediate_table[i]->opcode)) {
+            continue;
+        }
+
+        /* Registers are private to a thread; cells from shared up are not */
+        if (cell >= 0 && cell < shared &&
+            !(live_out[i].bits[cell / 32] & (1u << (cell % 32)))) {
+            keep[i] = 0;
+            dead++;
+        }
+    }
+
+    free(live_out);
+    return dead;
+}
+
+/**
+ * @brief Marks unconditional jumps to the instruction that follows them
+ *
+ * @param keep Flag per instruction, cleared for redundant jumps
+ * @return int Number of redundant jumps
+ */
+static int mark_redundant_jumps(int *keep) {
+    int redundant = 0;
+
+    for (int i = 0; i < intermediate_index; i++) {
+        if (keep[i] && intermediate_table[i]->opcode == OP_JUMP &&
+            intermediate_table[i]->parameters[0] == i + 2) {
+            keep[i] = 0;
+            redundant++;
+        }
+    }
+
+    return redundant;
+}
+
+/**
+ * @brief Opens a gap of empty instructions in the intermediate table
+ * 
+ * Branch targets and labels that referred to the instruction at the
+ * position are moved along with it, past the new instructions. The caller
+ * fills in the new instructions and re-links any branch that should land
+ * on them instead.
+ * 
+ * @param position Index where the first new instruction goes
+ * @param count Number of instructions to insert
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+static int insert_instructions(int position, int count) {
+    intermediate_lang **spare = (intermediate_lang**)stats_malloc(sizeof(intermediate_lang*) * count);
+
+    if (spare == NULL || !ensure_intermediate_capacity(intermediate_index + count)) {
+        fprintf(stderr, "Error: Memory allocation failed in optimizer\n");
+        free(spare);
+        return 0;
+    }
+
+    /* Re-link branch targets and labels at or after the position */
+    for (int i = 0; i < intermediate_index; i++) {
+        for (int j = 0; j < 5; j++) {
+            if (operand_kind(intermediate_table[i]->opcode, j) == OPERAND_TARGET &&
+                intermediate_table[i]->parameters[j] > position) {
+                intermediate_table[i]->parameters[j] += count;
+            }
+        }
+    }
+
+    for (int i = 0; i < blocks_index; i++) {
+        if (block_tab[i]->instr_no > position) {
+            block_tab[i]->instr_no += count;
+        }
+    }
+
+    /* Unused entries at the end of the table fill the gap */
+    for (int i = 0; i < count; i++) {
+        spare[i] = intermediate_table[intermediate_index + i];
+    }
+    memmove(&intermediate_table[position + count], &intermediate_table[position],
+            sizeof(intermediate_lang*) * (intermediate_index - position));
+    for (int i = 0; i < count; i++) {
+        intermediate_table[position + i] = spare[i];
+        intermediate_table[position + i]->opcode = OP_MOV_MEM_TO_REG;
+        intermediate_table[position + i]->parameters[0] = -1;
+    }
+
+    intermediate_index += count;
+    for (int i = 0; i < intermediate_index; i++) {
+        intermediate_table[i]->instruc_no = i + 1;
+    }
+
+    free(spare);
+    return 1;
+}
+
+/**
+ * @brief Checks whether a loop can have variables promoted to registers
+ * 
+ * The loop must only be entered at its header, may only leave to the
+ * instruction right after it, and may only contain instructions whose
+ * memory accesses are all visible in their operands.
+ * 
+ * @param header Index of the first instruction of the loop
+ * @param last Index of the last instruction of the loop
+ * @return int 1 if the loop can be transformed, 0 otherwise
+ */
+static int loop_is_promotable(int header, int last) {
+    for (int i = 0; i < intermediate_index; i++) {
+        int successors[2];
+        int count = instruction_successors(i, successors);
+        int inside = (i >= header && i <= last);
+
+        if (inside) {
+            switch (intermediate_table[i]->opcode) {
+                case OP_MOV_MEM_TO_REG:
+                case OP_MOV_REG_TO_MEM:
+                case OP_ADD:
+                case OP_SUB:
+                case OP_MUL:
+                case OP_SHL:
+                case OP_LOAD_IMM:
+                case OP_ADD_IMM:
+                case OP_MUL_IMM:
+                case OP_READ:
+                case OP_READ_JUMP:
+                case OP_READ_ARRAY:
+                case OP_PRINT:
+                case OP_PRINT_ARRAY:
+                case OP_IF:
+                case OP_IF_EQ:
+                case OP_IF_LT:
+                case OP_IF_GT:
+                case OP_IF_LTEQ:
+                case OP_IF_GTEQ:
+                case OP_IF_NE:
+                case OP_JUMP:
+                case OP_LOOP:
+                case OP_FOR:
+                case OP_NEXT:
+                    break;
+
+                default:
+                    return 0;
+            }
+        }
+
+        for (int s = 0; s < count; s++) {
+            int target = successors[s];
+            int target_inside = (target >= header && target <= last);
+
+            if (inside && !target_inside && target != last + 1) {
+                return 0;  /* Leaves the loop somewhere else */
+            }
+            if (!inside && target_inside && target != header) {
+                return 0;  /* Enters the loop in the middle */
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Promotes the DATA scalars used most in a loop into free registers
+ * 
+ * Each promoted variable is loaded into its register before the loop header
+ * and, if the loop writes it, stored back right after the loop. Jumps from
+ * outside the loop to its header are re-linked to the loads.
+ * 
+ * @param header Index of the first instruction of the loop
+ * @param last Index of the last instruction of the loop
+ * @return int Number of variables promoted
+ */
+static int promote_loop(int header, int last) {
+    int uses[MEMORY_SIZE] = {0}, written[MEMORY_SIZE] = {0};
+    int register_used[VARIABLE_MEMORY_START] = {0};
+    int variables[VARIABLE_MEMORY_START], registers[VARIABLE_MEMORY_START];
+    int promoted = 0, stores = 0;
+    live_set *live_in;
+
+    /* Count accesses and find the registers the loop touches */
+    for (int i = header; i <= last; i++) {
+        for (int j = 0; j < 5; j++) {
+            int kind = operand_kind(intermediate_table[i]->opcode, j);
+            int cell = intermediate_table[i]->parameters[j];
+
+            if (!(kind & OPERAND_UPDATE) || cell < 0 || cell >= MEMORY_SIZE) {
+                continue;
+            }
+            if (cell < VARIABLE_MEMORY_START) {
+                register_used[cell] = 1;
+            } else {
+                uses[cell]++;
+                if (kind & OPERAND_WRITE) {
+                    written[cell] = 1;
+                }
+            }
+        }
+    }
+
+    /* A register is free if the loop never touches it and nothing reads it later */
+    live_in = (live_set*)stats_malloc(sizeof(live_set) * (intermediate_index + 1));
+    if (live_in == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed in optimizer\n");
+        return 0;
+    }
+    if (!compute_liveness(live_in, NULL)) {
+        free(live_in);
+        return 0;
+    }
+    for (int reg = 0; reg < VARIABLE_MEMORY_START; reg++) {
+        if (live_in[header].bits[0] & (1u << reg)) {
+            register_used[reg] = 1;
+        }
+    }
+    free(live_in);
+
+    /* Pick the most used scalars, one free register each */
+    for (int reg = 0; reg < VARIABLE_MEMORY_START; reg++) {
+        int best = -1;
+
+        if (register_used[reg]) {
+            continue;
+        }
+
+        for (int i = 0; i < symbol_index; i++) {
+            int cell = symbol_tab[i]->address;
+            if (symbol_tab[i]->size == 1 && cell < MEMORY_SIZE && uses[cell] >= 2 &&
+                (best < 0 || uses[cell] > uses[best])) {
+                best = cell;
+            }
+        }
+
+        if (best < 0) {
+            break;
+        }
+
+        variables[promoted] = best;
+        registers[promoted] = reg;
+        uses[best] = 0;
+        if (written[best]) {
+            stores++;
+        }
+        promoted++;
+    }
+
+    if (promoted == 0) {
+        return 0;
+    }
+
+    /* Rewrite the accesses inside the loop */
+    for (int i = header; i <= last; i++) {
+        for (int j = 0; j < 5; j++) {
+            int kind = operand_kind(intermediate_table[i]->opcode, j);
+            if (!(kind & OPERAND_UPDATE)) {
+                continue;
+            }
+            for (int v = 0; v < promoted; v++) {
+                if (intermediate_table[i]->parameters[j] == variables[v]) {
+                    intermediate_table[i]->parameters[j] = registers[v];
+                }
+            }
+        }
+    }
+
+    /* Store written variables back when the loop exits */
+    if (stores > 0) {
+        if (!insert_instructions(last + 1, stores)) {
+            return 0;
+        }
+
+        /* Exits from inside the loop land on the stores */
+        for (int i = header; i <= last; i++) {
+            for (int j = 0; j < 5; j++) {
+                if (operand_kind(intermediate_table[i]->opcode, j) == OPERAND_TARGET &&
+                    intermediate_table[i]->parameters[j] == last + 2 + stores) {
+                    intermediate_table[i]->parameters[j] = last + 2;
+                }
+            }
+        }
+
+        int slot = last + 1;
+        for (int v = 0; v < promoted; v++) {
+            if (written[variables[v]]) {
+                intermediate_lang *instr = intermediate_table[slot++];
+                instr->opcode = OP_MOV_MEM_TO_REG;
+                instr->parameters[0] = variables[v];
+                instr->parameters[1] = registers[v];
+                instr->parameters[2] = -1;  /* End marker */
+            }
+        }
+    }
+
+    /* Load every promoted variable before the header */
+    if (!insert_instructions(header, promoted)) {
+        return 0;
+    }
+
+    /* Jumps from outside the loop land on the loads */
+    for (int i = 0; i < intermediate_index; i++) {
+        if (i >= header + promoted && i <= last + promoted) {
+            continue;
+        }
+        for (int j = 0; j < 5; j++) {
+            if (operand_kind(intermediate_table[i]->opcode, j) == OPERAND_TARGET &&
+                intermediate_table[i]->parameters[j] == header + 1 + promoted) {
+                intermediate_table[i]->parameters[j] = header + 1;
+            }
+        }
+    }
+
+    for (int v = 0; v < promoted; v++) {
+        intermediate_lang *instr = intermediate_table[header + v];
+        instr->opcode = OP_MOV_REG_TO_MEM;
+        instr->parameters[0] = registers[v];
+        instr->parameters[1] = variables[v];
+        instr->parameters[2] = -1;  /* End marker */
+        if (compiler_messages) {
+            printf("Promoted memory cell %d to register %cX in loop at instruction %d\n",
+                   variables[v], 'A' + registers[v], header + 1);
+        }
+    }
+
+    return promoted;
+}
+
+/**
+ * @brief Promotes loop-resident DATA scalars into free registers
+ * 
+ * Loops are found from backward branches; each loop spans from the branch
+ * target to the last branch back to it. Smaller, inner loops are tried
+ * first, and the search starts over after every change.
+ * 
+ * @return int Number of variables promoted
+ */
+static int promote_loop_variables(void) {
+    int total = 0, promoted;
+
+    do {
+        int tried_size = -1, tried_header = -1;
+        promoted = 0;
+
+        while (!promoted) {
+            int best_header = -1, best_last = -1;
+
+            /* Find the smallest loop not tried yet, ties broken by position */
+            for (int header = 0; header < intermediate_index; header++) {
+                int last = -1;
+
+                for (int i = header; i < intermediate_index; i++) {
+                    int successors[2];
+                    int count = instruction_successors(i, successors);
+                    for (int s = 0; s < count; s++) {
+                        if (successors[s] == header) {
+                            last = i;
+                        }
+                    }
+                }
+
+                if (last < 0 || last - header < tried_size ||
+                    (last - header == tried_size && header <= tried_header)) {
+                    continue;
+                }
+                if (best_header < 0 || last - header < best_last - best_header) {
+                    best_header = header;
+                    best_last = last;
+                }
+            }
+
+            if (best_header < 0) {
+                break;
+            }
+            tried_size = best_last - best_header;
+            tried_header = best_header;
+
+            if (loop_is_promotable(best_header, best_last)) {
+                promoted = promote_loop(best_header, best_last);
+            }
+        }
+
+        total += promoted;
+    } while (promoted > 0);
+
+    return total;
+}
+
+/**
+ * @brief Measures the body of a subroutine that can be inlined
+ * 
+ * Only straight-line subroutines of at most INLINE_MAX_LENGTH instructions
+ * that end in a RET qualify, so they never call anything themselves.
+ * 
+ * @param entry Index of the first instruction of the subroutine
+ * @return int Number of instructions before the RET, or -1 if the
+ *             subroutine cannot be inlined
+ */
+static int inline_body_length(int entry) {
+    for (int i = entry; i < intermediate_index && i - entry <= INLINE_MAX_LENGTH; i++) {
+        switch (intermediate_table[i]->opcode) {
+            case OP_RET:
+                return i - entry;
+
+            case OP_MOV_MEM_TO_REG:
+            case OP_MOV_REG_TO_MEM:
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_READ:
+            case OP_READ_ARRAY:
+            case OP_PRINT:
+            case OP_PRINT_ARRAY:
+                break;
+
+            default:
+                return -1;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Replaces calls to small leaf subroutines by a copy of their body
+ * 
+ * The copy takes the place of the CALL, so branches to the CALL land on
+ * it. A subroutine that is no longer called becomes unreachable and is
+ * removed by the cleanup passes.
+ * 
+ * @return int Number of calls inlined
+ */
+static int inline_calls(void) {
+    int inlined = 0;
+
+    for (int i = 0; i < intermediate_index; i++) {
+        intermediate_lang body[INLINE_MAX_LENGTH];
+        int entry, length;
+
+        if (intermediate_table[i]->opcode != OP_CALL) {
+            continue;
+        }
+
+        entry = intermediate_table[i]->parameters[0] - 1;
+        length = inline_body_length(entry);
+        if (length < 0) {
+            continue;
+        }
+
+        if (compiler_messages) {
+            printf("Inlined subroutine at instruction %d into call at instruction %d\n",
+                   entry + 1, i + 1);
+        }
+
+        if (length == 0) {
+            /* An empty subroutine: the jump is removed as redundant */
+            intermediate_table[i]->opcode = OP_JUMP;
+            intermediate_table[i]->parameters[0] = i + 2;
+            inlined++;
+            continue;
+        }
+
+        /* Copy the body first, inserting may move it */
+        for (int k = 0; k < length; k++) {
+            body[k] = *intermediate_table[entry + k];
+        }
+
+        if (length > 1 && !insert_instructions(i + 1, length - 1)) {
+            return inlined;
+        }
+
+        for (int k = 0; k < length; k++) {
+            intermediate_table[i + k]->opcode = body[k].opcode;
+            memcpy(intermediate_table[i + k]->parameters, body[k].parameters, sizeof(body[k].parameters));
+        }
+
+        i += length - 1;
+        inlined++;
+    }
+
+    return inlined;
+}
+
+/**
+ * @brief Runs one of the removal passes and compacts the table
+ *
+ * @param pass Pass that clears the keep flag of removable instructions
+ * @return int Number of instructions removed
+ */
+static int run_removal_pass(int (*pass)(int *keep)) {
+    int *keep = (int*)stats_malloc(sizeof(int) * (intermediate_index + 1));
+    int removed = 0;
+
+    if (keep == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed in optimizer\n");
+        return 0;
+    }
+
+    for (int i = 0; i < intermediate_index; i++) {
+        keep[i] = 1;
+    }
+
+    if (pass(keep) > 0) {
+        removed = compact_instructions(keep);
+    }
+
+    free(keep);
+    return removed;
+}
+
+/**
+ * @brief Repeats the removal passes until nothing changes
+ *
+ * @param memory_array Memory array holding the CONST values
+ * @return int Number of instructions removed
+ */
+static int run_cleanup_passes(int *memory_array) {
+    int total = 0, removed;
+
+    do {
+        int *keep = (int*)stats_malloc(sizeof(int) * (intermediate_index + 1));
+        if (keep == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed in optimizer\n");
+            return total;
+        }
+
+        for (int i = 0; i < intermediate_index; i++) {
+            keep[i] = 1;
+        }
+
+        removed = 0;
+        if (fold_conditions(memory_array, keep) + simplify_arithmetic(memory_array, keep) > 0) {
+            removed += compact_instructions(keep);
+        }
+        free(keep);
+
+        removed += run_removal_pass(mark_unreachable);
+        removed += run_removal_pass(mark_dead_stores);
+        removed += run_removal_pass(mark_redundant_jumps);
+        total += removed;
+    } while (removed > 0);
+
+    return total;
+}
+
+/**
+ * @brief Runs the optimization passes over the intermediate language table
+ *
+ * Inlines calls to short straight-line subroutines, folds IF statements
+ * whose outcome is known at compile time, simplifies arithmetic on CONST
+ * values (multiplications by powers of two become shifts), then removes
+ * unreachable instructions, dead stores and jumps to the next instruction
+ * until nothing changes. READ and PRINT are always kept, as are stores to
+ * DATA cells in a program that spawns threads, and every jump target and
+ * label is re-linked after instructions are removed. Unless
+ * the program spawns threads, copies are then propagated and repeated
+ * computations reused through the SSA form, and DATA scalars used inside
+ * loops are promoted into free registers.
+ *
+ * @param memory_array Memory array holding the CONST values
+ * @return int Number of instructions removed
+ */
+int optimize_program(int *memory_array) {
+    int total;
+
+    if (intermediate_index <= 0) {
+        return 0;
+    }
+
+    if (!targets_are_valid()) {
+        fprintf(stderr, "Warning: Unresolved jump targets, skipping optimization\n");
+        return 0;
+    }
+
+    inline_calls();
+    total = run_cleanup_passes(memory_array);
+
+    /* Threads share DATA, so a value another thread may change cannot be
+       reused from another cell or kept in a register */
+    if (program_spawns()) {
+        return total;
+    }
+
+    /* Copies and recomputations it makes redundant are left for the cleanup passes */
+    if (optimize_ssa(memory_array) > 0) {
+        total += run_cleanup_passes(memory_array);
+    }
+
+    /* Promotion leaves loads and stores for the cleanup passes to trim */
+    if (promote_loop_variables() > 0) {
+        total += run_cleanup_passes(memory_array);
+    }
+
+    return total;
+}
@@ -0,0 +1,417 @@
+/**
+ * @file profile.c
+ * @brief Profile-guided block layout for the Assembly Language Compiler
+ *
+ * A training run with -p records, for every instruction, how often it
+ * branched and how often execution arrived at it by a branch. That is
+ * enough to work out how many times each instruction ran. Compiling again
+ * with -u reads the profile back and lays the basic blocks out so the hot
+ * paths run straight through: an IF whose branch is usually taken is
+ * inverted so its likely successor falls through, each block is followed
+ * by its likely successor where possible, the hot blocks come first and
+ * the blocks that never ran are moved to the end.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+/* External variables from main.c */
+extern int intermediate_index;
+extern int blocks_index;
+extern intermediate_lang **intermediate_table;
+extern blocks_table **block_tab;
+
+/* Heat of every block, for sorting them */
+static const long long *block_heat = NULL;
+
+/**
+ * @brief Adds an instruction to a checksum
+ *
+ * Only the parameters the instruction uses are included; the slots after
+ * its end marker may hold anything.
+ *
+ * @param hash Checksum so far
+ * @param instr Instruction
+ * @return unsigned int Updated checksum (FNV-1a)
+ */
+static unsigned int hash_instruction(unsigned int hash, const intermediate_lang *instr) {
+    hash = (hash ^ (unsigned int)instr->opcode) * 16777619u;
+    for (int j = 0; j < 5; j++) {
+        if (operand_kind(instr->opcode, j) != OPERAND_NONE) {
+            hash = (hash ^ (unsigned int)instr->parameters[j]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief Gets the parameter slot holding the branch target of an opcode
+ *
+ * @param opcode Operation code
+ * @return int Slot index, or -1 if the instruction does not branch
+ */
+static int target_slot(int opcode) {
+    for (int j = 0; j < 5; j++) {
+        if (operand_kind(opcode, j) == OPERAND_TARGET) {
+            return j;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Gets the IF that branches when another one falls through
+ *
+ * @param opcode Specialized IF opcode
+ * @return int Opcode with the opposite comparison, or -1 if there is none
+ */
+static int inverse_condition(int opcode) {
+    switch (opcode) {
+        case OP_IF_EQ:
+            return OP_IF_NE;
+        case OP_IF_NE:
+            return OP_IF_EQ;
+        case OP_IF_LT:
+            return OP_IF_GTEQ;
+        case OP_IF_GTEQ:
+            return OP_IF_LT;
+        case OP_IF_GT:
+            return OP_IF_LTEQ;
+        case OP_IF_LTEQ:
+            return OP_IF_GT;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief Orders blocks from hottest to coldest, in source order on ties
+ *
+ * @param a First block index
+ * @param b Second block index
+ * @return int qsort comparison result
+ */
+static int compare_heat(const void *a, const void *b) {
+    int first = *(const int*)a, second = *(const int*)b;
+
+    if (block_heat[first] != block_heat[second]) {
+        return (block_heat[first] > block_heat[second]) ? -1 : 1;
+    }
+    return first - second;
+}
+
+/**
+ * @brief Writes the profile recorded by a run of the virtual machine
+ *
+ * The file starts with the number of instructions and a checksum of the
+ * code, so it is only applied to the same program. Each following line
+ * gives an instruction number, how many times it ran and how many times
+ * it branched; instructions that never ran are left out.
+ *
+ * @param filename Profile file to write
+ * @param code Instructions that were run
+ * @param code_length Number of instructions
+ * @param branches_taken Per instruction, times it branched
+ * @param branch_entries Per instruction, times execution arrived by a branch
+ * @return int 1 on success, 0 on failure
+ */
+int save_profile(const char *filename, const intermediate_lang *code, int code_length,
+                 const long long *branches_taken, const long long *branch_entries) {
+    unsigned int checksum = 2166136261u;
+    long long executions = 0;
+    FILE *fp;
+
+    for (int i = 0; i < code_length; i++) {
+        checksum = hash_instruction(checksum, &code[i]);
+    }
+
+    fp = fopen(filename, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not create profile %s\n", filename);
+        return 0;
+    }
+
+    fprintf(fp, "PROFILE %d %08x\n", code_length, checksum);
+    for (int i = 0; i < code_length; i++) {
+        /* Runs that did not branch away from the previous instruction fall into this one */
+        executions = (i > 0 ? executions - branches_taken[i - 1] : 0) + branch_entries[i];
+        if (executions > 0) {
+            fprintf(fp, "%d %lld %lld\n", i + 1, executions, branches_taken[i]);
+        }
+    }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error: Could not write profile %s\n", filename);
+        return 0;
+    }
+
+    printf("Profile written to %s\n", filename);
+    return 1;
+}
+
+/**
+ * @brief Reads a profile recorded for the compiled program
+ *
+ * @param filename Profile file
+ * @param executions Receives the times each instruction ran
+ * @param branches_taken Receives the times each instruction branched
+ * @return int 1 on success, 0 if the profile cannot be used
+ */
+static int load_profile(const char *filename, long long *executions, long long *branches_taken) {
+    unsigned int checksum = 2166136261u, recorded;
+    int length, number;
+    long long ran, taken;
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not open profile %s\n", filename);
+        return 0;
+    }
+
+    for (int i = 0; i < intermediate_index; i++) {
+        checksum = hash_instruction(checksum, intermediate_table[i]);
+    }
+
+    if (fscanf(fp, "PROFILE %d %x", &length, &recorded) != 2 ||
+        length != intermediate_index || recorded != checksum) {
+        fprintf(stderr, "Warning: Profile %s was recorded for other code, ignoring it\n", filename);
+        fclose(fp);
+        return 0;
+    }
+
+    while (fscanf(fp, "%d %lld %lld", &number, &ran, &taken) == 3) {
+        if (number >= 1 && number <= intermediate_index) {
+            executions[number - 1] = ran;
+            branches_taken[number - 1] = taken;
+        }
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+/**
+ * @brief Lays out the compiled program using a recorded profile
+ *
+ * Must be called on the code the profile was recorded for, that is after
+ * the same compilation steps. Blocks are chained from the entry: each one
+ * is followed by its likely successor while that is not placed yet, and
+ * otherwise by the hottest block left. A JUMP to the block placed right
+ * after it is removed, and a block whose fall-through successor is placed
+ * elsewhere gets a JUMP to it.
+ *
+ * @param filename Profile file
+ * @return int 1 if the layout was applied, 0 if the profile could not be used
+ */
+int apply_profile(const char *filename) {
+    int n = intermediate_index;
+    long long *executions = (long long*)stats_calloc(n + 1, sizeof(long long));
+    long long *branches_taken = (long long*)stats_calloc(n + 1, sizeof(long long));
+    int *block_of = (int*)stats_malloc(sizeof(int) * (n + 1));
+    int *starts = (int*)stats_malloc(sizeof(int) * (n + 2));
+    int *map = (int*)stats_malloc(sizeof(int) * (n + 2));
+    int *pending = (int*)stats_malloc(sizeof(int) * (n + 1));
+    int block_count = 0, inverted = 0, removed = 0, added = 0, moved = 0;
+    int *fall = NULL, *jump = NULL, *order = NULL, *by_heat = NULL;
+    char *placed = NULL;
+    long long *heat = NULL;
+    intermediate_lang **ordered = NULL;
+    int result = 0;
+
+    if (executions == NULL || branches_taken == NULL || block_of == NULL ||
+        starts == NULL || map == NULL || pending == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for profile layout\n");
+        goto done;
+    }
+
+    if (n <= 0 || !load_profile(filename, executions, branches_taken)) {
+        goto done;
+    }
+
+    /* Blocks start at the entry, at branch targets and after branches */
+    memset(block_of, 0, sizeof(int) * (n + 1));
+    block_of[0] = 1;
+    for (int i = 0; i < n; i++) {
+        int slot = target_slot(intermediate_table[i]->opcode);
+
+        if (slot >= 0) {
+            int target = intermediate_table[i]->parameters[slot];
+            if (target >= 1 && target <= n) {
+                block_of[target - 1] = 1;
+            }
+        }
+        if (slot >= 0 || intermediate_table[i]->opcode == OP_RET) {
+            block_of[i + 1] = 1;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (block_of[i]) {
+            starts[block_count++] = i;
+        }
+        block_of[i] = block_count - 1;
+    }
+    starts[block_count] = n;
+    block_of[n] = block_count;  /* The end of the program acts as one more block */
+
+    fall = (int*)stats_malloc(sizeof(int) * block_count);
+    jump = (int*)stats_malloc(sizeof(int) * block_count);
+    order = (int*)stats_malloc(sizeof(int) * block_count);
+    by_heat = (int*)stats_malloc(sizeof(int) * block_count);
+    placed = (char*)stats_calloc(block_count + 1, sizeof(char));
+    heat = (long long*)stats_malloc(sizeof(long long) * block_count);
+    ordered = (intermediate_lang**)stats_malloc(sizeof(intermediate_lang*) * (n + block_count));
+    if (fall == NULL || jump == NULL || order == NULL || by_heat == NULL || placed == NULL ||
+        heat == NULL || ordered == NULL || !ensure_intermediate_capacity(n + block_count)) {
+        fprintf(stderr, "Error: Memory allocation failed for profile layout\n");
+        goto done;
+    }
+
+    /* Successors of each block; IFs that usually branch are inverted */
+    for (int b = 0; b < block_count; b++) {
+        int last = starts[b + 1] - 1;
+        intermediate_lang *instr = intermediate_table[last];
+        int slot = target_slot(instr->opcode);
+        int inverse = inverse_condition(instr->opcode);
+
+        fall[b] = (instr->opcode == OP_JUMP || instr->opcode == OP_RET) ? -1 : block_of[last + 1];
+        jump[b] = -1;
+        heat[b] = executions[starts[b]];
+        by_heat[b] = b;
+
+        if (instr->opcode == OP_JUMP) {
+            int target = instr->parameters[0];
+            jump[b] = (target >= 1 && target <= n + 1) ? block_of[target - 1] : -1;
+        }
+
+        if (inverse >= 0 && branches_taken[last] * 2 > executions[last]) {
+            int target = instr->parameters[slot];
+
+            instr->opcode = inverse;
+            instr->parameters[slot] = starts[fall[b]] + 1;  /* The end is instruction n + 1 */
+            fall[b] = (target >= 1 && target <= n + 1) ? block_of[target - 1] : fall[b];
+            inverted++;
+        }
+    }
+
+    /* Chain each block to its likely successor, then continue with the hottest block left */
+    block_heat = heat;
+    qsort(by_heat, block_count, sizeof(int), compare_heat);
+    block_heat = NULL;
+
+    for (int placed_count = 0, current = 0, hottest = 0; placed_count < block_count; ) {
+        int follow;
+
+        if (current < 0) {
+            while (placed[by_heat[hottest]]) {
+                hottest++;
+            }
+            current = by_heat[hottest];
+        }
+
+        placed[current] = 1;
+        order[placed_count++] = current;
+
+        follow = (fall[current] >= 0) ? fall[current] : jump[current];
+        if (follow >= 0 && follow < block_count && !placed[follow] &&
+            (heat[follow] > 0 || heat[current] == 0)) {
+            current = follow;
+        } else {
+            current = -1;
+        }
+    }
+
+    /* Emit the blocks in their new order; removed and unused entries go after them */
+    {
+        int position = 0, pending_count = 0, dropped = 0;
+        intermediate_lang **removed_entries = ordered + n + block_count;
+
+        for (int k = 0; k < block_count; k++) {
+            int b = order[k];
+            int next = (k + 1 < block_count) ? order[k + 1] : block_count;
+            int last = starts[b + 1] - 1;
+
+            if (b != k) {
+                moved++;
+            }
+
+            for (int i = starts[b]; i <= last; i++) {
+                if (i == last && jump[b] == next) {
+                    /* Branches to the dropped JUMP land on what follows it */
+                    pending[pending_count++] = i;
+                    *--removed_entries = intermediate_table[i];
+                    dropped++;
+                    continue;
+                }
+
+                while (pending_count > 0) {
+                    map[pending[--pending_count] + 1] = position + 1;
+                }
+                map[i + 1] = position + 1;
+                ordered[position++] = intermediate_table[i];
+            }
+
+            if (fall[b] >= 0 && fall[b] != next) {
+                intermediate_lang *link = intermediate_table[n + added];
+
+                link->opcode = OP_JUMP;
+                link->parameters[0] = starts[fall[b]] + 1;
+                link->parameters[1] = -1;  /* End marker */
+                ordered[position++] = link;
+                added++;
+            }
+        }
+
+        while (pending_count > 0) {
+            map[pending[--pending_count] + 1] = position + 1;
+        }
+        map[n + 1] = position + 1;
+
+        /* Re-link branch targets and labels */
+        for (int k = 0; k < position; k++) {
+            int slot = target_slot(ordered[k]->opcode);
+            if (slot >= 0 && ordered[k]->parameters[slot] >= 1 && ordered[k]->parameters[slot] <= n + 1) {
+                ordered[k]->parameters[slot] = map[ordered[k]->parameters[slot]];
+            }
+        }
+
+        for (int i = 0; i < blocks_index; i++) {
+            if (block_tab[i]->instr_no >= 1 && block_tab[i]->instr_no <= n + 1) {
+                block_tab[i]->instr_no = map[block_tab[i]->instr_no];
+            }
+        }
+
+        /* Entries not used any more stay allocated after the instructions */
+        for (int k = n + added; k < n + block_count; k++) {
+            ordered[position + k - n - added] = intermediate_table[k];
+        }
+        memcpy(intermediate_table, ordered, sizeof(intermediate_lang*) * (n + block_count));
+
+        for (int k = 0; k < position; k++) {
+            intermediate_table[k]->instruc_no = k + 1;
+        }
+        intermediate_index = position;
+        removed = dropped;
+    }
+
+    printf("Profile layout: %d blocks, %d moved, %d conditions inverted, %d jumps removed, %d added\n",
+           block_count, moved, inverted, removed, added);
+    result = 1;
+
+done:
+    free(executions);
+    free(branches_taken);
+    free(block_of);
+    free(starts);
+    free(map);
+    free(pending);
+    free(fall);
+    free(jump);
+    free(order);
+    free(by_heat);
+    free(placed);
+    free(heat);
+    free(ordered);
+    return result;
+}
@@ -0,0 +1,23 @@
+DATA F
+DATA G
+CONST ZERO = 0
+CONST ONE = 1
+START:
+SPAWN W
+MOV F, ONE
+L:
+IF G EQ ZERO THEN
+JUMP L
+ENDIF
+MOV F, ZERO
+JOIN
+PRINT G
+JUMP DONE
+W:
+IF F EQ ZERO THEN
+JUMP W
+ENDIF
+MOV G, ONE
+RET
+DONE:
+END
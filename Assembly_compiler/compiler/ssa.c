@@ -0,0 +1,697 @@
+/**
+ * @file ssa.c
+ * @brief SSA form and global value numbering for the Assembly Language Compiler
+ *
+ * The intermediate table addresses memory cells directly, so the same cell
+ * holds many different values over a run. build_ssa splits the table into
+ * basic blocks and gives every value written to a cell a name of its own:
+ * an SSA value, defined once. Blocks entered from more than one place start
+ * with a phi value for every cell that some instruction writes. Cells that
+ * no instruction writes keep their initial value, so they need no phis.
+ *
+ * number_ssa_values then gives equal values equal numbers, visiting the
+ * values in reverse postorder. A copy takes the number of its source, and
+ * an ADD, SUB or MUL whose operands have the same numbers as an earlier
+ * one takes the earlier number. A phi takes the number shared by all of
+ * its incoming values; it gets a new number when the values differ or
+ * when one of them arrives by a loop's back edge, which is not numbered
+ * yet.
+ *
+ * lower_ssa maps the numbers back to the intermediate table, which stays
+ * the executable form. An operand is read from the cell that first held
+ * its value while that cell still does (copy propagation), and a
+ * computation whose value is already in some cell becomes a MOV from it
+ * (common subexpression elimination). The cleanup passes then remove the
+ * copies nobody reads any more.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+/* External variables from main.c */
+extern int intermediate_index;
+extern int compiler_messages;
+extern intermediate_lang **intermediate_table;
+
+/**
+ * @brief Adds an SSA value
+ *
+ * @param ssa SSA form
+ * @param kind One of the SSA_* kinds
+ * @param cell Memory cell holding the value
+ * @return int Index of the value, or -1 if memory allocation failed
+ */
+static int add_value(ssa_form *ssa, int kind, int cell) {
+    ssa_value *value;
+
+    if (ssa->value_count == ssa->value_capacity) {
+        int capacity = ssa->value_capacity * 2;
+        ssa_value *values = (ssa_value*)stats_realloc(ssa->values, sizeof(ssa_value) * capacity);
+        if (values == NULL) {
+            return -1;
+        }
+        ssa->values = values;
+        ssa->value_capacity = capacity;
+    }
+
+    value = &ssa->values[ssa->value_count];
+    value->kind = kind;
+    value->cell = cell;
+    value->block = -1;
+    value->opcode = 0;
+    value->operands[0] = value->operands[1] = -1;
+    value->immediate = 0;
+    value->number = -1;
+    return ssa->value_count++;
+}
+
+/**
+ * @brief Checks whether a parameter is a single cell the SSA form tracks
+ *
+ * @param instr Instruction
+ * @param index Parameter index (0-4)
+ * @return int 1 for a scalar address inside the memory array
+ */
+static int is_scalar_cell(const intermediate_lang *instr, int index) {
+    int cell = instr->parameters[index];
+
+    return cell >= 0 && cell < MEMORY_SIZE &&
+           (index == 4 || operand_kind(instr->opcode, index + 1) != OPERAND_COUNT);
+}
+
+/**
+ * @brief Finds the cells written by some instruction and the basic blocks
+ *
+ * @param ssa SSA form
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+static int find_blocks(ssa_form *ssa) {
+    int *leader = (int*)stats_calloc(intermediate_index + 1, sizeof(int));
+
+    if (leader == NULL) {
+        return 0;
+    }
+
+    for (int cell = 0; cell < MEMORY_SIZE; cell++) {
+        ssa->cells[cell] = -1;
+    }
+
+    leader[0] = 1;
+    for (int i = 0; i < intermediate_index; i++) {
+        intermediate_lang *instr = intermediate_table[i];
+        int successors[2];
+        int count = instruction_successors(i, successors);
+
+        /* A block ends at every instruction that can do more than fall through */
+        if (count != 1 || successors[0] != i + 1) {
+            leader[i + 1] = 1;
+        }
+        for (int s = 0; s < count; s++) {
+            leader[successors[s]] = 1;
+        }
+
+        for (int j = 0; j < 5; j++) {
+            int first = instr->parameters[j];
+            if (!(operand_kind(instr->opcode, j) & OPERAND_WRITE)) {
+                continue;
+            }
+            for (int cell = first; cell >= 0 && cell < first + operand_cells(instr, j) &&
+                 cell < MEMORY_SIZE; cell++) {
+                if (ssa->cells[cell] < 0) {
+                    ssa->cells[cell] = ssa->tracked++;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < intermediate_index; i++) {
+        ssa->block_count += leader[i];
+    }
+
+    ssa->blocks = (ssa_block*)stats_calloc(ssa->block_count, sizeof(ssa_block));
+    ssa->block_of = (int*)stats_malloc(sizeof(int) * intermediate_index);
+    if (ssa->blocks == NULL || ssa->block_of == NULL) {
+        free(leader);
+        return 0;
+    }
+
+    for (int i = 0, b = -1; i < intermediate_index; i++) {
+        if (leader[i]) {
+            ssa->blocks[++b].first = i;
+            ssa->blocks[b].order = -1;
+        }
+        ssa->blocks[b].last = i;
+        ssa->block_of[i] = b;
+    }
+
+    free(leader);
+    return 1;
+}
+
+/**
+ * @brief Links the blocks to their predecessors and orders them
+ *
+ * Reachable blocks are listed in reverse postorder, so every block comes
+ * after the blocks it can be entered from, except along back edges.
+ *
+ * @param ssa SSA form
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+static int order_blocks(ssa_form *ssa) {
+    int *stack, *next, *postorder;
+    int total = 0, depth = 0, visited = 0;
+
+    for (int b = 0; b < ssa->block_count; b++) {
+        int successors[2];
+        int count = instruction_successors(ssa->blocks[b].last, successors);
+        for (int s = 0; s < count; s++) {
+            if (successors[s] < intermediate_index) {
+                ssa->blocks[ssa->block_of[successors[s]]].pred_count++;
+                total++;
+            }
+        }
+    }
+
+    ssa->pred_list = (int*)stats_malloc(sizeof(int) * (total + 1));
+    stack = (int*)stats_malloc(sizeof(int) * ssa->block_count);
+    next = (int*)stats_calloc(ssa->block_count, sizeof(int));
+    postorder = (int*)stats_malloc(sizeof(int) * ssa->block_count);
+    ssa->order = postorder;
+    if (ssa->pred_list == NULL || stack == NULL || next == NULL || postorder == NULL) {
+        free(stack);
+        free(next);
+        return 0;
+    }
+
+    total = 0;
+    for (int b = 0; b < ssa->block_count; b++) {
+        ssa->blocks[b].preds = &ssa->pred_list[total];
+        total += ssa->blocks[b].pred_count;
+        ssa->blocks[b].pred_count = 0;
+    }
+    for (int b = 0; b < ssa->block_count; b++) {
+        int successors[2];
+        int count = instruction_successors(ssa->blocks[b].last, successors);
+        for (int s = 0; s < count; s++) {
+            if (successors[s] < intermediate_index) {
+                ssa_block *succ = &ssa->blocks[ssa->block_of[successors[s]]];
+                succ->preds[succ->pred_count++] = b;
+            }
+        }
+    }
+
+    /* Depth-first search from the first block; order holds -2 while on the stack */
+    stack[depth++] = 0;
+    ssa->blocks[0].order = -2;
+    while (depth > 0) {
+        int b = stack[depth - 1];
+        int successors[2];
+        int count = instruction_successors(ssa->blocks[b].last, successors);
+
+        if (next[b] < count) {
+            int s = successors[next[b]++];
+            if (s < intermediate_index && ssa->blocks[ssa->block_of[s]].order == -1) {
+                ssa->blocks[ssa->block_of[s]].order = -2;
+                stack[depth++] = ssa->block_of[s];
+            }
+            continue;
+        }
+
+        postorder[visited++] = b;
+        depth--;
+    }
+
+    /* Reverse the postorder in place */
+    for (int k = 0; k < visited / 2; k++) {
+        int swap = postorder[k];
+        postorder[k] = postorder[visited - 1 - k];
+        postorder[visited - 1 - k] = swap;
+    }
+    for (int k = 0; k < visited; k++) {
+        ssa->blocks[postorder[k]].order = k;
+    }
+    ssa->order_count = visited;
+
+    free(stack);
+    free(next);
+    return 1;
+}
+
+/**
+ * @brief Names the values written by one instruction
+ *
+ * @param ssa SSA form
+ * @param i Index of the instruction
+ * @param state SSA value in each memory cell, updated past the instruction
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+static int rename_instruction(ssa_form *ssa, int i, int *state) {
+    intermediate_lang *instr = intermediate_table[i];
+    int opcode = instr->opcode;
+    int *uses = &ssa->uses[i * 5];
+    int kind = SSA_OPAQUE;
+    int value;
+
+    /* Operands are read before the destination is written */
+    for (int j = 0; j < 5; j++) {
+        uses[j] = (operand_kind(opcode, j) == OPERAND_READ && is_scalar_cell(instr, j))
+                  ? state[instr->parameters[j]] : -1;
+    }
+
+    switch (opcode) {
+        case OP_MOV_MEM_TO_REG:
+        case OP_MOV_REG_TO_MEM:
+        case OP_FOR:
+            kind = (uses[1] >= 0) ? SSA_COPY : SSA_OPAQUE;
+            break;
+
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+            kind = (uses[1] >= 0 && uses[2] >= 0) ? SSA_EXPR : SSA_OPAQUE;
+            break;
+
+        case OP_SHL:
+        case OP_ADD_IMM:
+        case OP_MUL_IMM:
+            kind = (uses[1] >= 0) ? SSA_EXPR : SSA_OPAQUE;
+            break;
+
+        case OP_LOAD_IMM:
+            kind = SSA_EXPR;
+            break;
+
+        case OP_CALL:
+        case OP_SPAWN:
+        case OP_JOIN:
+            /* The subroutine may write any cell that some instruction writes */
+            for (int cell = 0; cell < MEMORY_SIZE; cell++) {
+                if (ssa->cells[cell] >= 0) {
+                    if ((value = add_value(ssa, SSA_OPAQUE, cell)) < 0) {
+                        return 0;
+                    }
+                    state[cell] = value;
+                }
+            }
+            return 1;
+
+        default:
+            break;
+    }
+
+    for (int j = 0; j < 5; j++) {
+        int first = instr->parameters[j];
+        if (!(operand_kind(opcode, j) & OPERAND_WRITE)) {
+            continue;
+        }
+
+        for (int cell = first; cell >= 0 && cell < first + operand_cells(instr, j) &&
+             cell < MEMORY_SIZE; cell++) {
+            if ((value = add_value(ssa, (j == 0) ? kind : SSA_OPAQUE, cell)) < 0) {
+                return 0;
+            }
+
+            if (ssa->values[value].kind == SSA_COPY) {
+                ssa->values[value].operands[0] = uses[1];
+            } else if (ssa->values[value].kind == SSA_EXPR) {
+                ssa->values[value].opcode = opcode;
+                ssa->values[value].operands[0] = (opcode == OP_LOAD_IMM) ? -1 : uses[1];
+                if (opcode == OP_ADD || opcode == OP_SUB || opcode == OP_MUL) {
+                    ssa->values[value].operands[1] = uses[2];
+                } else {
+                    ssa->values[value].immediate = instr->parameters[(opcode == OP_LOAD_IMM) ? 1 : 2];
+                }
+            }
+            state[cell] = value;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Builds the SSA form of the intermediate language table
+ *
+ * The first MEMORY_SIZE values are the initial values of the cells.
+ *
+ * @param ssa SSA form to fill in
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int build_ssa(ssa_form *ssa) {
+    int state[MEMORY_SIZE];
+
+    memset(ssa, 0, sizeof(ssa_form));
+    ssa->value_capacity = MEMORY_SIZE * 2;
+    ssa->values = (ssa_value*)stats_malloc(sizeof(ssa_value) * ssa->value_capacity);
+    ssa->uses = (int*)stats_malloc(sizeof(int) * 5 * intermediate_index);
+    ssa->defs = (int*)stats_malloc(sizeof(int) * intermediate_index);
+    ssa->def_ends = (int*)stats_malloc(sizeof(int) * intermediate_index);
+    if (ssa->values == NULL || ssa->uses == NULL || ssa->defs == NULL || ssa->def_ends == NULL ||
+        !find_blocks(ssa) || !order_blocks(ssa)) {
+        return 0;
+    }
+
+    ssa->entry = (int*)stats_malloc(sizeof(int) * ssa->block_count * (ssa->tracked + 1));
+    ssa->exit = (int*)stats_malloc(sizeof(int) * ssa->block_count * (ssa->tracked + 1));
+    if (ssa->entry == NULL || ssa->exit == NULL) {
+        return 0;
+    }
+
+    for (int cell = 0; cell < MEMORY_SIZE; cell++) {
+        add_value(ssa, SSA_ENTRY, cell);
+    }
+
+    for (int k = 0; k < ssa->order_count; k++) {
+        int b = ssa->order[k];
+        ssa_block *block = &ssa->blocks[b];
+        int *entry = &ssa->entry[b * ssa->tracked];
+
+        /* The first block is also entered when the program starts */
+        if (block->pred_count + (b == 0) == 1) {
+            int *from = (b == 0) ? NULL : &ssa->exit[block->preds[0] * ssa->tracked];
+            for (int cell = 0; cell < MEMORY_SIZE; cell++) {
+                state[cell] = (from == NULL || ssa->cells[cell] < 0) ? cell : from[ssa->cells[cell]];
+            }
+        } else {
+            for (int cell = 0; cell < MEMORY_SIZE; cell++) {
+                state[cell] = cell;
+                if (ssa->cells[cell] >= 0) {
+                    if ((state[cell] = add_value(ssa, SSA_PHI, cell)) < 0) {
+                        return 0;
+                    }
+                    ssa->values[state[cell]].block = b;
+                }
+            }
+        }
+
+        for (int cell = 0; cell < MEMORY_SIZE; cell++) {
+            if (ssa->cells[cell] >= 0) {
+                entry[ssa->cells[cell]] = state[cell];
+            }
+        }
+
+        for (int i = block->first; i <= block->last; i++) {
+            ssa->defs[i] = ssa->value_count;
+            if (!rename_instruction(ssa, i, state)) {
+                return 0;
+            }
+            ssa->def_ends[i] = ssa->value_count;
+        }
+
+        for (int cell = 0; cell < MEMORY_SIZE; cell++) {
+            if (ssa->cells[cell] >= 0) {
+                ssa->exit[b * ssa->tracked + ssa->cells[cell]] = state[cell];
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Finds or adds the number of an expression
+ *
+ * @param ssa SSA form
+ * @param table Open-addressing table of value indices, table_size entries
+ * @param table_size Number of entries, a power of two
+ * @param value Expression value to number
+ * @return int Value number
+ */
+static int expression_number(ssa_form *ssa, int *table, int table_size, int value) {
+    ssa_value *v = &ssa->values[value];
+    int a = (v->operands[0] >= 0) ? ssa->values[v->operands[0]].number : -1;
+    int b = (v->operands[1] >= 0) ? ssa->values[v->operands[1]].number : v->immediate;
+    unsigned int slot;
+
+    /* Operands of a commutative operation are put in a fixed order */
+    if ((v->opcode == OP_ADD || v->opcode == OP_MUL) && a > b) {
+        int swap = a;
+        a = b;
+        b = swap;
+    }
+
+    slot = ((unsigned int)v->opcode * 31u + (unsigned int)a * 1000003u + (unsigned int)b * 7919u) &
+           (unsigned int)(table_size - 1);
+    while (table[slot] >= 0) {
+        ssa_value *other = &ssa->values[table[slot]];
+        int c = (other->operands[0] >= 0) ? ssa->values[other->operands[0]].number : -1;
+        int d = (other->operands[1] >= 0) ? ssa->values[other->operands[1]].number : other->immediate;
+
+        if ((other->opcode == OP_ADD || other->opcode == OP_MUL) && c > d) {
+            int swap = c;
+            c = d;
+            d = swap;
+        }
+        if (other->opcode == v->opcode && c == a && d == b &&
+            (v->operands[1] >= 0) == (other->operands[1] >= 0)) {
+            return other->number;
+        }
+        slot = (slot + 1) & (unsigned int)(table_size - 1);
+    }
+
+    table[slot] = value;
+    return ssa->number_count++;
+}
+
+/**
+ * @brief Gives equal values equal numbers
+ *
+ * CONST cells that no instruction writes are numbered as the constant
+ * they hold, so they match a LOAD_IMM of the same value.
+ *
+ * @param ssa SSA form built by build_ssa
+ * @param memory_array Memory array holding the CONST values
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+int number_ssa_values(ssa_form *ssa, const int *memory_array) {
+    int known[MEMORY_SIZE];
+    int table_size = 16;
+    int *table;
+
+    while (table_size < ssa->value_count * 2) {
+        table_size *= 2;
+    }
+    table = (int*)stats_malloc(sizeof(int) * table_size);
+    ssa->leaders = (int*)stats_malloc(sizeof(int) * ssa->value_count);
+    if (table == NULL || ssa->leaders == NULL) {
+        free(table);
+        return 0;
+    }
+    memset(table, 0xff, sizeof(int) * table_size);
+
+    find_known_values(known);
+
+    /* Values are visited in the reverse postorder they were built in */
+    for (int v = 0; v < ssa->value_count; v++) {
+        ssa_value *value = &ssa->values[v];
+        int fresh = ssa->number_count;
+        int number = -1;
+
+        switch (value->kind) {
+            case SSA_ENTRY:
+                if (known[value->cell]) {
+                    /* Numbered like the LOAD_IMM that would put the constant there */
+                    value->opcode = OP_LOAD_IMM;
+                    value->immediate = memory_array[value->cell];
+                    number = expression_number(ssa, table, table_size, v);
+                }
+                break;
+
+            case SSA_PHI: {
+                ssa_block *block = &ssa->blocks[value->block];
+                int slot = ssa->cells[value->cell];
+
+                /* The program start brings the initial value into the first block */
+                number = (value->block == 0) ? ssa->values[value->cell].number : -2;
+                for (int p = 0; p < block->pred_count && number != -1; p++) {
+                    int pred = block->preds[p];
+                    int incoming;
+
+                    if (ssa->blocks[pred].order < 0) {
+                        continue;  /* Unreachable, never runs */
+                    }
+                    if (ssa->blocks[pred].order >= block->order) {
+                        number = -1;  /* Back edge: not numbered yet */
+                        break;
+                    }
+                    incoming = ssa->values[ssa->exit[pred * ssa->tracked + slot]].number;
+                    number = (number == -2 || number == incoming) ? incoming : -1;
+                }
+                break;
+            }
+
+            case SSA_COPY:
+                number = ssa->values[value->operands[0]].number;
+                break;
+
+            case SSA_EXPR:
+                number = expression_number(ssa, table, table_size, v);
+                break;
+
+            default:
+                break;
+        }
+
+        if (number < 0) {
+            /* Unlike any earlier value; -2 is a phi of unreachable blocks only */
+            number = ssa->number_count++;
+        }
+        value->number = number;
+
+        /* The first value with a number leads it */
+        if (number >= fresh) {
+            ssa->leaders[number] = v;
+        }
+    }
+
+    free(table);
+    return 1;
+}
+
+/**
+ * @brief Finds a cell that holds a value number
+ *
+ * @param ssa SSA form
+ * @param state SSA value in each memory cell
+ * @param number Value number
+ * @param scan 1 to look through every cell when the leader's cell does not hold it
+ * @return int Memory cell, or -1 if none holds the number
+ */
+static int find_holder(const ssa_form *ssa, const int *state, int number, int scan) {
+    int cell = ssa->values[ssa->leaders[number]].cell;
+
+    if (ssa->values[state[cell]].number == number) {
+        return cell;
+    }
+
+    for (cell = 0; scan && cell < MEMORY_SIZE; cell++) {
+        if (ssa->values[state[cell]].number == number) {
+            return cell;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Rewrites the intermediate language table from the value numbers
+ *
+ * Operands are read from the cell that first held their value while it
+ * still does, and a computation whose value some cell already holds
+ * becomes a MOV from that cell, or a MOV of its destination onto itself
+ * when the destination holds it. The number of instructions stays the
+ * same.
+ *
+ * @param ssa SSA form numbered by number_ssa_values
+ * @param operands Receives the number of operands rewritten
+ * @param computations Receives the number of computations replaced
+ */
+void lower_ssa(ssa_form *ssa, int *operands, int *computations) {
+    int state[MEMORY_SIZE];
+
+    *operands = 0;
+    *computations = 0;
+
+    for (int k = 0; k < ssa->order_count; k++) {
+        ssa_block *block = &ssa->blocks[ssa->order[k]];
+
+        for (int cell = 0; cell < MEMORY_SIZE; cell++) {
+            state[cell] = (ssa->cells[cell] < 0) ? cell
+                          : ssa->entry[ssa->order[k] * ssa->tracked + ssa->cells[cell]];
+        }
+
+        for (int i = block->first; i <= block->last; i++) {
+            int *params = intermediate_table[i]->parameters;
+            int first = ssa->defs[i];
+            int last = ssa->def_ends[i];
+
+            for (int j = 0; j < 5; j++) {
+                int use = ssa->uses[i * 5 + j];
+                int holder;
+
+                if (use < 0) {
+                    continue;
+                }
+                holder = find_holder(ssa, state, ssa->values[use].number, 0);
+                if (holder >= 0 && holder != params[j]) {
+                    params[j] = holder;
+                    (*operands)++;
+                }
+            }
+
+            /* A computation or copy of a value that is already around */
+            if (first < last && (ssa->values[first].kind == SSA_EXPR || ssa->values[first].kind == SSA_COPY) &&
+                intermediate_table[i]->opcode != OP_FOR) {
+                int number = ssa->values[first].number;
+                int dest = params[0];
+                int holder = (ssa->values[state[dest]].number == number) ? dest
+                             : (ssa->leaders[number] != first) ? find_holder(ssa, state, number, 1) : -1;
+                int is_move = (intermediate_table[i]->opcode == OP_MOV_MEM_TO_REG ||
+                               intermediate_table[i]->opcode == OP_MOV_REG_TO_MEM);
+
+                if (holder >= 0 && !(is_move && params[1] == holder)) {
+                    intermediate_table[i]->opcode = OP_MOV_MEM_TO_REG;
+                    params[1] = holder;
+                    params[2] = -1;  /* End marker */
+                    (*computations)++;
+                }
+            }
+
+            for (int v = first; v < last; v++) {
+                state[ssa->values[v].cell] = v;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Frees an SSA form
+ *
+ * @param ssa SSA form
+ */
+void release_ssa(ssa_form *ssa) {
+    free(ssa->blocks);
+    free(ssa->block_of);
+    free(ssa->pred_list);
+    free(ssa->order);
+    free(ssa->values);
+    free(ssa->entry);
+    free(ssa->exit);
+    free(ssa->uses);
+    free(ssa->defs);
+    free(ssa->def_ends);
+    free(ssa->leaders);
+    memset(ssa, 0, sizeof(ssa_form));
+}
+
+/**
+ * @brief Runs copy propagation and global value numbering over the program
+ *
+ * @param memory_array Memory array holding the CONST values
+ * @return int Number of operands and computations rewritten
+ */
+int optimize_ssa(const int *memory_array) {
+    ssa_form ssa;
+    int operands = 0, computations = 0;
+
+    if (intermediate_index <= 0) {
+        return 0;
+    }
+
+    if (!build_ssa(&ssa) || !number_ssa_values(&ssa, memory_array)) {
+        fprintf(stderr, "Error: Memory allocation failed in optimizer\n");
+        release_ssa(&ssa);
+        return 0;
+    }
+
+    lower_ssa(&ssa, &operands, &computations);
+    release_ssa(&ssa);
+
+    if (operands + computations > 0 && compiler_messages) {
+        printf("Value numbering: %d operands propagated, %d redundant computations replaced\n",
+               operands, computations);
+    }
+    return operands + computations;
+}
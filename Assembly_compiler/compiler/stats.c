@@ -0,0 +1,336 @@
+/**
+ * @file stats.c
+ * @brief Phase statistics for the Assembly Language Compiler
+ *
+ * This file times each phase of a run, counts the allocations made while
+ * it is active and, on Linux, reads hardware counters around it with
+ * perf_event_open. The results are written as a JSON report next to
+ * output.obj. Phases nest: ENDIF backpatching is also part of instruction
+ * processing, and lazily compiled blocks are part of execution.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/**
+ * @struct phase_stats
+ * @brief Totals for one phase
+ */
+typedef struct {
+    int active;                     /* Nesting depth of stats_begin calls */
+    long calls;                     /* Number of times the phase ran */
+    long long started_ns;           /* Clock when the phase was entered */
+    long long time_ns;              /* Total time spent in the phase */
+    long allocations;               /* Allocations made while active */
+    long long allocated_bytes;      /* Bytes requested by those allocations */
+    long long counter_start[STATS_COUNTERS]; /* Counter values when the phase was entered */
+    long long counters[STATS_COUNTERS];      /* Counter totals */
+} phase_stats;
+
+static phase_stats phases[STATS_PHASES];
+
+/* Report keys of the phases, by STATS_* number */
+static const char *phase_names[STATS_PHASES] = {
+    "declarations", "instructions", "backpatch", "verify", "optimize", "dump", "execute",
+    "link"
+};
+
+/* Report keys of the hardware counters */
+static const char *counter_names[STATS_COUNTERS] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+static int stats_enabled = 0;
+static long total_allocations = 0;
+static long long total_allocated_bytes = 0;
+static long long run_started_ns = 0;
+
+/* File descriptors of the counters, -1 when a counter could not be opened */
+static int counter_fds[STATS_COUNTERS] = { -1, -1, -1, -1 };
+static int counters_available = 0;
+
+/**
+ * @brief Reads a monotonic clock
+ *
+ * @return long long Nanoseconds since an arbitrary start
+ */
+static long long clock_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER now, frequency;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return (long long)(now.QuadPart / frequency.QuadPart * 1000000000LL +
+                       now.QuadPart % frequency.QuadPart * 1000000000LL / frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Opens the hardware counters for this process
+ *
+ * Counters are user space only. Any counter the kernel refuses, for
+ * example because of perf_event_paranoid, is left out of the report.
+ */
+static void open_counters(void) {
+#ifdef __linux__
+    static const unsigned long long configs[STATS_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        counter_fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counter_fds[i] >= 0) {
+            counters_available = 1;
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Reads the current value of every counter
+ *
+ * @param values Receives the values, 0 for counters that are not open
+ */
+static void read_counters(long long *values) {
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        values[i] = 0;
+#ifdef __linux__
+        if (counter_fds[i] >= 0 && read(counter_fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+            values[i] = 0;
+        }
+#endif
+    }
+}
+
+/**
+ * @brief Starts collecting statistics
+ *
+ * Until this is called, stats_begin and stats_end do nothing.
+ */
+void stats_start(void) {
+    stats_enabled = 1;
+    run_started_ns = clock_ns();
+    open_counters();
+}
+
+/**
+ * @brief Enters a phase
+ *
+ * Phases can be entered again while active; only the outermost entry
+ * is timed.
+ *
+ * @param phase STATS_* phase
+ */
+void stats_begin(int phase) {
+    phase_stats *p = &phases[phase];
+
+    if (!stats_enabled || p->active++ > 0) {
+        return;
+    }
+
+    p->calls++;
+    if (counters_available) {
+        read_counters(p->counter_start);
+    }
+    p->started_ns = clock_ns();
+}
+
+/**
+ * @brief Leaves a phase entered with stats_begin
+ *
+ * @param phase STATS_* phase
+ */
+void stats_end(int phase) {
+    phase_stats *p = &phases[phase];
+    long long now;
+
+    if (!stats_enabled || p->active <= 0 || --p->active > 0) {
+        return;
+    }
+
+    now = clock_ns();
+    p->time_ns += now - p->started_ns;
+
+    if (counters_available) {
+        long long values[STATS_COUNTERS];
+
+        read_counters(values);
+        for (int i = 0; i < STATS_COUNTERS; i++) {
+            p->counters[i] += values[i] - p->counter_start[i];
+        }
+    }
+}
+
+/**
+ * @brief Records an allocation against every active phase
+ *
+ * @param size Bytes requested
+ */
+static void count_allocation(size_t size) {
+    /* Nothing is shared with the daemon's worker threads unless enabled */
+    if (!stats_enabled) {
+        return;
+    }
+
+    total_allocations++;
+    total_allocated_bytes += (long long)size;
+
+    for (int i = 0; i < STATS_PHASES; i++) {
+        if (phases[i].active > 0) {
+            phases[i].allocations++;
+            phases[i].allocated_bytes += (long long)size;
+        }
+    }
+}
+
+/**
+ * @brief Counting replacement for malloc
+ *
+ * The compiler allocates through it so the statistics report can
+ * attribute allocations to phases.
+ *
+ * @param size Bytes to allocate
+ * @return void* The allocated block, or NULL
+ */
+void *stats_malloc(size_t size) {
+    count_allocation(size);
+    return malloc(size);
+}
+
+/**
+ * @brief Counting replacement for realloc
+ *
+ * @param block Block to resize, or NULL
+ * @param size New size in bytes
+ * @return void* The resized block, or NULL
+ */
+void *stats_realloc(void *block, size_t size) {
+    count_allocation(size);
+    return realloc(block, size);
+}
+
+/**
+ * @brief Counting replacement for calloc
+ *
+ * @param count Number of elements
+ * @param size Bytes per element
+ * @return void* The zeroed block, or NULL
+ */
+void *stats_calloc(size_t count, size_t size) {
+    count_allocation(count * size);
+    return calloc(count, size);
+}
+
+/**
+ * @brief Writes a string as a JSON string literal
+ *
+ * @param fp Report file
+ * @param text String to write
+ */
+static void write_json_string(FILE *fp, const char *text) {
+    fputc('"', fp);
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\') {
+            fputc('\\', fp);
+        }
+        fputc(*text, fp);
+    }
+    fputc('"', fp);
+}
+
+/**
+ * @brief Writes the statistics report and closes the counters
+ *
+ * @param filename Report file to write
+ * @param source Source or image file the run was for
+ * @return int 1 on success, 0 on failure
+ */
+int stats_write_report(const char *filename, const char *source) {
+    FILE *fp;
+
+    if (!stats_enabled) {
+        return 1;
+    }
+
+    fp = fopen(filename, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not create statistics report %s\n", filename);
+        return 0;
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"source\": ");
+    write_json_string(fp, source);
+    fprintf(fp, ",\n");
+    fprintf(fp, "  \"perf_counters\": %s,\n", counters_available ? "true" : "false");
+    fprintf(fp, "  \"phases\": {\n");
+
+    for (int i = 0; i < STATS_PHASES; i++) {
+        phase_stats *p = &phases[i];
+
+        fprintf(fp, "    \"%s\": {\"calls\": %ld, \"time_ns\": %lld, \"allocations\": %ld, "
+                "\"allocated_bytes\": %lld", phase_names[i], p->calls, p->time_ns,
+                p->allocations, p->allocated_bytes);
+
+        for (int j = 0; j < STATS_COUNTERS; j++) {
+            if (counter_fds[j] >= 0) {
+                fprintf(fp, ", \"%s\": %lld", counter_names[j], p->counters[j]);
+            } else {
+                fprintf(fp, ", \"%s\": null", counter_names[j]);
+            }
+        }
+
+        fprintf(fp, "}%s\n", (i + 1 < STATS_PHASES) ? "," : "");
+    }
+
+    fprintf(fp, "  },\n");
+    fprintf(fp, "  \"total\": {\"time_ns\": %lld, \"allocations\": %ld, \"allocated_bytes\": %lld}\n",
+            clock_ns() - run_started_ns, total_allocations, total_allocated_bytes);
+    fprintf(fp, "}\n");
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error: Could not write statistics report %s\n", filename);
+        return 0;
+    }
+
+#ifdef __linux__
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        if (counter_fds[i] >= 0) {
+            close(counter_fds[i]);
+            counter_fds[i] = -1;
+        }
+    }
+#endif
+    counters_available = 0;
+
+    printf("Statistics written to %s\n", filename);
+    return 1;
+}
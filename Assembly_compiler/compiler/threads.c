@@ -0,0 +1,312 @@
+/**
+ * @file threads.c
+ * @brief VM threads for the Assembly Language Compiler
+ *
+ * SPAWN label starts a VM thread at a subroutine, on an OS thread of its
+ * own, and the thread ends when the subroutine returns. Each VM thread has
+ * its own registers and return stack, while the DATA and CONST cells are
+ * shared, so the threads of a program work on the same variables and
+ * synchronize with XADD, CAS and JOIN.
+ *
+ * The main thread keeps its registers in cells 0-7. Every other slot of
+ * the thread group has a register bank past MEMORY_SIZE and runs a copy of
+ * the code whose register operands are moved to that bank, made the first
+ * time the slot is used. The virtual machine therefore runs every thread
+ * with the same flat memory accesses as a single-threaded program.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#endif
+
+/* Input of spawned threads, which always reads as the end of input */
+static const int no_input[1] = { 0 };
+
+/**
+ * @brief Takes the spin lock of a thread group
+ *
+ * The lock only guards claiming and freeing slots, which is brief.
+ *
+ * @param group Thread group
+ */
+static void lock_group(thread_group *group) {
+    while (ATOMIC_CAS(&group->lock, 0, 1) != 0) {
+        /* Spin */
+    }
+}
+
+/**
+ * @brief Releases the spin lock of a thread group
+ *
+ * @param group Thread group
+ */
+static void unlock_group(thread_group *group) {
+    ATOMIC_CAS(&group->lock, 1, 0);
+}
+
+/**
+ * @brief Passes PRINT values to the print function of a thread
+ *
+ * The threads of a group take turns, so the function is never called by
+ * two threads at once.
+ *
+ * @param state State of the printing thread, with a print function
+ * @param values Values printed
+ * @param count Number of values
+ */
+void vm_print(const vm_state *state, const int *values, int count) {
+    thread_group *group = state->threads;
+
+    if (group == NULL) {
+        state->print(state->print_context, values, count);
+        return;
+    }
+
+    while (ATOMIC_CAS(&group->print_lock, 0, 1) != 0) {
+        /* Spin */
+    }
+    state->print(state->print_context, values, count);
+    ATOMIC_CAS(&group->print_lock, 1, 0);
+}
+
+/**
+ * @brief Gets the address of the first register of a slot
+ *
+ * @param slot Slot in the thread group
+ * @return int Address of AX for the thread in the slot
+ */
+static int register_base(int slot) {
+    return (slot == 0) ? 0 : MEMORY_SIZE + (slot - 1) * VARIABLE_MEMORY_START;
+}
+
+/**
+ * @brief Makes the code a slot runs, with its registers in the slot's bank
+ *
+ * @param group Thread group
+ * @param slot Slot in the thread group, not 0
+ * @return intermediate_lang* Code, or NULL if memory allocation failed
+ */
+static intermediate_lang *thread_code(const thread_group *group, int slot) {
+    intermediate_lang *code = (intermediate_lang*)stats_malloc(sizeof(intermediate_lang) * group->code_length);
+    int base = register_base(slot);
+
+    if (code == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for thread code\n");
+        return NULL;
+    }
+
+    for (int i = 0; i < group->code_length; i++) {
+        code[i] = group->code[i];
+
+        for (int j = 0; j < 5; j++) {
+            int value = code[i].parameters[j];
+            if ((operand_kind(code[i].opcode, j) & OPERAND_UPDATE) &&
+                value >= 0 && value < VARIABLE_MEMORY_START) {
+                code[i].parameters[j] = value + base;
+            }
+        }
+    }
+
+    return code;
+}
+
+/**
+ * @brief Runs a spawned VM thread on its OS thread
+ *
+ * A thread waits for the threads it spawned itself before it ends.
+ *
+ * @param argument Slot of the thread
+ */
+#ifdef _WIN32
+static unsigned __stdcall thread_main(void *argument) {
+#else
+static void *thread_main(void *argument) {
+#endif
+    vm_thread *slot = (vm_thread*)argument;
+
+    vm_run(&slot->state, slot->state.threads->memory);
+    join_threads(&slot->state);
+    vm_release(&slot->state);
+    return 0;
+}
+
+/**
+ * @brief Starts a VM thread at a subroutine for SPAWN
+ *
+ * The new thread starts with a copy of the spawning thread's registers
+ * and its own empty return stack, and ends when the subroutine returns.
+ * Spawned threads do not READ input; they see the end of input.
+ *
+ * @param state State of the spawning thread
+ * @param target Index of the first instruction of the subroutine
+ * @return int 1 if the thread was started, 0 otherwise
+ */
+int spawn_thread(vm_state *state, int target) {
+    thread_group *group = state->threads;
+    vm_thread *slot = NULL;
+    int index;
+
+    if (group == NULL) {
+        fprintf(stderr, "Error: SPAWN needs the whole program compiled; it cannot run in lazy mode\n");
+        return 0;
+    }
+
+    lock_group(group);
+    for (index = 1; index < THREAD_MAX; index++) {
+        if (!group->slots[index].active) {
+            slot = &group->slots[index];
+            slot->active = 1;
+            slot->parent = state->thread;
+            break;
+        }
+    }
+    unlock_group(group);
+
+    if (slot == NULL) {
+        fprintf(stderr, "Error: SPAWN found all %d threads running\n", THREAD_MAX);
+        return 0;
+    }
+
+    if (slot->code == NULL) {
+        slot->code = thread_code(group, index);
+    }
+
+    if (slot->code != NULL) {
+        /* The thread starts where the spawning thread is, apart from the call stack */
+        slot->state = *state;
+        slot->state.code = slot->code;
+        slot->state.pc = target;
+        slot->state.executed = 0;
+        slot->state.elapsed_ms = 0;
+        slot->state.return_stack = NULL;
+        slot->state.return_depth = 0;
+        slot->state.input = no_input;
+        slot->state.input_count = 0;
+        slot->state.input_position = 0;
+        slot->state.branches_taken = NULL;
+        slot->state.branch_entries = NULL;
+        slot->state.thread = index;
+
+        memcpy(&group->memory[register_base(index)], &group->memory[register_base(state->thread)],
+               sizeof(int) * VARIABLE_MEMORY_START);
+
+#ifdef _WIN32
+        slot->handle = (thread_handle)_beginthreadex(NULL, 0, thread_main, slot, 0, NULL);
+        if (slot->handle != NULL) {
+            return 1;
+        }
+#else
+        if (pthread_create(&slot->handle, NULL, thread_main, slot) == 0) {
+            return 1;
+        }
+#endif
+        fprintf(stderr, "Error: Could not start an OS thread for SPAWN\n");
+    }
+
+    lock_group(group);
+    slot->active = 0;
+    unlock_group(group);
+    return 0;
+}
+
+/**
+ * @brief Waits for every thread a thread spawned, for JOIN
+ *
+ * Threads that stopped before their end are reported.
+ *
+ * @param state State of the joining thread
+ */
+void join_threads(vm_state *state) {
+    thread_group *group = state->threads;
+    int children[THREAD_MAX];
+    int count = 0;
+
+    if (group == NULL) {
+        return;
+    }
+
+    /* Only this thread spawns its children, so the list cannot grow meanwhile */
+    lock_group(group);
+    for (int i = 1; i < THREAD_MAX; i++) {
+        if (group->slots[i].active && group->slots[i].parent == state->thread) {
+            children[count++] = i;
+        }
+    }
+    unlock_group(group);
+
+    for (int k = 0; k < count; k++) {
+        vm_thread *slot = &group->slots[children[k]];
+
+#ifdef _WIN32
+        WaitForSingleObject(slot->handle, INFINITE);
+        CloseHandle(slot->handle);
+#else
+        pthread_join(slot->handle, NULL);
+#endif
+        report_stop(&slot->state);
+
+        lock_group(group);
+        slot->active = 0;
+        unlock_group(group);
+    }
+}
+
+/**
+ * @brief Runs a program, with a thread group when it can spawn threads
+ *
+ * Programs without SPAWN are run by vm_run directly. Otherwise the memory
+ * array is copied into the shared memory of a thread group for the run,
+ * and the program ends when its main thread and every thread it started
+ * have ended.
+ *
+ * @param state State of the virtual machine, for the main thread
+ * @param memory_array Memory array of MEMORY_SIZE cells
+ * @return int EXEC_* status of the main thread
+ */
+int vm_run_threads(vm_state *state, int *memory_array) {
+    thread_group *group;
+    int spawns = 0;
+
+    for (int i = 0; i < state->code_length && !spawns; i++) {
+        spawns = (state->code[i].opcode == OP_SPAWN);
+    }
+    if (!spawns) {
+        return vm_run(state, memory_array);
+    }
+
+    group = (thread_group*)stats_calloc(1, sizeof(thread_group));
+    if (group != NULL) {
+        group->memory = (int*)stats_calloc(THREAD_MEMORY_SIZE, sizeof(int));
+    }
+    if (group == NULL || group->memory == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for threads\n");
+        free(group);
+        return vm_run(state, memory_array);
+    }
+
+    group->code = state->code;
+    group->code_length = state->code_length;
+    memcpy(group->memory, memory_array, sizeof(int) * MEMORY_SIZE);
+
+    state->threads = group;
+    state->thread = 0;
+    vm_run(state, group->memory);
+
+    /* The program ends when its threads do */
+    join_threads(state);
+    memcpy(memory_array, group->memory, sizeof(int) * MEMORY_SIZE);
+
+    for (int i = 1; i < THREAD_MAX; i++) {
+        free(group->slots[i].code);
+    }
+    free(group->memory);
+    free(group);
+    state->threads = NULL;
+    return state->status;
+}
@@ -0,0 +1,231 @@
+/**
+ * @file verifier.c
+ * @brief Load-time verification for the Assembly Language Compiler
+ *
+ * This file checks the intermediate language table before it is run.
+ * Every operand address must lie within the memory image and every branch
+ * target must be an instruction, so the virtual machine can execute
+ * verified code without checking operands itself.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+/* External variables from main.c */
+extern int symbol_index;
+extern int intermediate_index;
+extern intermediate_lang **intermediate_table;
+extern symbol_table **symbol_tab;
+
+/* Mnemonics by opcode, for diagnostics */
+static const char *opcode_names[] = {
+    "?", "MOV", "MOV", "ADD", "SUB", "MUL", "JUMP", "IF", "EQ", "LT", "GT",
+    "LTEQ", "GTEQ", "PRINT", "READ", "ENDIF", "END", "LOOP", "FOR", "NEXT",
+    "CALL", "RET", "READ", "READ", "PRINT", "COMPILE", "SHL", "LOAD",
+    "IF", "IF", "IF", "IF", "IF", "ADD", "MUL", "IF", "SPAWN", "JOIN", "XADD",
+    "CAS", "TRAP"
+};
+
+/**
+ * @brief Gets the mnemonic of an opcode
+ *
+ * @param opcode Operation code
+ * @return const char* Mnemonic, or "?" for an unknown opcode
+ */
+const char *opcode_name(int opcode) {
+    if (opcode < 0 || opcode >= (int)(sizeof(opcode_names) / sizeof(opcode_names[0]))) {
+        return "?";
+    }
+    return opcode_names[opcode];
+}
+
+/**
+ * @brief Checks whether an opcode can appear in the intermediate table
+ *
+ * @param opcode Operation code
+ * @return int 1 if the virtual machine executes it, 0 otherwise
+ */
+static int is_executable(int opcode) {
+    switch (opcode) {
+        case OP_MOV_MEM_TO_REG:
+        case OP_MOV_REG_TO_MEM:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_JUMP:
+        case OP_IF:
+        case OP_PRINT:
+        case OP_READ:
+        case OP_LOOP:
+        case OP_FOR:
+        case OP_NEXT:
+        case OP_CALL:
+        case OP_RET:
+        case OP_READ_JUMP:
+        case OP_READ_ARRAY:
+        case OP_PRINT_ARRAY:
+        case OP_COMPILE:
+        case OP_SHL:
+        case OP_LOAD_IMM:
+        case OP_IF_EQ:
+        case OP_IF_LT:
+        case OP_IF_GT:
+        case OP_IF_LTEQ:
+        case OP_IF_GTEQ:
+        case OP_IF_NE:
+        case OP_ADD_IMM:
+        case OP_MUL_IMM:
+        case OP_SPAWN:
+        case OP_JOIN:
+        case OP_XADD:
+        case OP_CAS:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Finds the end of the memory image
+ *
+ * The image holds the registers followed by every declared variable.
+ *
+ * @return int First address past the image
+ */
+int memory_image_end(void) {
+    int end = VARIABLE_MEMORY_START;
+
+    for (int i = 0; i < symbol_index; i++) {
+        int size = (symbol_tab[i]->size == CONST_VARIABLE_SIZE) ? 1 : symbol_tab[i]->size;
+        if (symbol_tab[i]->address + size > end) {
+            end = symbol_tab[i]->address + size;
+        }
+    }
+
+    return (end < MEMORY_SIZE) ? end : MEMORY_SIZE;
+}
+
+/**
+ * @brief Checks one instruction
+ *
+ * Each problem is reported on stderr with the instruction number, its
+ * mnemonic and the offending operand.
+ *
+ * @param instr Instruction to check
+ * @param index Index of the instruction
+ * @param length Number of instructions in the program
+ * @param end First address past the memory image
+ * @return int Number of problems found
+ */
+static int verify_instruction(const intermediate_lang *instr, int index, int length, int end) {
+    const char *name = opcode_name(instr->opcode);
+    int errors = 0;
+
+    if (!is_executable(instr->opcode)) {
+        fprintf(stderr, "Error: Instruction %d: unknown opcode %d\n", index + 1, instr->opcode);
+        return 1;
+    }
+
+    for (int j = 0; j < 5; j++) {
+        int kind = operand_kind(instr->opcode, j);
+        int value = instr->parameters[j];
+
+        if (kind & OPERAND_UPDATE) {
+            int cells = operand_cells(instr, j);
+
+            if (value < 0 || value >= end) {
+                fprintf(stderr, "Error: Instruction %d (%s): operand %d refers to address %d, "
+                        "outside the memory image 0-%d\n", index + 1, name, j + 1, value, end - 1);
+                errors++;
+            } else if (cells < 1 || value + cells > end) {
+                fprintf(stderr, "Error: Instruction %d (%s): %d cells from address %d "
+                        "do not fit in the memory image 0-%d\n", index + 1, name, cells, value, end - 1);
+                errors++;
+            }
+        } else if (kind == OPERAND_TARGET) {
+            /* One past the last instruction ends the program */
+            if (value < 1 || value > length + 1) {
+                fprintf(stderr, "Error: Instruction %d (%s): branch target %d is not an "
+                        "instruction (1-%d)\n", index + 1, name, value, length + 1);
+                errors++;
+            }
+        } else if (kind == OPERAND_CONDITION) {
+            if (value < OP_EQ || value > OP_GTEQ) {
+                fprintf(stderr, "Error: Instruction %d (%s): unknown condition %d\n",
+                        index + 1, name, value);
+                errors++;
+            }
+        } else if (kind == OPERAND_IMMEDIATE && instr->opcode == OP_SHL) {
+            if (value < 0 || value > 31) {
+                fprintf(stderr, "Error: Instruction %d (%s): shift count %d is out of range 0-31\n",
+                        index + 1, name, value);
+                errors++;
+            }
+        }
+    }
+
+    return errors;
+}
+
+/**
+ * @brief Checks a range of instructions before they are run
+ *
+ * @param first Index of the first instruction to check
+ * @param last Index of the last instruction to check
+ * @return int Number of problems found, 0 if the instructions can be run
+ */
+int verify_instructions(int first, int last) {
+    int end = memory_image_end();
+    int errors = 0;
+
+    for (int i = first; i <= last; i++) {
+        errors += verify_instruction(intermediate_table[i], i, intermediate_index, end);
+    }
+
+    return errors;
+}
+
+/**
+ * @brief Checks code loaded from a program image
+ *
+ * The image carries no symbol table, so the end of its memory image is
+ * given by the caller. Lazy mode placeholders (OP_COMPILE) are rejected,
+ * since there is no source to compile them from.
+ *
+ * @param code Instructions of the program
+ * @param length Number of instructions
+ * @param end First address past the memory image
+ * @return int Number of problems found, 0 if the code can be run
+ */
+int verify_code(const intermediate_lang *code, int length, int end) {
+    int errors = 0;
+
+    if (end < VARIABLE_MEMORY_START || end > MEMORY_SIZE) {
+        fprintf(stderr, "Error: Memory image of %d cells is not valid\n", end);
+        return 1;
+    }
+
+    for (int i = 0; i < length; i++) {
+        /* Only lazy mode can compile the block behind a placeholder */
+        if (code[i].opcode == OP_COMPILE) {
+            fprintf(stderr, "Error: Instruction %d (COMPILE): lazy placeholder in a program image\n", i + 1);
+            errors++;
+            continue;
+        }
+        errors += verify_instruction(&code[i], i, length, end);
+    }
+
+    return errors;
+}
+
+/**
+ * @brief Checks every instruction of the program before it is run
+ *
+ * @return int Number of problems found, 0 if the program can be run
+ */
+int verify_program(void) {
+    return verify_instructions(0, intermediate_index - 1);
+}
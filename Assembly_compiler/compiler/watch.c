@@ -0,0 +1,514 @@
+/**
+ * @file watch.c
+ * @brief Incremental recompilation for the Assembly Language Compiler
+ *
+ * This file implements watch mode: the source file is polled for changes
+ * and only the lines that changed are recompiled, while the symbol table,
+ * block table and intermediate code stay in memory between builds.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include "FunctionHeaders.h"
+
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* External variables from main.c */
+extern int symbol_index;
+extern int intermediate_index;
+extern int blocks_index;
+extern intermediate_lang **intermediate_table;
+extern blocks_table **block_tab;
+
+/* Source lines of the last build, as read by fgets */
+static char (*source_lines)[LINE_SIZE] = NULL;
+static int source_count = 0;
+
+/* Index of the first instruction generated by each line (source_count + 1 entries) */
+static int *line_instruction = NULL;
+
+static int start_line = -1;     /* Line holding START: */
+static int end_line = -1;       /* Line holding END, or source_count */
+
+static int watch_memory[MEMORY_SIZE];
+static int watch_memory_index = 0;
+
+/* The last build was rejected, so output.obj no longer matches the tables */
+static int output_stale = 0;
+
+/**
+ * @brief Waits for a number of milliseconds
+ *
+ * @param milliseconds Time to wait
+ */
+static void sleep_ms(int milliseconds) {
+#ifdef _WIN32
+    Sleep(milliseconds);
+#else
+    usleep(milliseconds * 1000);
+#endif
+}
+
+/**
+ * @brief Reads a monotonic wall clock
+ *
+ * @return double Milliseconds since an arbitrary starting point
+ */
+static double clock_ms(void) {
+#ifdef _WIN32
+    LARGE_INTEGER now, frequency;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return (double)now.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+#endif
+}
+
+/**
+ * @brief Verifies the program before output.obj is written
+ *
+ * @return int 1 if the program can be written out, 0 if it was rejected
+ */
+static int accept_build(void) {
+    int errors = verify_program();
+
+    if (errors > 0) {
+        fprintf(stderr, "Error: Program rejected, %d problem(s) found; output.obj not updated\n", errors);
+        output_stale = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Reads a source file into memory, one fgets chunk per line
+ *
+ * @param filename File to read
+ * @param lines Receives the lines
+ * @param count Receives the number of lines
+ * @return int 1 on success, 0 on failure
+ */
+static int read_source(const char *filename, char (**lines)[LINE_SIZE], int *count) {
+    FILE *fp = fopen(filename, "r");
+    int capacity = 256;
+
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Could not open file %s\n", filename);
+        return 0;
+    }
+
+    *count = 0;
+    *lines = (char (*)[LINE_SIZE])stats_malloc(sizeof(**lines) * capacity);
+    if (*lines == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for source lines\n");
+        fclose(fp);
+        return 0;
+    }
+
+    while (fgets((*lines)[*count], LINE_SIZE, fp)) {
+        if (++(*count) == capacity) {
+            char (*grown)[LINE_SIZE];
+            capacity *= 2;
+            grown = (char (*)[LINE_SIZE])stats_realloc(*lines, sizeof(**lines) * capacity);
+            if (grown == NULL) {
+                fprintf(stderr, "Error: Memory allocation failed for source lines\n");
+                free(*lines);
+                fclose(fp);
+                return 0;
+            }
+            *lines = grown;
+        }
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+/**
+ * @brief Replaces the stored source with a new version
+ *
+ * @param lines New lines; ownership is taken
+ * @param count Number of new lines
+ * @return int 1 on success, 0 if memory allocation failed
+ */
+static int adopt_source(char (*lines)[LINE_SIZE], int count) {
+    int *instructions = (int*)stats_malloc(sizeof(int) * (count + 1));
+
+    if (instructions == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed for line table\n");
+        free(lines);
+        return 0;
+    }
+
+    free(source_lines);
+    free(line_instruction);
+    source_lines = lines;
+    source_count = count;
+    line_instruction = instructions;
+    return 1;
+}
+
+/**
+ * @brief Compiles the stored source from scratch and writes output.obj
+ *
+ * The program is verified and its IFs are specialized as in a normal
+ * build. The optimizer and CONST immediates are left out: incremental
+ * builds need one instruction per source line, and an edited line may
+ * start writing a CONST cell.
+ *
+ * @return int 1 if output.obj was written, 0 if the program was rejected
+ */
+static int full_build(void) {
+    control_stack stack = { NULL, -1, 0 };
+    int instruction_no = 0;
+    int i = 0;
+
+    symbol_index = 0;
+    intermediate_index = 0;
+    blocks_index = 0;
+    reset_module_symbols();
+    watch_memory_index = VARIABLE_MEMORY_START - 1;
+    start_line = source_count;
+    end_line = source_count;
+
+    /* Process declarations before START */
+    for (; i < source_count; i++) {
+        line_instruction[i] = 0;
+        if (strcmp(source_lines[i], "START:\n") == 0) {
+            start_line = i++;
+            break;
+        }
+        process_declaration(source_lines[i], watch_memory, &watch_memory_index);
+    }
+
+    /* Process instructions after START */
+    for (; i < source_count; i++) {
+        char line[LINE_SIZE];
+
+        line_instruction[i] = intermediate_index;
+        instruction_no++;
+
+        if (!ensure_intermediate_capacity(intermediate_index + 1)) {
+            break;
+        }
+
+        strcpy(line, source_lines[i]);
+        if (compile_instruction(line, &instruction_no, &stack)) {
+            end_line = i++;
+            break;
+        }
+    }
+
+    for (; i <= source_count; i++) {
+        line_instruction[i] = intermediate_index;
+    }
+
+    if (stack.top >= 0) {
+        fprintf(stderr, "Error: Unmatched IF/ELSE/FOR statements\n");
+    }
+    release_control_stack(&stack);
+    resolve_label_fixups();
+    if (!accept_build()) {
+        return 0;
+    }
+
+    specialize_instructions(0, intermediate_index - 1, NULL);
+    dump_to_file();
+    output_stale = 0;
+    return 1;
+}
+
+/**
+ * @brief Checks whether a line compiles to exactly one self-contained instruction
+ *
+ * Such lines can be recompiled on their own: they do not define labels,
+ * refer to labels, or take part in IF/ELSE/ENDIF nesting.
+ *
+ * @param line Source line
+ * @return int 1 if the line is a plain instruction, 0 otherwise
+ */
+static int is_plain_instruction(const char *line) {
+    static const char *plain[] = { "MOV", "ADD", "SUB", "MUL", "PRINT", "READ" };
+    char instruction[INSTRUCTION_LENGTH];
+    size_t length = strlen(line);
+
+    /* Lines longer than LINE_SIZE are split across several chunks */
+    if (length < 2 || line[length - 1] != '\n' || line[length - 2] == ':') {
+        return 0;
+    }
+
+    if (sscanf(line, "%5s", instruction) != 1) {
+        return 0;
+    }
+
+    /* READ with an end-of-input label refers to a label */
+    if (strcmp(instruction, "READ") == 0 && strchr(line, ',') != NULL) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(plain) / sizeof(plain[0]); i++) {
+        if (strcmp(instruction, plain[i]) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Recompiles only the lines that differ from the last build
+ *
+ * The changed region is found by comparing common leading and trailing
+ * lines. It is recompiled in place when every old and new line in it is a
+ * plain instruction inside the instruction section.
+ *
+ * @param lines New source lines; ownership is taken on success
+ * @param count Number of new lines
+ * @param first Receives the first changed line, or -1 if nothing changed
+ * @param last Receives the line after the last changed line
+ * @return int 1 if the build was updated, 0 if a full build is needed
+ */
+static int incremental_build(char (*lines)[LINE_SIZE], int count, int *first, int *last) {
+    int prefix = 0, suffix = 0;
+    int old_end, new_end;
+
+    while (prefix < source_count && prefix < count &&
+           strcmp(source_lines[prefix], lines[prefix]) == 0) {
+        prefix++;
+    }
+    while (suffix < source_count - prefix && suffix < count - prefix &&
+           strcmp(source_lines[source_count - 1 - suffix], lines[count - 1 - suffix]) == 0) {
+        suffix++;
+    }
+    old_end = source_count - suffix;
+    new_end = count - suffix;
+    *first = prefix;
+    *last = new_end;
+
+    if (prefix == old_end && prefix == new_end) {
+        free(lines);
+        *first = *last = -1;
+        return 1;  /* Nothing changed */
+    }
+
+    /* The region must lie inside the instruction section */
+    if (prefix <= start_line || old_end > end_line ||
+        source_lines[prefix - 1][strlen(source_lines[prefix - 1]) - 1] != '\n') {
+        return 0;
+    }
+
+    for (int i = prefix; i < old_end; i++) {
+        if (!is_plain_instruction(source_lines[i])) {
+            return 0;
+        }
+    }
+    for (int i = prefix; i < new_end; i++) {
+        if (!is_plain_instruction(lines[i])) {
+            return 0;
+        }
+    }
+
+    int start = line_instruction[prefix];
+    int old_size = line_instruction[old_end] - start;
+    int new_size = new_end - prefix;
+    int delta = new_size - old_size;
+    int total = intermediate_index;
+    int first_row = start;
+    int threshold = start + old_size;  /* Targets above this move by delta */
+
+    /*
+     * When lines are only inserted, a target that pointed at the insertion
+     * point may come from a label, ELSE or ENDIF just before the new lines
+     * (it should now reach them) or just after them (it should skip them).
+     */
+    if (old_size == 0) {
+        int links_before = !is_plain_instruction(source_lines[prefix - 1]);
+        int links_after = (old_end >= source_count) || !is_plain_instruction(source_lines[old_end]);
+
+        if (links_before && links_after) {
+            return 0;
+        }
+        if (links_before) {
+            threshold = start + 1;
+        }
+    }
+
+    int *instructions = (int*)stats_malloc(sizeof(int) * (count + 1));
+
+    if (instructions == NULL || !ensure_intermediate_capacity(total + new_size)) {
+        free(instructions);
+        return 0;
+    }
+
+    if (delta != 0) {
+        /* Targets and labels after the region move by delta */
+        for (int i = 0; i < total; i++) {
+            if (i >= start && i < start + old_size) {
+                continue;
+            }
+            for (int j = 0; j < 5; j++) {
+                if (operand_kind(intermediate_table[i]->opcode, j) == OPERAND_TARGET &&
+                    intermediate_table[i]->parameters[j] > threshold) {
+                    intermediate_table[i]->parameters[j] += delta;
+                    if (i < first_row) {
+                        first_row = i;
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < blocks_index; i++) {
+            if (block_tab[i]->instr_no > threshold) {
+                block_tab[i]->instr_no += delta;
+            }
+        }
+
+        /* Open or close the gap, keeping every entry allocated */
+        intermediate_lang **moved = (intermediate_lang**)stats_malloc(sizeof(intermediate_lang*) *
+                                                                (delta > 0 ? delta : -delta));
+        if (moved == NULL) {
+            free(instructions);
+            return 0;
+        }
+
+        if (delta > 0) {
+            memcpy(moved, &intermediate_table[total], sizeof(intermediate_lang*) * delta);
+            memmove(&intermediate_table[start + new_size], &intermediate_table[start + old_size],
+                    sizeof(intermediate_lang*) * (total - start - old_size));
+            memcpy(&intermediate_table[start + old_size], moved, sizeof(intermediate_lang*) * delta);
+        } else {
+            memcpy(moved, &intermediate_table[start + new_size], sizeof(intermediate_lang*) * -delta);
+            memmove(&intermediate_table[start + new_size], &intermediate_table[start + old_size],
+                    sizeof(intermediate_lang*) * (total - start - old_size));
+            memcpy(&intermediate_table[total + delta], moved, sizeof(intermediate_lang*) * -delta);
+        }
+        free(moved);
+    }
+
+    /* Compile the new lines into the gap */
+    intermediate_index = start;
+    for (int i = prefix; i < new_end; i++) {
+        char line[LINE_SIZE];
+        control_stack stack = { NULL, -1, 0 };  /* Plain instructions never push */
+        int instruction_no = intermediate_index + 1;
+
+        strcpy(line, lines[i]);
+        compile_instruction(line, &instruction_no, &stack);
+    }
+
+    if (intermediate_index != start + new_size) {
+        intermediate_index = total + delta;
+        free(instructions);
+        return 0;  /* A line failed to compile */
+    }
+    intermediate_index = total + delta;
+
+    if (delta != 0) {
+        for (int i = start + new_size; i < intermediate_index; i++) {
+            intermediate_table[i]->instruc_no = i + 1;
+        }
+    }
+
+    /* Carry the line table over to the new source */
+    for (int i = 0; i < prefix; i++) {
+        instructions[i] = line_instruction[i];
+    }
+    for (int i = prefix; i < new_end; i++) {
+        instructions[i] = start + (i - prefix);
+    }
+    for (int i = new_end; i <= count; i++) {
+        instructions[i] = line_instruction[i - new_end + old_end] + delta;
+    }
+
+    free(source_lines);
+    free(line_instruction);
+    source_lines = lines;
+    source_count = count;
+    line_instruction = instructions;
+    end_line += new_end - old_end;
+
+    if (!accept_build()) {
+        *first = *last = -1;
+        return 1;  /* Reported; output.obj keeps the last good build */
+    }
+    if (output_stale) {
+        dump_to_file();
+        output_stale = 0;
+    } else {
+        update_object_file(first_row, delta == 0 ? start + new_size - 1 : intermediate_index - 1);
+    }
+    return 1;
+}
+
+/**
+ * @brief Recompiles a source file whenever it changes
+ *
+ * The symbol table, block table and intermediate code stay in memory
+ * between builds. When only plain instructions changed, just those lines
+ * are recompiled, later instructions are renumbered, jump targets are
+ * patched and only the affected rows of output.obj are rewritten.
+ * Anything else triggers a full rebuild. A build that fails verification
+ * leaves output.obj as it was. Runs until interrupted.
+ *
+ * @param filename Source file to watch
+ * @return int Exit code
+ */
+int watch_source(const char *filename) {
+    char (*lines)[LINE_SIZE];
+    struct stat info;
+    int count;
+
+    if (stat(filename, &info) != 0 || !read_source(filename, &lines, &count) ||
+        !adopt_source(lines, count)) {
+        return 1;
+    }
+
+    time_t last_modified = info.st_mtime;
+    long last_size = (long)info.st_size;
+
+    full_build();
+    printf("Watching %s for changes (press Ctrl+C to stop)...\n", filename);
+    fflush(stdout);
+
+    for (;;) {
+        sleep_ms(WATCH_POLL_INTERVAL);
+
+        if (stat(filename, &info) != 0 ||
+            (info.st_mtime == last_modified && (long)info.st_size == last_size)) {
+            continue;
+        }
+        last_modified = info.st_mtime;
+        last_size = (long)info.st_size;
+
+        double started = clock_ms();
+        int first, last;
+
+        if (!read_source(filename, &lines, &count)) {
+            continue;
+        }
+
+        if (incremental_build(lines, count, &first, &last)) {
+            if (first < 0) {
+                continue;
+            }
+            printf("Recompiled %d line(s) at line %d in %.2f ms\n", last - first, first + 1,
+                   clock_ms() - started);
+        } else if (adopt_source(lines, count) && full_build()) {
+            printf("Rebuilt %s in %.2f ms\n", filename, clock_ms() - started);
+        }
+        fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file nested_if.c
+ * @brief Stress program generator for IF/ELSE/ENDIF backpatching
+ *
+ * Writes a program with IF/ELSE/ENDIF blocks nested to any depth to
+ * stdout. Each level adds the same number of instructions to both of its
+ * branches, so both the nesting depth and the amount of code the
+ * backpatching has to skip over can be scaled. Every IF is taken, and the
+ * program prints depth * width.
+ *
+ * Usage: nested_if <depth> [width] > stress.asm
+ *
+ * Compile it with the -s option to see the backpatch phase in
+ * output.stats.json. This tool is not part of the compiler build.
+ *
+ * @copyright Copyright (c) 2017 Komma Ravi Teja
+ * @license MIT License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Writes one line a number of times
+ *
+ * @param line Line to write, with its newline
+ * @param count Number of times
+ */
+static void repeat(const char *line, long count) {
+    for (long i = 0; i < count; i++) {
+        fputs(line, stdout);
+    }
+}
+
+/**
+ * @brief Entry point of the generator
+ *
+ * @param argc Argument count
+ * @param argv Argument vector: depth and optional width
+ * @return int Exit status
+ */
+int main(int argc, char *argv[]) {
+    long depth, width = 1;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <depth> [width]\n", argv[0]);
+        return 1;
+    }
+
+    depth = strtol(argv[1], NULL, 10);
+    if (argc == 3) {
+        width = strtol(argv[2], NULL, 10);
+    }
+    if (depth < 1 || width < 0) {
+        fprintf(stderr, "Error: depth must be at least 1 and width at least 0\n");
+        return 1;
+    }
+
+    fputs("DATA A\nCONST Z = 0\nCONST O = 1\nSTART:\nMOV A, Z\n", stdout);
+
+    /* Open every level: its IF and the instructions of its THEN branch */
+    for (long level = 0; level < depth; level++) {
+        fputs("IF Z EQ Z THEN\n", stdout);
+        repeat("ADD A, A, O\n", width);
+    }
+
+    /* Close them from the innermost out; the ELSE branches never run */
+    for (long level = 0; level < depth; level++) {
+        fputs("ELSE\n", stdout);
+        repeat("SUB A, A, O\n", width);
+        fputs("ENDIF\n", stdout);
+    }
+
+    fputs("PRINT A\nEND\n", stdout);
+    return 0;
+}